@@ -6,37 +6,47 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <vector>
+#include <stdexcept>
+#include <typeinfo>
 #include "bst.h"
+#include "fork_join.h"
 
 struct KeyError { };
 
 /**
-* A special kind of node for an AVL tree, which adds the balance as a data member, plus
+* A special kind of node for an AVL tree, which adds the balance, plus
 * other additional helper functions. You do NOT need to implement any functionality or
 * add additional data members or helper functions.
+* The balance lives in the spare bits of the parent link, as a 3-bit two's
+* complement number, so the node is no bigger than a plain Node. That holds
+* -4 to 3, which covers the -2 and 2 the fix-ups pass through.
 */
-template <typename Key, typename Value>
-class AVLNode : public Node<Key, Value>
+template <typename Key, typename Value, typename Links = PointerNodeLinks>
+class AVLNode : public Node<Key, Value, Links>
 {
 public:
     // Constructor/destructor.
-    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
-    virtual ~AVLNode();
+    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Links>* parent);
+    AVLNode(Key&& key, Value&& value, AVLNode<Key, Value, Links>* parent);
+    AVLNode(NodeItemBuilder<Key, Value>& item, AVLNode<Key, Value, Links>* parent);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Getters for parent, left, and right. These need to be redefined since they
+    // Getters for parent, left, and right. These hide the Node versions since they
     // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
     // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    AVLNode<Key, Value, Links>* getParent() const;
+    AVLNode<Key, Value, Links>* getLeft() const;
+    AVLNode<Key, Value, Links>* getRight() const;
 
-protected:
-    int8_t balance_;    // effectively a signed char
+private:
+    static const int BALANCE_SIGN = 1 << (NODE_LINK_TAG_BITS - 1);
+    static const unsigned BALANCE_MASK = (1u << NODE_LINK_TAG_BITS) - 1;
 };
 
 /*
@@ -48,18 +58,47 @@ protected:
 /**
 * An explicit constructor to initialize the elements by calling the base class constructor
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+template<class Key, class Value, class Links>
+AVLNode<Key, Value, Links>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Links> *parent) :
+    Node<Key, Value, Links>(key, value, parent)
+{
+    static_assert(std::is_same<Links, CompactNodeLinks>::value ||
+        alignof(Node<Key, Value, Links>) >= (1u << NODE_LINK_TAG_BITS),
+        "the balance needs the low bits of 8-byte aligned node pointers");
+
+}
+
+/**
+* A constructor that moves the key and value into the node.
+*/
+template<class Key, class Value, class Links>
+AVLNode<Key, Value, Links>::AVLNode(Key&& key, Value&& value, AVLNode<Key, Value, Links> *parent) :
+    Node<Key, Value, Links>(std::move(key), std::move(value), parent)
+{
+    static_assert(std::is_same<Links, CompactNodeLinks>::value ||
+        alignof(Node<Key, Value, Links>) >= (1u << NODE_LINK_TAG_BITS),
+        "the balance needs the low bits of 8-byte aligned node pointers");
+
+}
+
+/**
+* A constructor that has item build the key and value in place.
+*/
+template<class Key, class Value, class Links>
+AVLNode<Key, Value, Links>::AVLNode(NodeItemBuilder<Key, Value>& item, AVLNode<Key, Value, Links> *parent) :
+    Node<Key, Value, Links>(item, parent)
 {
+    static_assert(std::is_same<Links, CompactNodeLinks>::value ||
+        alignof(Node<Key, Value, Links>) >= (1u << NODE_LINK_TAG_BITS),
+        "the balance needs the low bits of 8-byte aligned node pointers");
 
 }
 
 /**
 * A destructor which does nothing.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::~AVLNode()
+template<class Key, class Value, class Links>
+AVLNode<Key, Value, Links>::~AVLNode()
 {
 
 }
@@ -67,56 +106,57 @@ AVLNode<Key, Value>::~AVLNode()
 /**
 * A getter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-int8_t AVLNode<Key, Value>::getBalance() const
+template<class Key, class Value, class Links>
+int8_t AVLNode<Key, Value, Links>::getBalance() const
 {
-    return balance_;
+    //sign-extend the tag
+    return static_cast<int8_t>(static_cast<int>(this->getParentTag() ^ BALANCE_SIGN) - BALANCE_SIGN);
 }
 
 /**
 * A setter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::setBalance(int8_t balance)
+template<class Key, class Value, class Links>
+void AVLNode<Key, Value, Links>::setBalance(int8_t balance)
 {
-    balance_ = balance;
+    this->setParentTag(static_cast<unsigned>(balance) & BALANCE_MASK);
 }
 
 /**
 * Adds diff to the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::updateBalance(int8_t diff)
+template<class Key, class Value, class Links>
+void AVLNode<Key, Value, Links>::updateBalance(int8_t diff)
 {
-    balance_ += diff;
+    setBalance(getBalance() + diff);
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* A getter for the parent that hides the Node version, since a static_cast is necessary
+* to make sure that our node is a AVLNode.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
+template<class Key, class Value, class Links>
+AVLNode<Key, Value, Links> *AVLNode<Key, Value, Links>::getParent() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    return static_cast<AVLNode<Key, Value, Links>*>(Node<Key, Value, Links>::getParent());
 }
 
 /**
-* Overridden for the same reasons as above.
+* Hidden for the same reasons as above.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
+template<class Key, class Value, class Links>
+AVLNode<Key, Value, Links> *AVLNode<Key, Value, Links>::getLeft() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+    return static_cast<AVLNode<Key, Value, Links>*>(Node<Key, Value, Links>::getLeft());
 }
 
 /**
-* Overridden for the same reasons as above.
+* Hidden for the same reasons as above.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
+template<class Key, class Value, class Links>
+AVLNode<Key, Value, Links> *AVLNode<Key, Value, Links>::getRight() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
+    return static_cast<AVLNode<Key, Value, Links>*>(Node<Key, Value, Links>::getRight());
 }
 
 
@@ -127,95 +167,164 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+template <class Key, class Value, class Alloc = std::allocator<std::pair<const Key, Value> >,
+          class Compare = std::less<Key> >
+class AVLTree : public BinarySearchTree<Key, Value, Alloc, Compare>
 {
 public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
+    AVLTree();
+    explicit AVLTree(const Alloc& alloc);
+    explicit AVLTree(const Compare& comp, const Alloc& alloc = Alloc());
+    virtual ~AVLTree();
     virtual void remove(const Key& key);  // TODO
+    void insert_batch(std::vector<std::pair<Key, Value> > batch, bool sorted = false);
+    void erase_batch(std::vector<Key> keys, bool sorted = false);
+    void split(const Key& key, AVLTree& right);
+    void join(AVLTree& right);
+    void set_union(AVLTree& other, ForkJoinPool& pool = defaultForkJoinPool());
+    void set_intersection(AVLTree& other, ForkJoinPool& pool = defaultForkJoinPool());
+    void set_difference(AVLTree& other, ForkJoinPool& pool = defaultForkJoinPool());
+    void build_from_unsorted(std::vector<std::pair<Key, Value> > items, ForkJoinPool& pool = defaultForkJoinPool());
+    void setValidation(bool enabled);
 protected:
-    virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    typedef typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeLinks NodeLinks;
+    typedef typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType NodeType;
+    typedef AVLNode<Key, Value, NodeLinks> AVLNodeType;
+
+    virtual void nodeSwap( AVLNodeType* n1, AVLNodeType* n2);
+    virtual NodeType* createNode(NodeItemBuilder<Key, Value>& item, NodeType* parent);
+    virtual void balanceAfterInsert(NodeType* node);
+    virtual void balanceAfterBuild(NodeType* node, int leftHeight, int rightHeight);
+    virtual void destroyNode(NodeType* node);
+    virtual void updateAfterRotate(AVLNodeType* down, AVLNodeType* up);
+    virtual void updateAfterUnlink(AVLNodeType* parent);
+    virtual void updateAfterRelink(AVLNodeType* node);
 
     // Add helper functions here
-    void insertFix (AVLNode<Key, Value>* p, AVLNode<Key, Value>* n);
-    void rotateRight (AVLNode<Key, Value>* z);
-    void rotateLeft (AVLNode<Key, Value>* z);
-    void removeFix(AVLNode<Key, Value>* n, int8_t diff);
+    void insertFix (AVLNodeType* p, AVLNodeType* n);
+    void rotateRight (AVLNodeType* z);
+    void rotateLeft (AVLNodeType* z);
+    void removeFix(AVLNodeType* n, int8_t diff);
+    void removeNode(AVLNodeType* removed_node);
+    void checkCanExchange(AVLTree& other) const;
+    static int subtreeHeight(AVLNodeType* node);
+    void validateFrom(AVLNodeType* node) const;
+    int validateNode(AVLNodeType* node) const;
+    void checkNode(AVLNodeType* node, int leftHeight, int rightHeight) const;
+    AVLNodeType* joinWithPivot(AVLNodeType* left, int leftHeight, AVLNodeType* pivot,
+                                       AVLNodeType* right, int rightHeight, int& height);
+    bool joinFix(AVLNodeType* n, AVLNodeType* grown);
+    void splitHelper(AVLNodeType* t, int height, const Key& key,
+                     AVLNodeType*& less, int& lessHeight, AVLNodeType*& found,
+                     AVLNodeType*& greater, int& greaterHeight);
+    AVLNodeType* splitLast(AVLNodeType* t, int height, int& restHeight, AVLNodeType*& last);
+    AVLNodeType* joinTwo(AVLNodeType* left, int leftHeight,
+                                 AVLNodeType* right, int rightHeight, int& height);
 
+    // Set operations: each combines two detached subtrees into one, and
+    // collects the detached subtrees it no longer needs in dropped.
+    enum SetOperation { SET_UNION, SET_INTERSECTION, SET_DIFFERENCE };
+    void setOperation(SetOperation op, AVLTree& other, ForkJoinPool& pool);
+    NodeType* parallelBuildHelper(std::pair<Key, Value>* items, std::size_t count, int& height,
+                                          ForkJoinPool& pool);
+    AVLNodeType* setOperationHelper(SetOperation op, AVLNodeType* t1, int height1,
+                                            AVLNodeType* t2, int height2, int& height,
+                                            std::vector<AVLNodeType*>& dropped, ForkJoinPool& pool);
+
+    bool validating_;   // check the nodes each insert and remove touched
 };
 
-/*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
- */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+template<class Key, class Value, class Alloc, class Compare>
+AVLTree<Key, Value, Alloc, Compare>::AVLTree() :
+    validating_(false)
 {
-    // TODO
-    AVLNode<Key, Value>* current_node = static_cast<AVLNode<Key, Value>*>(this->root_);
-    if (BinarySearchTree<Key, Value>::empty()) {
-        AVLNode<Key, Value>* new_node = new AVLNode<Key, Value>(new_item.first, new_item.second, NULL);
-        this->root_ = new_node;
-        new_node->setBalance(0);
-        return;
+
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+AVLTree<Key, Value, Alloc, Compare>::AVLTree(const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Alloc, Compare>(alloc), validating_(false)
+{
+
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+AVLTree<Key, Value, Alloc, Compare>::AVLTree(const Compare& comp, const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Alloc, Compare>(comp, alloc), validating_(false)
+{
+
+}
+
+/**
+* Clears here rather than in the base destructor, where destroyNode
+* would no longer dispatch to the AVLNode version.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+AVLTree<Key, Value, Alloc, Compare>::~AVLTree()
+{
+    this->clear();
+}
+
+/**
+* Insertion itself (including overwriting the value of an existing key) is
+* done by BinarySearchTree::insert and friends; the AVL tree only supplies
+* its node type and the rebalancing below.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename AVLTree<Key, Value, Alloc, Compare>::NodeType*
+AVLTree<Key, Value, Alloc, Compare>::createNode(NodeItemBuilder<Key, Value>& item, NodeType* parent)
+{
+    return this->allocateNode(item, static_cast<AVLNodeType*>(parent));
+}
+
+/**
+* Updates the balance of a newly linked node's parent and fixes the tree.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::balanceAfterInsert(NodeType* node)
+{
+    AVLNodeType *new_node = static_cast<AVLNodeType*>(node);
+    AVLNodeType *parent = new_node->getParent();
+    if (parent == NULL) { //new root
     }
-    else {
-        //BinarySearchTree<Key, Value>::insert(new_item);
-        AVLNode<Key, Value>* parent_node = NULL;
-        while (current_node != NULL) {
-            parent_node = current_node;
-            if (new_item.first == current_node->getKey()) { //key are same
-                current_node->setValue(new_item.second); //update value
-                return;
-            }
-            else if (new_item.first < current_node->getKey()) {
-                current_node = current_node->getLeft();
-            }
-            else if (new_item.first > current_node->getKey()) {
-                current_node = current_node->getRight();
-            }
-            
-        }
-        
-        //update parent node's left or right child
-        if (new_item.first < parent_node->getKey()) {
-            AVLNode<Key, Value>* new_node = new AVLNode<Key, Value>(new_item.first, new_item.second, parent_node); //dynamically create new node
-            parent_node->setLeft(new_node);
-        }
-        else if (new_item.first > parent_node->getKey()) {
-            AVLNode<Key, Value>* new_node = new AVLNode<Key, Value>(new_item.first, new_item.second, parent_node); //dynamically create new node
-            parent_node->setRight(new_node); 
+    else if(parent->getBalance() == 1 || parent->getBalance() == -1) { //parent balance was +- 1
+        parent->setBalance(0);
+    }
+    else if (parent->getBalance() == 0) { //parent balance was 0
+        //update parent balance
+        if (parent->getLeft() == new_node) { //new node was left
+            parent->setBalance(-1);
         }
-        //finish pasted code
-        AVLNode<Key, Value> *new_node = static_cast<AVLNode<Key, Value>*>(this->internalFind(new_item.first));
-        new_node->setBalance(0);
-        if(new_node->getParent()->getBalance() == 1 || new_node->getParent()->getBalance() == -1) { //parent balance was +- 1
-            new_node->getParent()->setBalance(0);
-            return;
+        else { //new node was right
+            parent->setBalance(1);
         }
-        else if (new_node->getParent()->getBalance() == 0) { //parent balance was 0
-            //update parent balance
-            if (new_node->getParent()->getLeft() == NULL) { //new node was right
-                new_node->getParent()->setBalance(1);
-            }
-            else { //new node was left
-                new_node->getParent()->setBalance(-1);
-            }
-            //call insert fix
-            insertFix(new_node->getParent(), new_node);
-        } 
+        //call insert fix
+        insertFix(parent, new_node);
     }
+    if (validating_) {
+        validateFrom(new_node);
+    }
+}
+
+/**
+* Records the balance of a node placed by build_from_sorted.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::balanceAfterBuild(NodeType* node, int leftHeight, int rightHeight)
+{
+    static_cast<AVLNodeType*>(node)->setBalance(rightHeight - leftHeight);
 }
 
 //insert fix helper function
-template<class Key, class Value>
-void AVLTree<Key, Value>::insertFix (AVLNode<Key, Value>* p, AVLNode<Key, Value>* n) {
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::insertFix (AVLNodeType* p, AVLNodeType* n) {
     if (p == NULL || p->getParent() == NULL) {
         return;
     }
-    AVLNode<Key, Value> *g = p->getParent();
+    AVLNodeType *g = p->getParent();
     if (g->getLeft() == p) { //p is left child of g
         g->updateBalance(-1);
+        BST_TRACE_EVENT(TRACE_INSERT_FIX, g, g->getBalance());
         if (g->getBalance() == 0) { //case 1: balance is 0
             return;
         }
@@ -251,6 +360,7 @@ void AVLTree<Key, Value>::insertFix (AVLNode<Key, Value>* p, AVLNode<Key, Value>
     }
     else { //p is right child of g
         g->updateBalance(1);
+        BST_TRACE_EVENT(TRACE_INSERT_FIX, g, g->getBalance());
         if (g->getBalance() == 0) { //case 1: balance is 0
             return;
         }
@@ -288,15 +398,16 @@ void AVLTree<Key, Value>::insertFix (AVLNode<Key, Value>* p, AVLNode<Key, Value>
 }
 
 //helper function
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight (AVLNode<Key, Value>* z) {
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::rotateRight (AVLNodeType* z) {
     if (z == NULL || z->getLeft() == NULL) {
         return;
     }
     
-    AVLNode<Key, Value> *y = z->getLeft();
-    AVLNode<Key, Value> *p = z->getParent();
-    AVLNode<Key, Value> *c = NULL;
+    BST_TRACE_EVENT(TRACE_ROTATE_RIGHT, z, 0);
+    AVLNodeType *y = z->getLeft();
+    AVLNodeType *p = z->getParent();
+    AVLNodeType *c = NULL;
 
     if (y != NULL) {
         c = y->getRight();
@@ -321,21 +432,24 @@ void AVLTree<Key, Value>::rotateRight (AVLNode<Key, Value>* z) {
     }
     else {
         y->setParent(NULL);
-        this->root_ = y;
+        if (this->root_ == z) { //split and join also rotate detached subtrees
+            this->root_ = y;
+        }
     }
-
+    updateAfterRotate(z, y);
 }
 
 //helper function
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft (AVLNode<Key, Value>* z) {
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::rotateLeft (AVLNodeType* z) {
     if (z == NULL || z->getRight() == NULL) {
         return;
     }
     
-    AVLNode<Key, Value> *y = z->getRight();
-    AVLNode<Key, Value> *p = z->getParent();
-    AVLNode<Key, Value> *c = NULL;
+    BST_TRACE_EVENT(TRACE_ROTATE_LEFT, z, 0);
+    AVLNodeType *y = z->getRight();
+    AVLNodeType *p = z->getParent();
+    AVLNodeType *c = NULL;
 
     if (y != NULL) {
         c = y->getLeft();
@@ -360,16 +474,19 @@ void AVLTree<Key, Value>::rotateLeft (AVLNode<Key, Value>* z) {
     }
     else {
         y->setParent(NULL);
-        this->root_ = y;
+        if (this->root_ == z) { //split and join also rotate detached subtrees
+            this->root_ = y;
+        }
     }
+    updateAfterRotate(z, y);
 
     /*
     if (x == NULL) {
         return;
     }
-    AVLNode<Key, Value> *y = x->getRight();
-    AVLNode<Key, Value> *b = y->getLeft();
-    AVLNode<Key, Value> *p = y->getParent();
+    AVLNodeType *y = x->getRight();
+    AVLNodeType *b = y->getLeft();
+    AVLNodeType *p = y->getParent();
     
     //change p's child from x to y
     if (p->getRight() == x) {
@@ -390,22 +507,828 @@ void AVLTree<Key, Value>::rotateLeft (AVLNode<Key, Value>* z) {
  * Recall: The writeup specifies that if a node has 2 children you 
  * should swap with the predecessor and then remove.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>:: remove(const Key& key)
 {
     // TODO
     if (this->root_ == NULL) {
         return;
     }
-    AVLNode<Key, Value> *removed_node = static_cast<AVLNode<Key, Value>*>(this->internalFind(key)); 
+    AVLNodeType *removed_node = static_cast<AVLNodeType*>(this->internalFind(key)); 
     if (removed_node == NULL) {
         return;
     }
-    int8_t diff;
-    AVLNode<Key, Value> *removed_node_parent;
+    removeNode(removed_node);
+}
+
+/**
+* Orders batch items by key only, so a stable sort keeps duplicates in
+* the order they were given.
+*/
+template<class Key, class Value, class Compare>
+struct BatchItemLess
+{
+    explicit BatchItemLess(const Compare& comp) : comp(comp) { }
+
+    bool operator()(const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) const
+    {
+        return comp(a.first, b.first);
+    }
+
+    Compare comp;
+};
+
+/**
+* Inserts every item of batch as insert() would, overwriting existing keys
+* (so among duplicate keys in the batch the last one wins). The batch is
+* sorted first unless the caller says it already is. Walking it in key
+* order, each insert climbs from the previous node only as far as needed
+* instead of descending from the root, which costs O(m log(n/m + 1))
+* comparisons for m items into n.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::insert_batch(std::vector<std::pair<Key, Value> > batch, bool sorted)
+{
+    if (!sorted) {
+        std::stable_sort(batch.begin(), batch.end(), BatchItemLess<Key, Value, Compare>(this->comp_));
+    }
+    NodeType* finger = NULL;
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        NodeType* start = (finger == NULL) ? this->root_ : this->climbToCover(finger, batch[i].first);
+        NodeType* parent;
+        bool left;
+        NodeType* existing = this->findInsertPositionBelow(start, batch[i].first, parent, left);
+        if (existing != NULL) {
+            existing->setValue(std::move(batch[i].second));
+            finger = existing;
+        }
+        else {
+            finger = this->makeNode(std::move(batch[i].first), std::move(batch[i].second), parent);
+            this->linkNode(finger, parent, left);
+        }
+    }
+}
+
+/**
+* Removes every key in keys that is in the tree. Like insert_batch this
+* walks the keys in order, starting each search from where the previous
+* one ended.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::erase_batch(std::vector<Key> keys, bool sorted)
+{
+    if (!sorted) {
+        std::sort(keys.begin(), keys.end(), this->comp_);
+    }
+    NodeType* finger = NULL;
+    for (std::size_t i = 0; i < keys.size() && this->root_ != NULL; ++i) {
+        NodeType* start = (finger == NULL) ? this->root_ : this->climbToCover(finger, keys[i]);
+        NodeType* parent;
+        bool left;
+        NodeType* found = this->findInsertPositionBelow(start, keys[i], parent, left);
+        if (found == NULL) {
+            finger = parent; //where the search fell off the tree
+            continue;
+        }
+        finger = this->successor(found);
+        removeNode(static_cast<AVLNodeType*>(found));
+        if (finger == NULL) {
+            return; //nothing larger is left
+        }
+    }
+}
+
+/**
+* Moves every key that is not less than key into right, replacing whatever
+* right held; this tree keeps the smaller keys. Runs in O(log n): the tree
+* is cut along the search path for key and the pieces on each side are
+* joined back up, so no key is compared or copied more than once.
+* right must be the same kind of tree and share this tree's allocator.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::split(const Key& key, AVLTree& right)
+{
+    checkCanExchange(right);
+    right.clear();
+    AVLNodeType* less;
+    AVLNodeType* found;
+    AVLNodeType* rest;
+    int lessHeight, restHeight;
+    AVLNodeType* root = static_cast<AVLNodeType*>(this->root_);
+    this->root_ = NULL;
+    splitHelper(root, subtreeHeight(root), key, less, lessHeight, found, rest, restHeight);
+    if (found != NULL) { //key itself goes right, as that side's smallest
+        rest = joinWithPivot(NULL, 0, found, rest, restHeight, restHeight);
+    }
+    this->root_ = less;
+    right.root_ = rest;
+    this->rightmost_ = NULL;
+    right.rightmost_ = NULL;
+    if (rest != NULL) { //neither side knows how many keys it got without a recount
+        this->size_ = this->UNKNOWN_SIZE;
+        right.size_ = this->UNKNOWN_SIZE;
+    }
+}
+
+/**
+* Turns on (or off) checking the AVL invariants after every insert and
+* remove. Only the nodes the operation could have changed are checked, so
+* each operation costs O(log^2 n) more rather than the O(n) of a full
+* check, which is cheap enough to leave on outside of tests. A broken invariant throws
+* std::logic_error from the insert or remove that found it.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::setValidation(bool enabled)
+{
+    validating_ = enabled;
+}
+
+/**
+* Checks node and every ancestor, plus their children. Rebalancing only
+* rotates and rebalances nodes on the path from the changed leaf to the
+* root, and rotations move their children, so nothing else can have
+* changed since the last check. Each height on the path is carried up
+* from the one below, so only the children off the path are measured.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::validateFrom(AVLNodeType* node) const
+{
+    AVLNodeType* below = NULL;
+    int belowHeight = 0;
+    while (node != NULL) {
+        AVLNodeType* left = node->getLeft();
+        AVLNodeType* right = node->getRight();
+        int leftHeight = (below != NULL && left == below) ? belowHeight : validateNode(left);
+        int rightHeight = (below != NULL && right == below) ? belowHeight : validateNode(right);
+        checkNode(node, leftHeight, rightHeight);
+        below = node;
+        belowHeight = 1 + std::max(leftHeight, rightHeight);
+        node = node->getParent();
+    }
+    if (below != this->root_) {
+        throw std::logic_error("AVLTree: the root has a parent");
+    }
+}
+
+/**
+* Checks one node against its children and returns its height. The
+* children's heights come from their balances, which is O(log n) and only
+* as good as those balances, so this relies on the subtrees below having
+* been checked already.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+int AVLTree<Key, Value, Alloc, Compare>::validateNode(AVLNodeType* node) const
+{
+    if (node == NULL) {
+        return 0;
+    }
+    int leftHeight = subtreeHeight(node->getLeft());
+    int rightHeight = subtreeHeight(node->getRight());
+    checkNode(node, leftHeight, rightHeight);
+    return 1 + std::max(leftHeight, rightHeight);
+}
+
+/**
+* Checks the links, key order and balance of node, given the heights of
+* its two subtrees.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::checkNode(AVLNodeType* node, int leftHeight, int rightHeight) const
+{
+    AVLNodeType* left = node->getLeft();
+    AVLNodeType* right = node->getRight();
+    if ((left != NULL && left->getParent() != node) || (right != NULL && right->getParent() != node)) {
+        throw std::logic_error("AVLTree: a child does not point back to its parent");
+    }
+    if ((left != NULL && !this->comp_(left->getKey(), node->getKey()))
+        || (right != NULL && !this->comp_(node->getKey(), right->getKey()))) {
+        throw std::logic_error("AVLTree: keys are out of order");
+    }
+    if (node->getBalance() < -1 || node->getBalance() > 1) {
+        throw std::logic_error("AVLTree: a balance is out of range");
+    }
+    if (node->getBalance() != rightHeight - leftHeight) {
+        throw std::logic_error("AVLTree: a balance does not match the subtree heights");
+    }
+}
+
+/**
+* Appends all of right to this tree in O(log n), leaving right empty.
+* Every key in right must be greater than every key here; otherwise
+* std::invalid_argument is thrown and neither tree changes. right must be
+* the same kind of tree and share this tree's allocator.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::join(AVLTree& right)
+{
+    checkCanExchange(right);
+    if (right.root_ == NULL) {
+        return;
+    }
+    if (this->root_ == NULL) {
+        std::swap(this->root_, right.root_);
+        std::swap(this->size_, right.size_);
+        std::swap(this->rightmost_, right.rightmost_);
+        return;
+    }
+    if (!this->comp_(this->getLargestNode()->getKey(), right.getSmallestNode()->getKey())) {
+        throw std::invalid_argument("AVLTree::join: key ranges overlap");
+    }
+    //the largest key here becomes the pivot between the two trees
+    AVLNodeType* root = static_cast<AVLNodeType*>(this->root_);
+    AVLNodeType* rightRoot = static_cast<AVLNodeType*>(right.root_);
+    int height;
+    this->root_ = joinTwo(root, subtreeHeight(root), rightRoot, subtreeHeight(rightRoot), height);
+    if (this->size_ != this->UNKNOWN_SIZE && right.size_ != this->UNKNOWN_SIZE) {
+        this->size_ += right.size_;
+    }
+    else {
+        this->size_ = this->UNKNOWN_SIZE;
+    }
+    this->rightmost_ = right.rightmost_; //right's largest is still the largest
+    right.root_ = NULL;
+    right.size_ = 0;
+    right.rightmost_ = NULL;
+}
+
+/**
+* Nodes can only move to a tree that builds the same node type and can
+* free them, i.e. one whose allocator compares equal.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::checkCanExchange(AVLTree& other) const
+{
+    if (&other == this) {
+        throw std::invalid_argument("AVLTree: cannot split or join a tree with itself");
+    }
+    if (typeid(*this) != typeid(other)) {
+        throw std::invalid_argument("AVLTree: trees hold different node types");
+    }
+    if (!(this->alloc_ == other.alloc_)) {
+        throw std::invalid_argument("AVLTree: trees do not share an allocator");
+    }
+}
+
+/**
+* Height of the subtree at node, read off the balance factors by always
+* stepping to the taller child. O(log n).
+*/
+template<class Key, class Value, class Alloc, class Compare>
+int AVLTree<Key, Value, Alloc, Compare>::subtreeHeight(AVLNodeType* node)
+{
+    int height = 0;
+    while (node != NULL) {
+        ++height;
+        node = (node->getBalance() < 0) ? node->getLeft() : node->getRight();
+    }
+    return height;
+}
+
+/**
+* Links two detached subtrees under pivot, where every key of left is less
+* than pivot's and every key of right is greater, and returns the root of
+* the resulting balanced subtree (whose height is stored in height). If the
+* heights differ by more than one, pivot is hung off the spine of the
+* taller subtree at the matching height and the tree is rebalanced upward
+* from there, so this costs O(|leftHeight - rightHeight| + 1).
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename AVLTree<Key, Value, Alloc, Compare>::AVLNodeType*
+AVLTree<Key, Value, Alloc, Compare>::joinWithPivot(AVLNodeType* left, int leftHeight,
+                                                                AVLNodeType* pivot,
+                                                                AVLNodeType* right, int rightHeight,
+                                                                int& height)
+{
+    if (leftHeight <= rightHeight + 1 && rightHeight <= leftHeight + 1) { //close enough: pivot is the root
+        pivot->setParent(NULL);
+        pivot->setLeft(left);
+        pivot->setRight(right);
+        if (left != NULL) {
+            left->setParent(pivot);
+        }
+        if (right != NULL) {
+            right->setParent(pivot);
+        }
+        pivot->setBalance(rightHeight - leftHeight);
+        updateAfterRelink(pivot);
+        height = 1 + std::max(leftHeight, rightHeight);
+        return pivot;
+    }
+
+    AVLNodeType* top;
+    AVLNodeType* spine;
+    AVLNodeType* parent = NULL;
+    int spineHeight;
+    if (leftHeight > rightHeight) { //walk down left's right spine
+        top = left;
+        spine = left;
+        spineHeight = leftHeight;
+        while (spineHeight > rightHeight + 1) {
+            spineHeight -= (spine->getBalance() < 0) ? 2 : 1;
+            parent = spine;
+            spine = spine->getRight();
+        }
+        pivot->setLeft(spine);
+        pivot->setRight(right);
+        parent->setRight(pivot);
+        pivot->setBalance(rightHeight - spineHeight);
+    }
+    else { //walk down right's left spine
+        top = right;
+        spine = right;
+        spineHeight = rightHeight;
+        while (spineHeight > leftHeight + 1) {
+            spineHeight -= (spine->getBalance() > 0) ? 2 : 1;
+            parent = spine;
+            spine = spine->getLeft();
+        }
+        pivot->setLeft(left);
+        pivot->setRight(spine);
+        parent->setLeft(pivot);
+        pivot->setBalance(spineHeight - leftHeight);
+    }
+    pivot->setParent(parent);
+    if (pivot->getLeft() != NULL) {
+        pivot->getLeft()->setParent(pivot);
+    }
+    if (pivot->getRight() != NULL) {
+        pivot->getRight()->setParent(pivot);
+    }
+    for (AVLNodeType* node = pivot; node != NULL; node = node->getParent()) {
+        updateAfterRelink(node);
+    }
+
+    //pivot's subtree is one taller than the spine subtree it replaced
+    height = std::max(leftHeight, rightHeight);
+    if (joinFix(parent, pivot)) {
+        ++height;
+    }
+    while (top->getParent() != NULL) { //a rotation may have replaced the top
+        top = top->getParent();
+    }
+    return top;
+}
+
+/**
+* Rebalancing for join: grown, a child of n, has just become one taller.
+* Works upward like insertFix, except that the grown child may itself be
+* balanced, which calls for the single rotation that leaves the subtree
+* taller. Returns true if the height of the whole (sub)tree grew.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+bool AVLTree<Key, Value, Alloc, Compare>::joinFix(AVLNodeType* n, AVLNodeType* grown)
+{
+    while (n != NULL) {
+        if (n->getRight() == grown) { //grew on the right
+            n->updateBalance(1);
+            if (n->getBalance() == 0) {
+                return false;
+            }
+            else if (n->getBalance() == 1) {
+                grown = n;
+                n = n->getParent();
+            }
+            else if (grown->getBalance() == 1) { //zig zig
+                rotateLeft(n);
+                n->setBalance(0);
+                grown->setBalance(0);
+                return false;
+            }
+            else if (grown->getBalance() == 0) { //subtree stays one taller
+                rotateLeft(n);
+                n->setBalance(1);
+                grown->setBalance(-1);
+                n = grown->getParent();
+            }
+            else { //zig zag
+                AVLNodeType* g = grown->getLeft();
+                rotateRight(grown);
+                rotateLeft(n);
+                if (g->getBalance() == 1) {
+                    grown->setBalance(0);
+                    n->setBalance(-1);
+                }
+                else if (g->getBalance() == 0) {
+                    grown->setBalance(0);
+                    n->setBalance(0);
+                }
+                else {
+                    grown->setBalance(1);
+                    n->setBalance(0);
+                }
+                g->setBalance(0);
+                return false;
+            }
+        }
+        else { //grew on the left
+            n->updateBalance(-1);
+            if (n->getBalance() == 0) {
+                return false;
+            }
+            else if (n->getBalance() == -1) {
+                grown = n;
+                n = n->getParent();
+            }
+            else if (grown->getBalance() == -1) { //zig zig
+                rotateRight(n);
+                n->setBalance(0);
+                grown->setBalance(0);
+                return false;
+            }
+            else if (grown->getBalance() == 0) { //subtree stays one taller
+                rotateRight(n);
+                n->setBalance(-1);
+                grown->setBalance(1);
+                n = grown->getParent();
+            }
+            else { //zig zag
+                AVLNodeType* g = grown->getRight();
+                rotateLeft(grown);
+                rotateRight(n);
+                if (g->getBalance() == -1) {
+                    grown->setBalance(0);
+                    n->setBalance(1);
+                }
+                else if (g->getBalance() == 0) {
+                    grown->setBalance(0);
+                    n->setBalance(0);
+                }
+                else {
+                    grown->setBalance(-1);
+                    n->setBalance(0);
+                }
+                g->setBalance(0);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+* Splits the detached subtree t (of the given height) into the keys less
+* than key, the node holding key (found, or NULL) and the keys greater than
+* key, returning the two sides as detached subtrees with their heights.
+* Each level cuts t's root loose and joins it, as the pivot, onto the side
+* it belongs to.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::splitHelper(AVLNodeType* t, int height, const Key& key,
+                                             AVLNodeType*& less, int& lessHeight,
+                                             AVLNodeType*& found,
+                                             AVLNodeType*& greater, int& greaterHeight)
+{
+    if (t == NULL) {
+        less = NULL;
+        found = NULL;
+        greater = NULL;
+        lessHeight = 0;
+        greaterHeight = 0;
+        return;
+    }
+    AVLNodeType* left = t->getLeft();
+    AVLNodeType* right = t->getRight();
+    int leftHeight = height - ((t->getBalance() > 0) ? 2 : 1);
+    int rightHeight = height - ((t->getBalance() < 0) ? 2 : 1);
+    if (left != NULL) {
+        left->setParent(NULL);
+    }
+    if (right != NULL) {
+        right->setParent(NULL);
+    }
+    int order = compareKeys(this->comp_, key, t->getKey());
+    if (order > 0) { //t and its left subtree are less than key
+        splitHelper(right, rightHeight, key, less, lessHeight, found, greater, greaterHeight);
+        less = joinWithPivot(left, leftHeight, t, less, lessHeight, lessHeight);
+    }
+    else if (order < 0) { //t and its right subtree are greater
+        splitHelper(left, leftHeight, key, less, lessHeight, found, greater, greaterHeight);
+        greater = joinWithPivot(greater, greaterHeight, t, right, rightHeight, greaterHeight);
+    }
+    else {
+        less = left;
+        lessHeight = leftHeight;
+        greater = right;
+        greaterHeight = rightHeight;
+        found = t;
+        t->setParent(NULL);
+        t->setLeft(NULL);
+        t->setRight(NULL);
+        t->setBalance(0);
+    }
+}
+
+/**
+* Concatenates two detached subtrees, every key of left being less than
+* every key of right, using the largest node of left as the pivot.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename AVLTree<Key, Value, Alloc, Compare>::AVLNodeType*
+AVLTree<Key, Value, Alloc, Compare>::joinTwo(AVLNodeType* left, int leftHeight,
+                                                          AVLNodeType* right, int rightHeight,
+                                                          int& height)
+{
+    if (left == NULL) {
+        height = rightHeight;
+        return right;
+    }
+    if (right == NULL) {
+        height = leftHeight;
+        return left;
+    }
+    AVLNodeType* pivot;
+    AVLNodeType* rest = splitLast(left, leftHeight, leftHeight, pivot);
+    return joinWithPivot(rest, leftHeight, pivot, right, rightHeight, height);
+}
+
+/**
+* Replaces this tree with the union of its keys and other's, leaving other
+* empty. Where both hold a key, other's value wins, as with insert().
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::set_union(AVLTree& other, ForkJoinPool& pool)
+{
+    setOperation(SET_UNION, other, pool);
+}
+
+/**
+* Keeps only the keys that other also holds (with this tree's values), and
+* leaves other empty.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::set_intersection(AVLTree& other, ForkJoinPool& pool)
+{
+    setOperation(SET_INTERSECTION, other, pool);
+}
+
+/**
+* Removes the keys that other holds from this tree, and leaves other empty.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::set_difference(AVLTree& other, ForkJoinPool& pool)
+{
+    setOperation(SET_DIFFERENCE, other, pool);
+}
 
-    //BinarySearchTree<Key, Value>::remove(key);
-    AVLNode<Key, Value>* nodeToRemove = static_cast<AVLNode<Key, Value>*>(this->internalFind(key));
+/**
+* Subtrees shorter than this are combined on the calling thread; below
+* about 2^12 nodes a task is not worth handing to another thread.
+*/
+static const int AVL_PARALLEL_MIN_HEIGHT = 12;
+
+/**
+* The set operations are join based: other's root splits this tree, the
+* two halves are combined with other's subtrees recursively (in parallel,
+* for big enough subtrees), and the results are joined back up. That costs
+* O(m log(n/m + 1)) for trees of m <= n keys, rather than m lookups.
+* Nodes that drop out are freed afterwards on this thread, since the
+* allocator need not be thread-safe. other must be the same kind of tree
+* and share this tree's allocator.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::setOperation(SetOperation op, AVLTree& other, ForkJoinPool& pool)
+{
+    checkCanExchange(other);
+    AVLNodeType* t1 = static_cast<AVLNodeType*>(this->root_);
+    AVLNodeType* t2 = static_cast<AVLNodeType*>(other.root_);
+    this->root_ = NULL;
+    other.root_ = NULL;
+    int height;
+    std::vector<AVLNodeType*> dropped;
+    this->root_ = setOperationHelper(op, t1, subtreeHeight(t1), t2, subtreeHeight(t2), height, dropped, pool);
+
+    this->size_ = this->UNKNOWN_SIZE;
+    other.size_ = 0;
+    this->rightmost_ = NULL;
+    other.rightmost_ = NULL;
+    for (std::size_t i = 0; i < dropped.size(); ++i) {
+        this->clearHelper(dropped[i]);
+    }
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename AVLTree<Key, Value, Alloc, Compare>::AVLNodeType*
+AVLTree<Key, Value, Alloc, Compare>::setOperationHelper(SetOperation op,
+                                                                     AVLNodeType* t1, int height1,
+                                                                     AVLNodeType* t2, int height2,
+                                                                     int& height,
+                                                                     std::vector<AVLNodeType*>& dropped,
+                                                                     ForkJoinPool& pool)
+{
+    if (t1 == NULL || t2 == NULL) {
+        AVLNodeType* kept = (t1 == NULL) ? t2 : t1;
+        int keptHeight = (t1 == NULL) ? height2 : height1;
+        if (op == SET_UNION || (op == SET_DIFFERENCE && kept == t1)) {
+            height = keptHeight;
+            return kept;
+        }
+        if (kept != NULL) {
+            dropped.push_back(kept);
+        }
+        height = 0;
+        return NULL;
+    }
+
+    //cut other's root loose and split this side by its key
+    AVLNodeType* left2 = t2->getLeft();
+    AVLNodeType* right2 = t2->getRight();
+    int leftHeight2 = height2 - ((t2->getBalance() > 0) ? 2 : 1);
+    int rightHeight2 = height2 - ((t2->getBalance() < 0) ? 2 : 1);
+    if (left2 != NULL) {
+        left2->setParent(NULL);
+    }
+    if (right2 != NULL) {
+        right2->setParent(NULL);
+    }
+    t2->setLeft(NULL);
+    t2->setRight(NULL);
+    AVLNodeType* less;
+    AVLNodeType* found;
+    AVLNodeType* greater;
+    int lessHeight, greaterHeight;
+    splitHelper(t1, height1, t2->getKey(), less, lessHeight, found, greater, greaterHeight);
+
+    AVLNodeType* left;
+    AVLNodeType* right;
+    int leftHeight, rightHeight;
+    if (std::min(height1, height2) >= AVL_PARALLEL_MIN_HEIGHT) {
+        std::vector<AVLNodeType*> droppedRight;
+        pool.invoke(
+            [&]() { left = setOperationHelper(op, less, lessHeight, left2, leftHeight2, leftHeight, dropped, pool); },
+            [&]() { right = setOperationHelper(op, greater, greaterHeight, right2, rightHeight2, rightHeight, droppedRight, pool); });
+        dropped.insert(dropped.end(), droppedRight.begin(), droppedRight.end());
+    }
+    else {
+        left = setOperationHelper(op, less, lessHeight, left2, leftHeight2, leftHeight, dropped, pool);
+        right = setOperationHelper(op, greater, greaterHeight, right2, rightHeight2, rightHeight, dropped, pool);
+    }
+
+    AVLNodeType* pivot = NULL;
+    if (op == SET_UNION) { //other's node stays, so its value wins
+        pivot = t2;
+        if (found != NULL) {
+            dropped.push_back(found);
+        }
+    }
+    else if (op == SET_INTERSECTION) {
+        pivot = found;
+        dropped.push_back(t2);
+    }
+    else {
+        dropped.push_back(t2);
+        if (found != NULL) {
+            dropped.push_back(found);
+        }
+    }
+    if (pivot == NULL) {
+        return joinTwo(left, leftHeight, right, rightHeight, height);
+    }
+    return joinWithPivot(left, leftHeight, pivot, right, rightHeight, height);
+}
+
+/**
+* Detaches the node with the largest key from the detached subtree t,
+* returning it in last, and returns the rest of t rebalanced.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename AVLTree<Key, Value, Alloc, Compare>::AVLNodeType*
+AVLTree<Key, Value, Alloc, Compare>::splitLast(AVLNodeType* t, int height,
+                                                            int& restHeight, AVLNodeType*& last)
+{
+    AVLNodeType* left = t->getLeft();
+    int leftHeight = height - ((t->getBalance() > 0) ? 2 : 1);
+    if (left != NULL) {
+        left->setParent(NULL);
+    }
+    if (t->getRight() == NULL) {
+        last = t;
+        t->setLeft(NULL);
+        restHeight = leftHeight;
+        return left;
+    }
+    AVLNodeType* right = t->getRight();
+    int rightHeight = height - ((t->getBalance() < 0) ? 2 : 1);
+    right->setParent(NULL);
+    AVLNodeType* rest = splitLast(right, rightHeight, rightHeight, last);
+    return joinWithPivot(left, leftHeight, t, rest, rightHeight, restHeight);
+}
+
+/**
+* Items per task in build_from_unsorted: sorting, deduplicating and building
+* below this size stays on one thread.
+*/
+static const std::size_t AVL_PARALLEL_BUILD_GRAIN = 1 << 14;
+
+/**
+* Replaces the contents of the tree with items, in any order, using every
+* thread of pool. Where a key appears more than once the last one wins, as
+* if the items had been inserted in order. The items are stable-sorted in
+* parallel, deduplicated in parallel chunks, and linked into the same
+* perfectly balanced tree that build_from_sorted makes, with the subtrees
+* built concurrently. Nodes are only created on several threads if the
+* allocator is thread-safe (see allocator_is_thread_safe); otherwise that
+* last step runs on this thread. Key and Value must be default
+* constructible, for the sort's scratch space. As with build_from_sorted,
+* if building a node throws the tree is left empty.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::build_from_unsorted(std::vector<std::pair<Key, Value> > items, ForkJoinPool& pool)
+{
+    std::vector<std::pair<Key, Value> > buffer;
+    parallelStableSort(items, buffer, BatchItemLess<Key, Value, Compare>(this->comp_), pool, AVL_PARALLEL_BUILD_GRAIN);
+
+    //an item survives if the next one has a different key, i.e. it wrote last
+    std::size_t n = items.size();
+    std::size_t chunks = (n + AVL_PARALLEL_BUILD_GRAIN - 1) / AVL_PARALLEL_BUILD_GRAIN;
+    std::vector<std::size_t> offsets(chunks + 1, 0);
+    parallelFor(pool, 0, chunks, 1, [&](std::size_t lo, std::size_t hi) {
+        for (std::size_t c = lo; c < hi; ++c) {
+            std::size_t end = std::min(n, (c + 1) * AVL_PARALLEL_BUILD_GRAIN);
+            for (std::size_t i = c * AVL_PARALLEL_BUILD_GRAIN; i < end; ++i) {
+                if (i + 1 == n || this->comp_(items[i].first, items[i + 1].first)) {
+                    ++offsets[c + 1];
+                }
+            }
+        }
+    });
+    for (std::size_t c = 0; c < chunks; ++c) {
+        offsets[c + 1] += offsets[c];
+    }
+    parallelFor(pool, 0, chunks, 1, [&](std::size_t lo, std::size_t hi) {
+        for (std::size_t c = lo; c < hi; ++c) {
+            std::size_t out = offsets[c];
+            std::size_t end = std::min(n, (c + 1) * AVL_PARALLEL_BUILD_GRAIN);
+            for (std::size_t i = c * AVL_PARALLEL_BUILD_GRAIN; i < end; ++i) {
+                if (i + 1 == n || this->comp_(items[i].first, items[i + 1].first)) {
+                    buffer[out++] = std::move(items[i]);
+                }
+            }
+        }
+    });
+    std::size_t unique = offsets[chunks];
+
+    if (!allocator_is_thread_safe<Alloc>::value) {
+        this->build_from_sorted(std::make_move_iterator(buffer.begin()),
+                                std::make_move_iterator(buffer.begin() + unique));
+        return;
+    }
+    this->clear();
+    this->size_ = this->UNKNOWN_SIZE; //nodes are counted below, not as each is made
+    int height;
+    this->root_ = parallelBuildHelper(buffer.data(), unique, height, pool);
+    this->size_ = unique;
+}
+
+/**
+* Parallel counterpart of buildHelper: the two halves around the middle
+* item are built as separate tasks, down to AVL_PARALLEL_BUILD_GRAIN items.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename AVLTree<Key, Value, Alloc, Compare>::NodeType*
+AVLTree<Key, Value, Alloc, Compare>::parallelBuildHelper(std::pair<Key, Value>* items, std::size_t count,
+                                                                 int& height, ForkJoinPool& pool)
+{
+    if (count <= AVL_PARALLEL_BUILD_GRAIN) {
+        std::move_iterator<std::pair<Key, Value>*> next(items);
+        return this->buildHelper(next, count, height);
+    }
+    std::size_t leftCount = count / 2;
+    NodeType* left = NULL;
+    NodeType* right = NULL;
+    NodeType* node;
+    int leftHeight, rightHeight;
+    try {
+        pool.invoke([&]() { left = parallelBuildHelper(items, leftCount, leftHeight, pool); },
+                    [&]() { right = parallelBuildHelper(items + leftCount + 1, count - leftCount - 1, rightHeight, pool); });
+        node = this->makeNode(std::move(items[leftCount].first),
+                              std::move(items[leftCount].second), NULL);
+    }
+    catch (...) { //a half that threw has freed its own nodes; the other one is freed here
+        this->clearHelper(left);
+        this->clearHelper(right);
+        throw;
+    }
+    node->setLeft(left);
+    left->setParent(node);
+    node->setRight(right);
+    right->setParent(node);
+    this->balanceAfterBuild(node, leftHeight, rightHeight);
+    height = 1 + std::max(leftHeight, rightHeight);
+    return node;
+}
+
+/**
+* Unlinks and frees a node that is known to be in the tree, then rebalances.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::removeNode(AVLNodeType* removed_node)
+{
+    int8_t diff = 0;
+    AVLNodeType *removed_node_parent = NULL;
+
+    //BinarySearchTree<Key, Value, Alloc, Compare>::remove(key);
+    AVLNodeType* nodeToRemove = removed_node;
+    this->trackUnlinked(nodeToRemove);
     if (nodeToRemove->getLeft() == NULL && nodeToRemove->getRight() == NULL) { //0 children
         removed_node_parent = removed_node->getParent(); 
         if (removed_node_parent != NULL) { //parent of removed node exists    
@@ -427,7 +1350,7 @@ void AVLTree<Key, Value>:: remove(const Key& key)
                 nodeToRemove->getParent()->setRight(nullptr);
             }
         }
-        delete nodeToRemove;
+        destroyNode(nodeToRemove);
     }
     else if (nodeToRemove->getLeft() == NULL || nodeToRemove->getRight() == NULL){ //1 child
         removed_node_parent = removed_node->getParent(); 
@@ -439,7 +1362,7 @@ void AVLTree<Key, Value>:: remove(const Key& key)
                 diff = -1;
             }
         }
-        AVLNode<Key, Value>* child;
+        AVLNodeType* child;
         if (nodeToRemove->getLeft() == nullptr) {
             child = nodeToRemove->getRight();
         } 
@@ -459,10 +1382,10 @@ void AVLTree<Key, Value>:: remove(const Key& key)
             }
             child->setParent(nodeToRemove->getParent());
         }
-        delete nodeToRemove;
+        destroyNode(nodeToRemove);
     }
     else { //2 children
-        nodeSwap(nodeToRemove,static_cast<AVLNode<Key,Value>*>(this->predecessor(nodeToRemove))); //swap node with predecessor
+        nodeSwap(nodeToRemove,static_cast<AVLNodeType*>(this->predecessor(nodeToRemove))); //swap node with predecessor
         //then it will fall in one of the above 2 cases
         removed_node_parent = removed_node->getParent(); 
         if (removed_node_parent != NULL) { //parent of removed node exists    
@@ -485,10 +1408,10 @@ void AVLTree<Key, Value>:: remove(const Key& key)
                     nodeToRemove->getParent()->setRight(nullptr);
                 }
             }
-            delete nodeToRemove;
+            destroyNode(nodeToRemove);
         }
         else if (nodeToRemove->getLeft() == NULL || nodeToRemove->getRight() == NULL){ //1 child
-            Node<Key, Value>* child;
+            NodeType* child;
             if (nodeToRemove->getLeft() == nullptr) {
                 child = nodeToRemove->getRight();
             } 
@@ -508,28 +1431,29 @@ void AVLTree<Key, Value>:: remove(const Key& key)
                 }
                 child->setParent(nodeToRemove->getParent());
             }
-            delete nodeToRemove;
+            destroyNode(nodeToRemove);
         }
     }
 
-
-    std::cout << "removing " << key << std::endl;
-    std::cout << "before fix" << std::endl;
-    this->print();
+    updateAfterUnlink(removed_node_parent);
     removeFix(removed_node_parent, diff);
+    if (validating_) {
+        validateFrom(removed_node_parent != NULL ? removed_node_parent
+                                                 : static_cast<AVLNodeType*>(this->root_));
+    }
 
 }
 
 //remove helper function
-template<class Key, class Value>
-void AVLTree<Key, Value>:: removeFix(AVLNode<Key, Value>* n, int8_t diff) {
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>:: removeFix(AVLNodeType* n, int8_t diff) {
     //if n is null, return
     if (n == NULL) {
         return;
     }
     //compute next recursive call's arguments now before altering tree
-    AVLNode<Key, Value>* p = n->getParent();
-    int8_t nextdiff;
+    AVLNodeType* p = n->getParent();
+    int8_t nextdiff = 0;
     if (p != NULL) {
         if (p->getLeft() == n) { //if n is left child next diff = 1
             nextdiff = 1;
@@ -538,12 +1462,11 @@ void AVLTree<Key, Value>:: removeFix(AVLNode<Key, Value>* n, int8_t diff) {
             nextdiff = -1;
         }
     }
+    BST_TRACE_EVENT(TRACE_REMOVE_FIX, n, n->getBalance() + diff);
     //diff = -1
     if (diff == -1) {
-        std::cout << n->getKey() << std::endl;
         if (n->getBalance() + diff == -2) { //case 1
-            std::cout << "-2 case" << std::endl;
-            AVLNode<Key, Value>* c = n->getLeft();
+            AVLNodeType* c = n->getLeft();
             if (c->getBalance() == -1) { //case 1a
                 rotateRight(n);
                 n->setBalance(0);
@@ -557,7 +1480,7 @@ void AVLTree<Key, Value>:: removeFix(AVLNode<Key, Value>* n, int8_t diff) {
                 return;
             }
             else { //case 1c
-                AVLNode<Key, Value>* g = c->getRight();
+                AVLNodeType* g = c->getRight();
                 rotateLeft(c);
                 rotateRight(n);
                 if (g->getBalance() == 1) {
@@ -579,12 +1502,10 @@ void AVLTree<Key, Value>:: removeFix(AVLNode<Key, Value>* n, int8_t diff) {
             }
         }
         else if (n->getBalance() + diff == -1) { //case 2
-            std::cout << "-1 case" << std::endl;
             n->setBalance(-1);
             return;
         }
         else { //case 3
-            std::cout << "0 case" << std::endl;
             n->setBalance(0);
             removeFix(p, nextdiff);
         }
@@ -592,8 +1513,7 @@ void AVLTree<Key, Value>:: removeFix(AVLNode<Key, Value>* n, int8_t diff) {
     //diff = 1
     else{
         if (n->getBalance() + diff == 2) { //case 1
-            std::cout << "2 case" << std::endl;
-            AVLNode<Key, Value>* c = n->getRight();
+            AVLNodeType* c = n->getRight();
             if (c->getBalance() == 1) { //case 1a
                 rotateLeft(n);
                 n->setBalance(0);
@@ -607,7 +1527,7 @@ void AVLTree<Key, Value>:: removeFix(AVLNode<Key, Value>* n, int8_t diff) {
                 return;
             }
             else { //case 1c
-                AVLNode<Key, Value>* g = c->getLeft();
+                AVLNodeType* g = c->getLeft();
                 rotateRight(c);
                 rotateLeft(n);
                 if (g->getBalance() == -1) {
@@ -629,26 +1549,60 @@ void AVLTree<Key, Value>:: removeFix(AVLNode<Key, Value>* n, int8_t diff) {
             }
         }
         else if (n->getBalance() + diff == 1) { //case 2
-            std::cout << "1 case" << std::endl;
             n->setBalance(1);
             return;
         }
         else { //case 
-            std::cout << " right 0 case" << std::endl;
             n->setBalance(0);
             removeFix(p, nextdiff);
         }
     }
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::nodeSwap( AVLNodeType* n1, AVLNodeType* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    BinarySearchTree<Key, Value, Alloc, Compare>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
 }
 
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::destroyNode(NodeType* node)
+{
+    this->deallocateNode(static_cast<AVLNodeType*>(node));
+}
+
+/**
+* Called once a rotation has moved down below up, for trees that keep
+* more per-node data than the balance. Nothing to do here.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::updateAfterRotate(AVLNodeType* down, AVLNodeType* up)
+{
+
+}
+
+/**
+* Called when node has been given new children outside of a rotation, as
+* split and join do. Nothing to do here.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::updateAfterRelink(AVLNodeType* node)
+{
+
+}
+
+/**
+* Called when removal has unlinked a node from parent (NULL if it was the
+* root), before removeFix rebalances. Nothing to do here.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void AVLTree<Key, Value, Alloc, Compare>::updateAfterUnlink(AVLNodeType* parent)
+{
+
+}
+
 
 #endif
@@ -0,0 +1,1067 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "bst_trace.h"
+
+#if defined(__GNUC__) && (defined(__SSE2__) || defined(__AVX2__))
+#include <immintrin.h>
+#define BPLUS_SIMD_32 1
+#endif
+#if defined(__GNUC__) && (defined(__SSE4_2__) || defined(__AVX2__))
+#define BPLUS_SIMD_64 1
+#endif
+
+/**
+ * The cache line size B+ tree nodes are laid out for.
+ */
+static const std::size_t BPLUS_CACHE_LINE = 64;
+
+/**
+ * Keys per B+ tree node: two cache lines' worth for 4- and 8-byte keys,
+ * and never fewer than 8. Always even, so a node that has to merge
+ * always fits in one.
+ */
+template <typename Key>
+struct bplus_node_keys
+{
+    static const unsigned value = sizeof(Key) <= 4 ? 32 : sizeof(Key) <= 8 ? 16 : 8;
+};
+
+/**
+ * How BPlusTree searches inside a node. countLess returns how many of
+ * the first n keys are less than key (the lower bound in a leaf), and
+ * countNotGreater how many are not greater than key (the child to
+ * descend into). This version runs binary searches; integer keys use the
+ * SIMD versions below when the build allows.
+ */
+template <typename Key, typename Enable = void>
+struct BPlusKeySearch
+{
+    template<std::size_t Capacity>
+    static unsigned countLess(const Key (&keys)[Capacity], unsigned n, const Key& key)
+    {
+        return static_cast<unsigned>(std::lower_bound(keys, keys + n, key) - keys);
+    }
+
+    template<std::size_t Capacity>
+    static unsigned countNotGreater(const Key (&keys)[Capacity], unsigned n, const Key& key)
+    {
+        return static_cast<unsigned>(std::upper_bound(keys, keys + n, key) - keys);
+    }
+};
+
+#if defined(BPLUS_SIMD_32) || defined(BPLUS_SIMD_64)
+/**
+ * Shared part of the SIMD searches: every key of the node, used or not,
+ * is compared at once and the result comes back as a bit mask, of which
+ * only the first n bits count. There is no branch on the keys at all.
+ */
+template <typename Key>
+struct BPlusSimdCount
+{
+    template<typename Search, std::size_t Capacity>
+    static unsigned countLess(const Key (&keys)[Capacity], unsigned n, const Key& key)
+    {
+        return __builtin_popcountll(Search::template compareMask<true>(keys, key) & firstBits(n));
+    }
+
+    template<typename Search, std::size_t Capacity>
+    static unsigned countNotGreater(const Key (&keys)[Capacity], unsigned n, const Key& key)
+    {
+        return n - __builtin_popcountll(Search::template compareMask<false>(keys, key) & firstBits(n));
+    }
+
+    static uint64_t firstBits(unsigned n)
+    {
+        return n >= 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+    }
+};
+#endif
+
+#if defined(BPLUS_SIMD_32)
+/**
+ * 4-byte integers: 8 keys per AVX2 compare, or 4 per SSE2 compare.
+ * The compare instructions are signed, so unsigned keys get their top
+ * bit flipped on both sides first, which keeps the order.
+ */
+template <typename Key>
+struct BPlusKeySearch<Key, typename std::enable_if<std::is_integral<Key>::value && sizeof(Key) == 4>::type>
+{
+    template<std::size_t Capacity>
+    static unsigned countLess(const Key (&keys)[Capacity], unsigned n, const Key& key)
+    {
+        return BPlusSimdCount<Key>::template countLess<BPlusKeySearch>(keys, n, key);
+    }
+
+    template<std::size_t Capacity>
+    static unsigned countNotGreater(const Key (&keys)[Capacity], unsigned n, const Key& key)
+    {
+        return BPlusSimdCount<Key>::template countNotGreater<BPlusKeySearch>(keys, n, key);
+    }
+
+    // bit j is set if keys[j] < key (Less) or keys[j] > key (!Less)
+    template<bool Less, std::size_t Capacity>
+    static uint64_t compareMask(const Key (&keys)[Capacity], const Key& key)
+    {
+        const uint32_t flip = std::is_signed<Key>::value ? 0 : 0x80000000u;
+        uint64_t mask = 0;
+#if defined(__AVX2__)
+        static_assert(Capacity % 8 == 0, "node capacity must fill whole AVX2 registers");
+        const __m256i bias = _mm256_set1_epi32(static_cast<int32_t>(flip));
+        const __m256i k = _mm256_set1_epi32(static_cast<int32_t>(static_cast<uint32_t>(key) ^ flip));
+        for (std::size_t i = 0; i < Capacity; i += 8) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), bias);
+            __m256i c = Less ? _mm256_cmpgt_epi32(k, v) : _mm256_cmpgt_epi32(v, k);
+            mask |= uint64_t(static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(c)))) << i;
+        }
+#else
+        static_assert(Capacity % 4 == 0, "node capacity must fill whole SSE registers");
+        const __m128i bias = _mm_set1_epi32(static_cast<int32_t>(flip));
+        const __m128i k = _mm_set1_epi32(static_cast<int32_t>(static_cast<uint32_t>(key) ^ flip));
+        for (std::size_t i = 0; i < Capacity; i += 4) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), bias);
+            __m128i c = Less ? _mm_cmpgt_epi32(k, v) : _mm_cmpgt_epi32(v, k);
+            mask |= uint64_t(static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(c)))) << i;
+        }
+#endif
+        return mask;
+    }
+};
+#endif
+
+#if defined(BPLUS_SIMD_64)
+/**
+ * 8-byte integers: 4 keys per AVX2 compare, or 2 per SSE4.2 compare.
+ * Unsigned keys are flipped as for 4-byte ones.
+ */
+template <typename Key>
+struct BPlusKeySearch<Key, typename std::enable_if<std::is_integral<Key>::value && sizeof(Key) == 8>::type>
+{
+    template<std::size_t Capacity>
+    static unsigned countLess(const Key (&keys)[Capacity], unsigned n, const Key& key)
+    {
+        return BPlusSimdCount<Key>::template countLess<BPlusKeySearch>(keys, n, key);
+    }
+
+    template<std::size_t Capacity>
+    static unsigned countNotGreater(const Key (&keys)[Capacity], unsigned n, const Key& key)
+    {
+        return BPlusSimdCount<Key>::template countNotGreater<BPlusKeySearch>(keys, n, key);
+    }
+
+    template<bool Less, std::size_t Capacity>
+    static uint64_t compareMask(const Key (&keys)[Capacity], const Key& key)
+    {
+        const uint64_t flip = std::is_signed<Key>::value ? 0 : 0x8000000000000000ull;
+        uint64_t mask = 0;
+#if defined(__AVX2__)
+        static_assert(Capacity % 4 == 0, "node capacity must fill whole AVX2 registers");
+        const __m256i bias = _mm256_set1_epi64x(static_cast<long long>(flip));
+        const __m256i k = _mm256_set1_epi64x(static_cast<long long>(static_cast<uint64_t>(key) ^ flip));
+        for (std::size_t i = 0; i < Capacity; i += 4) {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), bias);
+            __m256i c = Less ? _mm256_cmpgt_epi64(k, v) : _mm256_cmpgt_epi64(v, k);
+            mask |= uint64_t(static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(c)))) << i;
+        }
+#else
+        static_assert(Capacity % 2 == 0, "node capacity must fill whole SSE registers");
+        const __m128i bias = _mm_set1_epi64x(static_cast<long long>(flip));
+        const __m128i k = _mm_set1_epi64x(static_cast<long long>(static_cast<uint64_t>(key) ^ flip));
+        for (std::size_t i = 0; i < Capacity; i += 2) {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), bias);
+            __m128i c = Less ? _mm_cmpgt_epi64(k, v) : _mm_cmpgt_epi64(v, k);
+            mask |= uint64_t(static_cast<unsigned>(_mm_movemask_pd(_mm_castsi128_pd(c)))) << i;
+        }
+#endif
+        return mask;
+    }
+};
+#endif
+
+/**
+ * The part every B+ tree node has: its sorted keys. The nodes are plain
+ * data; BPlusTree does all of the bookkeeping. Keys past count_ are
+ * value-initialized and never read for their value.
+ *
+ * The keys come first and start on a cache line, so for 4- and 8-byte
+ * keys the search inside a node reads exactly two whole lines. A node
+ * spans more lines than that: count_ and the children (or the values
+ * and leaf links) follow the keys, and only the line holding the slot
+ * the search picked is read from them. A 16-key inner node is five
+ * lines, and a leaf with 8-byte values five as well.
+ */
+template <typename Key, typename Value>
+class BPlusNode
+{
+public:
+    static const unsigned CAPACITY = bplus_node_keys<Key>::value;
+
+    BPlusNode() : keys_(), count_(0) { }
+
+    alignas(BPLUS_CACHE_LINE) Key keys_[CAPACITY];
+    unsigned count_;
+};
+
+/**
+ * A leaf holds the items, with the values in their own array so the keys
+ * stay packed for the search. Leaves are chained in key order.
+ */
+template <typename Key, typename Value>
+class BPlusLeaf : public BPlusNode<Key, Value>
+{
+public:
+    BPlusLeaf() : values_(), prev_(NULL), next_(NULL) { }
+
+    Value values_[BPlusNode<Key, Value>::CAPACITY];
+    BPlusLeaf<Key, Value>* prev_;
+    BPlusLeaf<Key, Value>* next_;
+};
+
+/**
+ * An inner node with count_ keys has count_ + 1 children. keys_[i]
+ * separates children_[i], whose keys are all smaller, from
+ * children_[i + 1], whose keys are all greater or equal.
+ */
+template <typename Key, typename Value>
+class BPlusInner : public BPlusNode<Key, Value>
+{
+public:
+    BPlusInner() : children_() { }
+
+    BPlusNode<Key, Value>* children_[BPlusNode<Key, Value>::CAPACITY + 1];
+};
+
+/**
+ * A B+ tree with the same map interface as BinarySearchTree and AVLTree.
+ *
+ * Each node holds up to bplus_node_keys keys (16 for 8-byte keys), so a
+ * lookup touches a handful of nodes instead of one node per level of a
+ * binary tree, and each node's keys share two cache lines. Integer keys
+ * are searched inside a node with SIMD compares (SSE2/SSE4.2, or AVX2
+ * when the build targets it, see ARCH in the Makefile). All items live
+ * in the leaves, which are linked, so iterating is a sequential walk.
+ * Nodes other than the root are kept at least half full.
+ *
+ * Key and Value must be default constructible, since nodes hold arrays
+ * of them. Iterators yield pairs of references, as the keys and values
+ * are stored apart: it->first and it->second work, but there is no pair
+ * object to take the address of. An insert or remove invalidates every
+ * iterator, since items shift within and between nodes.
+ */
+template <typename Key, typename Value, typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class BPlusTree
+{
+public:
+    typedef Alloc allocator_type;
+    class iterator;
+
+    BPlusTree();
+    explicit BPlusTree(const Alloc& alloc);
+    ~BPlusTree();
+
+    std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair);
+    std::pair<iterator, bool> insert(std::pair<const Key, Value>&& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+
+    bool empty() const;
+    std::size_t size() const;
+    allocator_type getAllocator() const;
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+
+    /**
+    * A bidirectional iterator over the items in key order. Decrementing
+    * end() gives the largest item.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key&, Value&> reference;
+
+        /**
+        * What operator-> hands out: holds the item so that
+        * it->first can reach into it.
+        */
+        class pointer
+        {
+        public:
+            const reference* operator->() const { return &item_; }
+        private:
+            friend class iterator;
+            explicit pointer(const reference& item) : item_(item) { }
+            reference item_;
+        };
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BPlusTree<Key, Value, Alloc>;
+        iterator(BPlusLeaf<Key, Value>* leaf, unsigned index, const BPlusTree<Key, Value, Alloc>* tree);
+        BPlusLeaf<Key, Value>* leaf_;   // NULL for end()
+        unsigned index_;
+        const BPlusTree<Key, Value, Alloc>* tree_;
+    };
+
+protected:
+    typedef BPlusNode<Key, Value> NodeType;
+    typedef BPlusLeaf<Key, Value> LeafType;
+    typedef BPlusInner<Key, Value> InnerType;
+    typedef BPlusKeySearch<Key> Search;
+
+    static const unsigned CAPACITY = NodeType::CAPACITY;
+    static const unsigned MIN_KEYS = CAPACITY / 2;   // for every node but the root
+    static const int MAX_HEIGHT = 48;                // fan-out >= 5 bounds the height well below this
+
+    LeafType* descend(const Key& key, InnerType** path, unsigned* slots) const;
+    iterator iteratorAt(LeafType* leaf, unsigned index) const;
+    template<typename V>
+    std::pair<iterator, bool> insertHelper(const Key& key, V&& value);
+    iterator splitLeaf(LeafType* leaf, unsigned pos, const Key& key, Value&& value,
+                       InnerType** path, unsigned* slots);
+    void insertIntoParent(InnerType** path, unsigned* slots, int level, Key separator, NodeType* right);
+    bool rebalanceLeaf(LeafType* leaf, InnerType* parent, unsigned slot);
+    bool rebalanceInner(InnerType* node, InnerType* parent, unsigned slot);
+    static void removeChild(InnerType* parent, unsigned keyIndex, unsigned childIndex);
+    void unlinkLeaf(LeafType* leaf);
+    void clearHelper(NodeType* node, int height);
+
+    template<typename NodeT>
+    NodeT* allocateNode();
+    template<typename NodeT>
+    void deallocateNode(NodeT* node);
+
+protected:
+    NodeType* root_;
+    int height_;             // levels, counting the leaves; 0 when empty
+    std::size_t size_;
+    LeafType* first_;        // leftmost and rightmost leaves
+    LeafType* last_;
+    Alloc alloc_;
+
+private:
+    BPlusTree(const BPlusTree&);
+    BPlusTree& operator=(const BPlusTree&);
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the BPlusTree::iterator class.
+  -----------------------------------------------------
+*/
+
+template<class Key, class Value, class Alloc>
+BPlusTree<Key, Value, Alloc>::iterator::iterator() :
+    leaf_(NULL),
+    index_(0),
+    tree_(NULL)
+{
+
+}
+
+template<class Key, class Value, class Alloc>
+BPlusTree<Key, Value, Alloc>::iterator::iterator(BPlusLeaf<Key, Value>* leaf, unsigned index,
+                                                 const BPlusTree<Key, Value, Alloc>* tree) :
+    leaf_(leaf),
+    index_(index),
+    tree_(tree)
+{
+
+}
+
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::iterator::reference
+BPlusTree<Key, Value, Alloc>::iterator::operator*() const
+{
+    return reference(leaf_->keys_[index_], leaf_->values_[index_]);
+}
+
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::iterator::pointer
+BPlusTree<Key, Value, Alloc>::iterator::operator->() const
+{
+    return pointer(**this);
+}
+
+template<class Key, class Value, class Alloc>
+bool BPlusTree<Key, Value, Alloc>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+template<class Key, class Value, class Alloc>
+bool BPlusTree<Key, Value, Alloc>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::iterator&
+BPlusTree<Key, Value, Alloc>::iterator::operator++()
+{
+    if (leaf_ == NULL) {
+        return *this;
+    }
+    if (++index_ == leaf_->count_) {
+        leaf_ = leaf_->next_;
+        index_ = 0;
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::iterator
+BPlusTree<Key, Value, Alloc>::iterator::operator++(int)
+{
+    iterator old = *this;
+    ++*this;
+    return old;
+}
+
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::iterator&
+BPlusTree<Key, Value, Alloc>::iterator::operator--()
+{
+    if (leaf_ == NULL) {
+        if (tree_ == NULL || tree_->last_ == NULL) { //end() of an empty tree stays end()
+            return *this;
+        }
+        leaf_ = tree_->last_;
+        index_ = leaf_->count_ - 1;
+    }
+    else if (index_ == 0) {
+        leaf_ = leaf_->prev_;
+        index_ = leaf_->count_ - 1;
+    }
+    else {
+        --index_;
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::iterator
+BPlusTree<Key, Value, Alloc>::iterator::operator--(int)
+{
+    iterator old = *this;
+    --*this;
+    return old;
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the BPlusTree::iterator class.
+  ---------------------------------------------------
+*/
+
+/*
+  -------------------------------------------
+  Begin implementations for the BPlusTree class.
+  -------------------------------------------
+*/
+
+template<class Key, class Value, class Alloc>
+BPlusTree<Key, Value, Alloc>::BPlusTree() :
+    root_(NULL),
+    height_(0),
+    size_(0),
+    first_(NULL),
+    last_(NULL)
+{
+
+}
+
+template<class Key, class Value, class Alloc>
+BPlusTree<Key, Value, Alloc>::BPlusTree(const Alloc& alloc) :
+    root_(NULL),
+    height_(0),
+    size_(0),
+    first_(NULL),
+    last_(NULL),
+    alloc_(alloc)
+{
+
+}
+
+template<class Key, class Value, class Alloc>
+BPlusTree<Key, Value, Alloc>::~BPlusTree()
+{
+    clear();
+}
+
+template<class Key, class Value, class Alloc>
+bool BPlusTree<Key, Value, Alloc>::empty() const
+{
+    return size_ == 0;
+}
+
+template<class Key, class Value, class Alloc>
+std::size_t BPlusTree<Key, Value, Alloc>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::allocator_type
+BPlusTree<Key, Value, Alloc>::getAllocator() const
+{
+    return alloc_;
+}
+
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::iterator
+BPlusTree<Key, Value, Alloc>::begin() const
+{
+    return iteratorAt(first_, 0);
+}
+
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::iterator
+BPlusTree<Key, Value, Alloc>::end() const
+{
+    return iterator(NULL, 0, this);
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::iterator
+BPlusTree<Key, Value, Alloc>::find(const Key& key) const
+{
+    if (root_ == NULL) {
+        return end();
+    }
+    LeafType* leaf = descend(key, NULL, NULL);
+    unsigned pos = Search::countLess(leaf->keys_, leaf->count_, key);
+    if (pos == leaf->count_ || key < leaf->keys_[pos]) {
+        BST_TRACE_EVENT(TRACE_LOOKUP, leaf, 0);
+        return end();
+    }
+    BST_TRACE_EVENT(TRACE_LOOKUP, leaf, 1);
+    return iterator(leaf, pos, this);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none.
+*/
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::iterator
+BPlusTree<Key, Value, Alloc>::lower_bound(const Key& key) const
+{
+    if (root_ == NULL) {
+        return end();
+    }
+    LeafType* leaf = descend(key, NULL, NULL);
+    return iteratorAt(leaf, Search::countLess(leaf->keys_, leaf->count_, key));
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or end() if there is none.
+*/
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::iterator
+BPlusTree<Key, Value, Alloc>::upper_bound(const Key& key) const
+{
+    if (root_ == NULL) {
+        return end();
+    }
+    LeafType* leaf = descend(key, NULL, NULL);
+    return iteratorAt(leaf, Search::countNotGreater(leaf->keys_, leaf->count_, key));
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<class Key, class Value, class Alloc>
+Value& BPlusTree<Key, Value, Alloc>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it.leaf_->values_[it.index_];
+}
+
+template<class Key, class Value, class Alloc>
+Value const & BPlusTree<Key, Value, Alloc>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it.leaf_->values_[it.index_];
+}
+
+/**
+* Inserts the item, or overwrites the value if the key is already in the
+* tree. Returns an iterator to the item and whether the key was new.
+*/
+template<class Key, class Value, class Alloc>
+std::pair<typename BPlusTree<Key, Value, Alloc>::iterator, bool>
+BPlusTree<Key, Value, Alloc>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    return insertHelper(keyValuePair.first, keyValuePair.second);
+}
+
+template<class Key, class Value, class Alloc>
+std::pair<typename BPlusTree<Key, Value, Alloc>::iterator, bool>
+BPlusTree<Key, Value, Alloc>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    return insertHelper(keyValuePair.first, std::move(keyValuePair.second));
+}
+
+/**
+* Walks down to the leaf for key, remembering the path, and puts the item
+* there. A full leaf is split in two and the split is passed up the path.
+*/
+template<class Key, class Value, class Alloc>
+template<typename V>
+std::pair<typename BPlusTree<Key, Value, Alloc>::iterator, bool>
+BPlusTree<Key, Value, Alloc>::insertHelper(const Key& key, V&& value)
+{
+    if (root_ == NULL) {
+        LeafType* leaf = allocateNode<LeafType>();
+        leaf->keys_[0] = key;
+        leaf->values_[0] = std::forward<V>(value);
+        leaf->count_ = 1;
+        root_ = first_ = last_ = leaf;
+        height_ = 1;
+        size_ = 1;
+        return std::make_pair(iterator(leaf, 0, this), true);
+    }
+    InnerType* path[MAX_HEIGHT];
+    unsigned slots[MAX_HEIGHT];
+    LeafType* leaf = descend(key, path, slots);
+    unsigned pos = Search::countLess(leaf->keys_, leaf->count_, key);
+    if (pos < leaf->count_ && !(key < leaf->keys_[pos])) { //key is already here
+        leaf->values_[pos] = std::forward<V>(value);
+        return std::make_pair(iterator(leaf, pos, this), false);
+    }
+    ++size_;
+    if (leaf->count_ == CAPACITY) {
+        Value moved(std::forward<V>(value));
+        return std::make_pair(splitLeaf(leaf, pos, key, std::move(moved), path, slots), true);
+    }
+    std::move_backward(leaf->keys_ + pos, leaf->keys_ + leaf->count_, leaf->keys_ + leaf->count_ + 1);
+    std::move_backward(leaf->values_ + pos, leaf->values_ + leaf->count_, leaf->values_ + leaf->count_ + 1);
+    leaf->keys_[pos] = key;
+    leaf->values_[pos] = std::forward<V>(value);
+    ++leaf->count_;
+    return std::make_pair(iterator(leaf, pos, this), true);
+}
+
+/**
+* Splits a full leaf to make room for key at pos: the upper half moves to
+* a new leaf to its right, the item goes into whichever half it belongs
+* to, and the new leaf's first key becomes the separator in the parent.
+*/
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::iterator
+BPlusTree<Key, Value, Alloc>::splitLeaf(LeafType* leaf, unsigned pos, const Key& key, Value&& value,
+                                        InnerType** path, unsigned* slots)
+{
+    LeafType* right = allocateNode<LeafType>();
+    const unsigned leftCount = (CAPACITY + 1) / 2; //of the CAPACITY + 1 items
+    unsigned from = (pos < leftCount) ? leftCount - 1 : leftCount;
+    std::move(leaf->keys_ + from, leaf->keys_ + CAPACITY, right->keys_);
+    std::move(leaf->values_ + from, leaf->values_ + CAPACITY, right->values_);
+    right->count_ = CAPACITY - from;
+    leaf->count_ = from;
+
+    LeafType* target = (pos < leftCount) ? leaf : right;
+    unsigned at = (pos < leftCount) ? pos : pos - leftCount;
+    std::move_backward(target->keys_ + at, target->keys_ + target->count_, target->keys_ + target->count_ + 1);
+    std::move_backward(target->values_ + at, target->values_ + target->count_, target->values_ + target->count_ + 1);
+    target->keys_[at] = key;
+    target->values_[at] = std::move(value);
+    ++target->count_;
+
+    right->prev_ = leaf;
+    right->next_ = leaf->next_;
+    if (leaf->next_ != NULL) {
+        leaf->next_->prev_ = right;
+    }
+    else {
+        last_ = right;
+    }
+    leaf->next_ = right;
+
+    insertIntoParent(path, slots, height_ - 2, right->keys_[0], right);
+    return iterator(target, at, this);
+}
+
+/**
+* Adds separator and the node right of it to the inner node at level of
+* the path, just after the child the path went through. A full inner node
+* splits around its middle key, which moves up a level in turn; splitting
+* the root grows the tree by a level.
+*/
+template<class Key, class Value, class Alloc>
+void BPlusTree<Key, Value, Alloc>::insertIntoParent(InnerType** path, unsigned* slots, int level,
+                                                    Key separator, NodeType* right)
+{
+    for (; level >= 0; --level) {
+        InnerType* node = path[level];
+        unsigned slot = slots[level];
+        if (node->count_ < CAPACITY) {
+            std::move_backward(node->keys_ + slot, node->keys_ + node->count_, node->keys_ + node->count_ + 1);
+            std::move_backward(node->children_ + slot + 1, node->children_ + node->count_ + 1,
+                               node->children_ + node->count_ + 2);
+            node->keys_[slot] = std::move(separator);
+            node->children_[slot + 1] = right;
+            ++node->count_;
+            return;
+        }
+        //lay out all CAPACITY + 1 keys and CAPACITY + 2 children, then cut
+        Key keys[CAPACITY + 1];
+        NodeType* children[CAPACITY + 2];
+        std::move(node->keys_, node->keys_ + slot, keys);
+        keys[slot] = std::move(separator);
+        std::move(node->keys_ + slot, node->keys_ + CAPACITY, keys + slot + 1);
+        std::copy(node->children_, node->children_ + slot + 1, children);
+        children[slot + 1] = right;
+        std::copy(node->children_ + slot + 1, node->children_ + CAPACITY + 1, children + slot + 2);
+
+        const unsigned mid = (CAPACITY + 1) / 2;
+        InnerType* sibling = allocateNode<InnerType>();
+        std::move(keys, keys + mid, node->keys_);
+        std::copy(children, children + mid + 1, node->children_);
+        node->count_ = mid;
+        std::move(keys + mid + 1, keys + CAPACITY + 1, sibling->keys_);
+        std::copy(children + mid + 1, children + CAPACITY + 2, sibling->children_);
+        sibling->count_ = CAPACITY - mid;
+
+        separator = std::move(keys[mid]);
+        right = sibling;
+    }
+    InnerType* root = allocateNode<InnerType>();
+    root->keys_[0] = std::move(separator);
+    root->children_[0] = root_;
+    root->children_[1] = right;
+    root->count_ = 1;
+    root_ = root;
+    ++height_;
+}
+
+/**
+* Removes key if it is in the tree. A leaf left less than half full takes
+* an item from a sibling that can spare one, or else merges with it; a
+* merge takes a key out of the parent, which may then need the same fix,
+* up to the root. A root left with a single child is dropped.
+*/
+template<class Key, class Value, class Alloc>
+void BPlusTree<Key, Value, Alloc>::remove(const Key& key)
+{
+    if (root_ == NULL) {
+        return;
+    }
+    InnerType* path[MAX_HEIGHT];
+    unsigned slots[MAX_HEIGHT];
+    LeafType* leaf = descend(key, path, slots);
+    unsigned pos = Search::countLess(leaf->keys_, leaf->count_, key);
+    if (pos == leaf->count_ || key < leaf->keys_[pos]) {
+        return; //key mismatch
+    }
+    std::move(leaf->keys_ + pos + 1, leaf->keys_ + leaf->count_, leaf->keys_ + pos);
+    std::move(leaf->values_ + pos + 1, leaf->values_ + leaf->count_, leaf->values_ + pos);
+    --leaf->count_;
+    --size_;
+
+    if (height_ == 1) {
+        if (leaf->count_ == 0) {
+            deallocateNode(leaf);
+            root_ = NULL;
+            first_ = last_ = NULL;
+            height_ = 0;
+        }
+        return;
+    }
+    if (leaf->count_ >= MIN_KEYS || !rebalanceLeaf(leaf, path[height_ - 2], slots[height_ - 2])) {
+        return;
+    }
+    for (int level = height_ - 2; level > 0; --level) { //a merge took a key from path[level]
+        if (path[level]->count_ >= MIN_KEYS ||
+            !rebalanceInner(path[level], path[level - 1], slots[level - 1])) {
+            return;
+        }
+    }
+    InnerType* root = static_cast<InnerType*>(root_);
+    if (root->count_ == 0) {
+        root_ = root->children_[0];
+        deallocateNode(root);
+        --height_;
+    }
+}
+
+/**
+* Refills leaf, the child at slot of parent, from a sibling. Returns true
+* if it had to merge, which takes a key out of parent.
+*/
+template<class Key, class Value, class Alloc>
+bool BPlusTree<Key, Value, Alloc>::rebalanceLeaf(LeafType* leaf, InnerType* parent, unsigned slot)
+{
+    LeafType* left = (slot > 0) ? static_cast<LeafType*>(parent->children_[slot - 1]) : NULL;
+    LeafType* right = (slot < parent->count_) ? static_cast<LeafType*>(parent->children_[slot + 1]) : NULL;
+    if (left != NULL && left->count_ > MIN_KEYS) { //take left's largest
+        std::move_backward(leaf->keys_, leaf->keys_ + leaf->count_, leaf->keys_ + leaf->count_ + 1);
+        std::move_backward(leaf->values_, leaf->values_ + leaf->count_, leaf->values_ + leaf->count_ + 1);
+        --left->count_;
+        leaf->keys_[0] = std::move(left->keys_[left->count_]);
+        leaf->values_[0] = std::move(left->values_[left->count_]);
+        ++leaf->count_;
+        parent->keys_[slot - 1] = leaf->keys_[0];
+        return false;
+    }
+    if (right != NULL && right->count_ > MIN_KEYS) { //take right's smallest
+        leaf->keys_[leaf->count_] = std::move(right->keys_[0]);
+        leaf->values_[leaf->count_] = std::move(right->values_[0]);
+        ++leaf->count_;
+        std::move(right->keys_ + 1, right->keys_ + right->count_, right->keys_);
+        std::move(right->values_ + 1, right->values_ + right->count_, right->values_);
+        --right->count_;
+        parent->keys_[slot] = right->keys_[0];
+        return false;
+    }
+    if (left != NULL) { //merge into left
+        std::move(leaf->keys_, leaf->keys_ + leaf->count_, left->keys_ + left->count_);
+        std::move(leaf->values_, leaf->values_ + leaf->count_, left->values_ + left->count_);
+        left->count_ += leaf->count_;
+        unlinkLeaf(leaf);
+        deallocateNode(leaf);
+        removeChild(parent, slot - 1, slot);
+    }
+    else { //merge right into this one
+        std::move(right->keys_, right->keys_ + right->count_, leaf->keys_ + leaf->count_);
+        std::move(right->values_, right->values_ + right->count_, leaf->values_ + leaf->count_);
+        leaf->count_ += right->count_;
+        unlinkLeaf(right);
+        deallocateNode(right);
+        removeChild(parent, slot, slot + 1);
+    }
+    return true;
+}
+
+/**
+* Same as rebalanceLeaf for an inner node. Keys pass through the parent:
+* the separator comes down into the node and the sibling's key nearest to
+* it goes up in its place, along with the child between them.
+*/
+template<class Key, class Value, class Alloc>
+bool BPlusTree<Key, Value, Alloc>::rebalanceInner(InnerType* node, InnerType* parent, unsigned slot)
+{
+    InnerType* left = (slot > 0) ? static_cast<InnerType*>(parent->children_[slot - 1]) : NULL;
+    InnerType* right = (slot < parent->count_) ? static_cast<InnerType*>(parent->children_[slot + 1]) : NULL;
+    if (left != NULL && left->count_ > MIN_KEYS) {
+        std::move_backward(node->keys_, node->keys_ + node->count_, node->keys_ + node->count_ + 1);
+        std::move_backward(node->children_, node->children_ + node->count_ + 1, node->children_ + node->count_ + 2);
+        node->keys_[0] = std::move(parent->keys_[slot - 1]);
+        node->children_[0] = left->children_[left->count_];
+        parent->keys_[slot - 1] = std::move(left->keys_[left->count_ - 1]);
+        --left->count_;
+        ++node->count_;
+        return false;
+    }
+    if (right != NULL && right->count_ > MIN_KEYS) {
+        node->keys_[node->count_] = std::move(parent->keys_[slot]);
+        node->children_[node->count_ + 1] = right->children_[0];
+        parent->keys_[slot] = std::move(right->keys_[0]);
+        std::move(right->keys_ + 1, right->keys_ + right->count_, right->keys_);
+        std::move(right->children_ + 1, right->children_ + right->count_ + 1, right->children_);
+        --right->count_;
+        ++node->count_;
+        return false;
+    }
+    if (left == NULL) { //merge right into node instead of node into left
+        left = node;
+        node = right;
+        ++slot;
+    }
+    left->keys_[left->count_] = std::move(parent->keys_[slot - 1]);
+    std::move(node->keys_, node->keys_ + node->count_, left->keys_ + left->count_ + 1);
+    std::copy(node->children_, node->children_ + node->count_ + 1, left->children_ + left->count_ + 1);
+    left->count_ += node->count_ + 1;
+    deallocateNode(node);
+    removeChild(parent, slot - 1, slot);
+    return true;
+}
+
+/**
+* Closes the gap left in parent by a merged-away child.
+*/
+template<class Key, class Value, class Alloc>
+void BPlusTree<Key, Value, Alloc>::removeChild(InnerType* parent, unsigned keyIndex, unsigned childIndex)
+{
+    std::move(parent->keys_ + keyIndex + 1, parent->keys_ + parent->count_, parent->keys_ + keyIndex);
+    std::copy(parent->children_ + childIndex + 1, parent->children_ + parent->count_ + 1,
+              parent->children_ + childIndex);
+    --parent->count_;
+}
+
+template<class Key, class Value, class Alloc>
+void BPlusTree<Key, Value, Alloc>::unlinkLeaf(LeafType* leaf)
+{
+    if (leaf->prev_ != NULL) {
+        leaf->prev_->next_ = leaf->next_;
+    }
+    else {
+        first_ = leaf->next_;
+    }
+    if (leaf->next_ != NULL) {
+        leaf->next_->prev_ = leaf->prev_;
+    }
+    else {
+        last_ = leaf->prev_;
+    }
+}
+
+/**
+* Walks from the root to the leaf whose range holds key. If path is given,
+* it receives the inner nodes passed through and slots the child taken
+* at each.
+*/
+template<class Key, class Value, class Alloc>
+BPlusLeaf<Key, Value>* BPlusTree<Key, Value, Alloc>::descend(const Key& key, InnerType** path, unsigned* slots) const
+{
+    NodeType* node = root_;
+    for (int level = 0; level + 1 < height_; ++level) {
+        InnerType* inner = static_cast<InnerType*>(node);
+        unsigned slot = Search::countNotGreater(inner->keys_, inner->count_, key);
+        if (path != NULL) {
+            path[level] = inner;
+            slots[level] = slot;
+        }
+        node = inner->children_[slot];
+    }
+    return static_cast<LeafType*>(node);
+}
+
+/**
+* An iterator to item index of leaf, where index may be one past the
+* leaf's last item (meaning the next leaf's first).
+*/
+template<class Key, class Value, class Alloc>
+typename BPlusTree<Key, Value, Alloc>::iterator
+BPlusTree<Key, Value, Alloc>::iteratorAt(LeafType* leaf, unsigned index) const
+{
+    if (leaf != NULL && index == leaf->count_) {
+        leaf = leaf->next_;
+        index = 0;
+    }
+    return iterator(leaf, index, this);
+}
+
+/**
+* Frees every node.
+*/
+template<class Key, class Value, class Alloc>
+void BPlusTree<Key, Value, Alloc>::clear()
+{
+    if (root_ != NULL) {
+        clearHelper(root_, height_);
+    }
+    root_ = NULL;
+    height_ = 0;
+    size_ = 0;
+    first_ = last_ = NULL;
+}
+
+/**
+* Frees the subtree of the given height at node. The recursion is only as
+* deep as the tree, which stays shallow.
+*/
+template<class Key, class Value, class Alloc>
+void BPlusTree<Key, Value, Alloc>::clearHelper(NodeType* node, int height)
+{
+    if (height == 1) {
+        deallocateNode(static_cast<LeafType*>(node));
+        return;
+    }
+    InnerType* inner = static_cast<InnerType*>(node);
+    for (unsigned i = 0; i <= inner->count_; ++i) {
+        clearHelper(inner->children_[i], height - 1);
+    }
+    deallocateNode(inner);
+}
+
+/**
+* Allocates and default-constructs a node of type NodeT through the tree's
+* allocator. Nodes are aligned to a cache line, which ::operator new does
+* not promise before C++17, so the node is cut out of a byte buffer with a
+* line of slack in front; how far in it starts (1 to BPLUS_CACHE_LINE
+* bytes) is kept in the byte just before it, for deallocateNode.
+*/
+template<class Key, class Value, class Alloc>
+template<typename NodeT>
+NodeT* BPlusTree<Key, Value, Alloc>::allocateNode()
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<unsigned char> ByteAlloc;
+    typedef std::allocator_traits<ByteAlloc> ByteTraits;
+    static_assert(alignof(NodeT) <= BPLUS_CACHE_LINE, "nodes are aligned to at most a cache line");
+    ByteAlloc byteAlloc(alloc_);
+    unsigned char* buffer = ByteTraits::allocate(byteAlloc, sizeof(NodeT) + BPLUS_CACHE_LINE);
+    std::size_t offset = BPLUS_CACHE_LINE - reinterpret_cast<std::uintptr_t>(buffer) % BPLUS_CACHE_LINE;
+    NodeT* node = reinterpret_cast<NodeT*>(buffer + offset);
+    buffer[offset - 1] = static_cast<unsigned char>(offset);
+    try {
+        ByteTraits::construct(byteAlloc, node);
+    }
+    catch (...) {
+        ByteTraits::deallocate(byteAlloc, buffer, sizeof(NodeT) + BPLUS_CACHE_LINE);
+        throw;
+    }
+    BST_TRACE_EVENT(TRACE_NODE_ALLOC, node, sizeof(NodeT));
+    return node;
+}
+
+/**
+* Destructs a node of type NodeT and hands its buffer back to the allocator.
+*/
+template<class Key, class Value, class Alloc>
+template<typename NodeT>
+void BPlusTree<Key, Value, Alloc>::deallocateNode(NodeT* node)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<unsigned char> ByteAlloc;
+    typedef std::allocator_traits<ByteAlloc> ByteTraits;
+    ByteAlloc byteAlloc(alloc_);
+    BST_TRACE_EVENT(TRACE_NODE_FREE, node, sizeof(NodeT));
+    unsigned char* start = reinterpret_cast<unsigned char*>(node);
+    unsigned char* buffer = start - start[-1];
+    ByteTraits::destroy(byteAlloc, node);
+    ByteTraits::deallocate(byteAlloc, buffer, sizeof(NodeT) + BPLUS_CACHE_LINE);
+}
+
+/*
+  -----------------------------------------
+  End implementations for the BPlusTree class.
+  -----------------------------------------
+*/
+
+#endif
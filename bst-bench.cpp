@@ -0,0 +1,1212 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include "bst.h"
+#include "avlbst.h"
+#include "ranked_avl.h"
+#include "bplustree.h"
+#include "persistent_avl.h"
+#include "concurrent_avl.h"
+#include "sharded_avl.h"
+#include "splay_tree.h"
+
+using namespace std;
+
+typedef AVLTree<uint64_t, uint64_t, NodePool<std::pair<const uint64_t, uint64_t> > > PooledAVL;
+typedef RankedAVLTree<uint64_t, uint64_t, NodePool<std::pair<const uint64_t, uint64_t> > > PooledRankedAVL;
+
+// the same 32-bit pairs with pointer links, in a node pool, and with
+// compact index links
+typedef AVLTree<uint32_t, uint32_t, NodePool<std::pair<const uint32_t, uint32_t> > > PooledPointerAVL;
+typedef AVLTree<uint32_t, uint32_t, NodeIndexAllocator<std::pair<const uint32_t, uint32_t> > > CompactAVL;
+
+/**
+ * Wall-clock stopwatch for the benchmarks below.
+ */
+class Stopwatch
+{
+public:
+    Stopwatch() : start_(chrono::steady_clock::now()) { }
+    double seconds() const
+    {
+        return chrono::duration<double>(chrono::steady_clock::now() - start_).count();
+    }
+private:
+    chrono::steady_clock::time_point start_;
+};
+
+// Keeps results alive so the optimizer cannot drop the measured loops.
+static volatile uint64_t sink;
+
+static vector<uint64_t> randomKeys(size_t n, uint64_t seed)
+{
+    mt19937_64 rng(seed);
+    vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+    }
+    return keys;
+}
+
+static void report(const string& name, double seconds, size_t ops)
+{
+    cout << left << setw(44) << name << right << fixed << setprecision(1)
+         << setw(10) << seconds * 1e9 / ops << " ns/op" << endl;
+}
+
+/**
+ * Random successful lookups through find() on a tree of n keys,
+ * plus the per-node footprint measured by the node pool.
+ */
+static void benchLookup(size_t n, size_t lookups)
+{
+    vector<uint64_t> keys = randomKeys(n, 1);
+    PooledAVL tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(std::make_pair(keys[i], i));
+    }
+    vector<uint64_t> probes = randomKeys(lookups, 2);
+    for(size_t i = 0; i < lookups; ++i) {
+        probes[i] = keys[probes[i] % n];
+    }
+
+    uint64_t sum = 0;
+    Stopwatch sw;
+    for(size_t i = 0; i < lookups; ++i) {
+        sum += tree.find(probes[i])->second;
+    }
+    double t = sw.seconds();
+    sink = sum;
+
+    report("AVLTree<uint64_t,uint64_t>::find n=" + to_string(n), t, lookups);
+    cout << "  sizeof(AVLNode<uint64_t,uint64_t>) = " << sizeof(AVLNode<uint64_t, uint64_t>)
+         << " bytes, pool bytes/node = " << tree.getAllocator().bytesInUse() / n << endl;
+}
+
+/**
+ * Loading n sorted keys: one insert() per key against build_from_sorted().
+ */
+static void benchBuild(size_t n)
+{
+    vector<pair<uint64_t, uint64_t> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(2 * i, i);
+    }
+
+    PooledAVL looped;
+    Stopwatch sw;
+    for(size_t i = 0; i < n; ++i) {
+        looped.insert(items[i]);
+    }
+    report("AVLTree insert() loop, sorted n=" + to_string(n), sw.seconds(), n);
+
+    PooledAVL built;
+    sw = Stopwatch();
+    built.build_from_sorted(items.begin(), items.end());
+    report("AVLTree build_from_sorted() n=" + to_string(n), sw.seconds(), n);
+}
+
+/**
+ * Time-window queries over n sequential timestamps: filtering a full scan
+ * from begin() against walking range(lo, hi) over the same window.
+ */
+static void benchRange(size_t n, size_t queries, uint64_t window)
+{
+    vector<pair<uint64_t, uint64_t> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(i, i);
+    }
+    PooledAVL tree;
+    tree.build_from_sorted(items.begin(), items.end());
+    vector<uint64_t> starts = randomKeys(queries, 5);
+    for(size_t i = 0; i < queries; ++i) {
+        starts[i] %= n;
+    }
+
+    uint64_t sum = 0;
+    Stopwatch sw;
+    for(size_t i = 0; i < queries; ++i) {
+        for(PooledAVL::iterator it = tree.begin(); it != tree.end(); ++it) {
+            if(it->first >= starts[i] && it->first < starts[i] + window) {
+                sum += it->second;
+            }
+        }
+    }
+    report("AVLTree filtered scan, window=" + to_string(window), sw.seconds(), queries);
+
+    sw = Stopwatch();
+    for(size_t i = 0; i < queries; ++i) {
+        PooledAVL::range_view r = tree.range(starts[i], starts[i] + window);
+        for(PooledAVL::iterator it = r.begin(); it != r.end(); ++it) {
+            sum += it->second;
+        }
+    }
+    report("AVLTree range(lo, hi), window=" + to_string(window), sw.seconds(), queries);
+    sink = sum;
+}
+
+/**
+ * Retention: dropping the oldest m of n sequential timestamps with one
+ * remove() per key, against one split() that cuts the prefix off (which
+ * is then cleared) and a join() that puts the tree back together.
+ */
+static void benchRetention(size_t n, size_t m)
+{
+    vector<pair<uint64_t, uint64_t> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(i, i);
+    }
+    string suffix = " m=" + to_string(m) + " n=" + to_string(n);
+
+    PooledAVL looped;
+    looped.build_from_sorted(items.begin(), items.end());
+    Stopwatch sw;
+    for(size_t i = 0; i < m; ++i) {
+        looped.remove(i);
+    }
+    report("AVLTree remove() loop" + suffix, sw.seconds(), m);
+
+    PooledAVL tree;
+    tree.build_from_sorted(items.begin(), items.end());
+    PooledAVL kept(tree.getAllocator());
+    sw = Stopwatch();
+    tree.split(m, kept);
+    double splitTime = sw.seconds();
+    tree.clear();
+    report("AVLTree split()+clear()" + suffix, sw.seconds(), m);
+    report("  split() alone, per call", splitTime, 1);
+
+    PooledAVL head(kept.getAllocator());
+    kept.split(n / 2, tree);
+    head.join(kept);
+    sw = Stopwatch();
+    head.join(tree);
+    report("AVLTree join() of two halves, per call", sw.seconds(), 1);
+}
+
+/**
+ * Reconciling two trees of n keys that share half their keys: a find() +
+ * insert() loop against set_union(), serial and on the default pool,
+ * plus set_intersection() and set_difference() on the pool.
+ */
+static void benchSetOps(size_t n)
+{
+    vector<pair<uint64_t, uint64_t> > today(n), yesterday(n);
+    for(size_t i = 0; i < n; ++i) {
+        today[i] = make_pair(2 * i, i);
+        yesterday[i] = make_pair(2 * i + (i % 2) * n, i);
+    }
+    sort(yesterday.begin(), yesterday.end());
+    string suffix = " n=" + to_string(n);
+    ForkJoinPool serial(1);
+
+    PooledAVL a, b(a.getAllocator());
+    a.build_from_sorted(today.begin(), today.end());
+    b.build_from_sorted(yesterday.begin(), yesterday.end());
+    Stopwatch sw;
+    for(PooledAVL::iterator it = b.begin(); it != b.end(); ++it) {
+        if(a.find(it->first) == a.end()) {
+            a.insert(*it);
+        }
+    }
+    report("AVLTree find()+insert() loop" + suffix, sw.seconds(), n);
+
+    a.build_from_sorted(today.begin(), today.end());
+    b.build_from_sorted(yesterday.begin(), yesterday.end());
+    sw = Stopwatch();
+    a.set_union(b, serial);
+    report("AVLTree set_union(), 1 thread" + suffix, sw.seconds(), n);
+
+    unsigned threads = defaultForkJoinPool().threads();
+    string onPool = to_string(threads) + (threads == 1 ? " thread" : " threads");
+    a.build_from_sorted(today.begin(), today.end());
+    b.build_from_sorted(yesterday.begin(), yesterday.end());
+    sw = Stopwatch();
+    a.set_union(b);
+    report("AVLTree set_union(), " + onPool + suffix, sw.seconds(), n);
+
+    a.build_from_sorted(today.begin(), today.end());
+    b.build_from_sorted(yesterday.begin(), yesterday.end());
+    sw = Stopwatch();
+    a.set_intersection(b);
+    report("AVLTree set_intersection(), " + onPool, sw.seconds(), n);
+
+    a.build_from_sorted(today.begin(), today.end());
+    b.build_from_sorted(yesterday.begin(), yesterday.end());
+    sw = Stopwatch();
+    a.set_difference(b);
+    report("AVLTree set_difference(), " + onPool, sw.seconds(), n);
+}
+
+/**
+ * Applying a batch of m random keys to a tree of n keys: one insert() or
+ * remove() per key against insert_batch() / erase_batch().
+ */
+static void benchBatch(size_t n, size_t m)
+{
+    vector<uint64_t> keys = randomKeys(n, 1);
+    vector<pair<uint64_t, uint64_t> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(keys[i], i);
+    }
+    sort(items.begin(), items.end());
+    vector<uint64_t> fresh = randomKeys(m, 3);
+    vector<pair<uint64_t, uint64_t> > batch(m);
+    for(size_t i = 0; i < m; ++i) {
+        batch[i] = make_pair(fresh[i], i);
+    }
+    string suffix = " m=" + to_string(m) + " n=" + to_string(n);
+
+    PooledAVL looped;
+    looped.build_from_sorted(items.begin(), items.end());
+    Stopwatch sw;
+    for(size_t i = 0; i < m; ++i) {
+        looped.insert(batch[i]);
+    }
+    report("AVLTree insert() loop" + suffix, sw.seconds(), m);
+    sw = Stopwatch();
+    for(size_t i = 0; i < m; ++i) {
+        looped.remove(fresh[i]);
+    }
+    report("AVLTree remove() loop" + suffix, sw.seconds(), m);
+
+    PooledAVL batched;
+    batched.build_from_sorted(items.begin(), items.end());
+    sw = Stopwatch();
+    batched.insert_batch(batch);
+    report("AVLTree insert_batch()" + suffix, sw.seconds(), m);
+    sw = Stopwatch();
+    batched.erase_batch(fresh);
+    report("AVLTree erase_batch()" + suffix, sw.seconds(), m);
+}
+
+/**
+ * Order statistics on n random keys: select(k) against advancing an
+ * iterator k steps from begin(), plus what keeping sizes costs inserts.
+ */
+static void benchRank(size_t n, size_t queries)
+{
+    vector<uint64_t> keys = randomKeys(n, 1);
+    PooledAVL plain;
+    Stopwatch sw;
+    for(size_t i = 0; i < n; ++i) {
+        plain.insert(std::make_pair(keys[i], i));
+    }
+    report("AVLTree insert() n=" + to_string(n), sw.seconds(), n);
+
+    PooledRankedAVL ranked;
+    sw = Stopwatch();
+    for(size_t i = 0; i < n; ++i) {
+        ranked.insert(std::make_pair(keys[i], i));
+    }
+    report("RankedAVLTree insert() n=" + to_string(n), sw.seconds(), n);
+
+    vector<uint64_t> ks = randomKeys(queries, 4);
+    for(size_t i = 0; i < queries; ++i) {
+        ks[i] %= n;
+    }
+    uint64_t sum = 0;
+    sw = Stopwatch();
+    for(size_t i = 0; i < queries; ++i) {
+        PooledAVL::iterator it = plain.begin();
+        for(uint64_t step = 0; step < ks[i]; ++step) {
+            ++it;
+        }
+        sum += it->first;
+    }
+    report("AVLTree k x operator++ n=" + to_string(n), sw.seconds(), queries);
+
+    sw = Stopwatch();
+    for(size_t i = 0; i < queries; ++i) {
+        sum += ranked.select(ks[i])->first;
+    }
+    report("RankedAVLTree select(k) n=" + to_string(n), sw.seconds(), queries);
+
+    sw = Stopwatch();
+    for(size_t i = 0; i < queries; ++i) {
+        sum += ranked.rank(keys[ks[i]]);
+    }
+    report("RankedAVLTree rank(key) n=" + to_string(n), sw.seconds(), queries);
+    sink = sum;
+}
+
+/**
+ * Loading n unsorted items, a tenth of them repeated keys: an insert()
+ * loop against build_from_unsorted(), serial and on the default pool.
+ * The trees use the standard allocator so the parallel build can create
+ * nodes on every thread.
+ */
+static void benchLoad(size_t n)
+{
+    vector<uint64_t> keys = randomKeys(n, 1);
+    vector<pair<uint64_t, uint64_t> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(i % 10 == 9 ? keys[i / 2] : keys[i], i);
+    }
+    string suffix = " n=" + to_string(n);
+
+    double looped;
+    {
+        AVLTree<uint64_t, uint64_t> tree;
+        Stopwatch sw;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(items[i]);
+        }
+        looped = sw.seconds();
+        report("AVLTree insert() loop" + suffix, looped, n);
+    }
+
+    ForkJoinPool serial(1);
+    AVLTree<uint64_t, uint64_t> tree;
+    Stopwatch sw;
+    tree.build_from_unsorted(items, serial);
+    double oneThread = sw.seconds();
+    report("AVLTree build_from_unsorted(), 1 thread", oneThread, n);
+
+    unsigned threads = defaultForkJoinPool().threads();
+    tree.clear();
+    sw = Stopwatch();
+    tree.build_from_unsorted(items);
+    double pooled = sw.seconds();
+    report("AVLTree build_from_unsorted(), " + to_string(threads)
+           + (threads == 1 ? " thread" : " threads"), pooled, n);
+    cout << "speedup over insert() loop: " << setprecision(2) << looped / pooled
+         << "x, over 1 thread: " << oneThread / pooled << "x" << endl;
+}
+
+/**
+ * What leaving the AVL invariant checks on costs: n random inserts and
+ * removes with setValidation() off and on, plus one full isBalanced().
+ */
+static void benchValidate(size_t n)
+{
+    vector<uint64_t> keys = randomKeys(n, 1);
+    string suffix = " n=" + to_string(n);
+    for(int validating = 0; validating < 2; ++validating) {
+        PooledAVL tree;
+        tree.setValidation(validating != 0);
+        string mode = validating ? " checked" : "";
+        Stopwatch sw;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(std::make_pair(keys[i], i));
+        }
+        report("AVLTree insert()" + mode + suffix, sw.seconds(), n);
+        if(!validating) {
+            sw = Stopwatch();
+            sink = tree.isBalanced();
+            report("BinarySearchTree isBalanced()" + suffix, sw.seconds(), n);
+        }
+        sw = Stopwatch();
+        for(size_t i = 0; i < n; ++i) {
+            tree.remove(keys[i]);
+        }
+        report("AVLTree remove()" + mode + suffix, sw.seconds(), n);
+    }
+}
+
+/**
+ * Exposes the tree's internals so the benchmark can build shapes insert()
+ * would not, and compare against the old recursive walks.
+ */
+class ShapedBST : public BinarySearchTree<uint64_t, uint64_t>
+{
+public:
+    // n keys, each the right child of the last: a tree as deep as it is long
+    void buildChain(size_t n)
+    {
+        clear();
+        Node<uint64_t, uint64_t>* last = NULL;
+        for(size_t i = 0; i < n; ++i) {
+            Node<uint64_t, uint64_t>* node = makeNode(i, i, last);
+            linkNode(node, last, false);
+            last = node;
+        }
+    }
+    int height() const { return getHeight(root_); }
+    int recursiveHeight() const { return recursiveHeight(root_); }
+    void recursiveClear() { recursiveClear(root_); root_ = NULL; size_ = 0; rightmost_ = NULL; }
+
+private:
+    static int recursiveHeight(Node<uint64_t, uint64_t>* node)
+    {
+        return node == NULL ? 0 : 1 + max(recursiveHeight(node->getLeft()), recursiveHeight(node->getRight()));
+    }
+    void recursiveClear(Node<uint64_t, uint64_t>* node)
+    {
+        if(node != NULL) {
+            recursiveClear(node->getLeft());
+            recursiveClear(node->getRight());
+            destroyNode(node);
+        }
+    }
+};
+
+/**
+ * The whole-tree walks without recursion: on a balanced tree of n keys
+ * against the recursive versions, then on an n-deep chain, where the
+ * recursive ones would overflow the stack.
+ */
+static void benchDegenerate(size_t n)
+{
+    vector<pair<uint64_t, uint64_t> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(i, i);
+    }
+    string suffix = " n=" + to_string(n);
+
+    ShapedBST tree;
+    tree.build_from_sorted(items.begin(), items.end());
+    Stopwatch sw;
+    sink = tree.recursiveHeight();
+    report("balanced, recursive getHeight()" + suffix, sw.seconds(), n);
+    sw = Stopwatch();
+    sink = tree.height();
+    report("balanced, getHeight()" + suffix, sw.seconds(), n);
+    sw = Stopwatch();
+    sink = tree.isBalanced();
+    report("balanced, isBalanced()" + suffix, sw.seconds(), n);
+    sw = Stopwatch();
+    tree.recursiveClear();
+    report("balanced, recursive clear()" + suffix, sw.seconds(), n);
+    tree.build_from_sorted(items.begin(), items.end());
+    sw = Stopwatch();
+    tree.clear();
+    report("balanced, clear()" + suffix, sw.seconds(), n);
+
+    tree.buildChain(n);
+    sw = Stopwatch();
+    sink = tree.height();
+    report("chain, getHeight()" + suffix, sw.seconds(), n);
+    sw = Stopwatch();
+    sink = tree.isBalanced();
+    report("chain, isBalanced()" + suffix, sw.seconds(), n);
+    sw = Stopwatch();
+    tree.clear();
+    report("chain, clear()" + suffix, sw.seconds(), n);
+}
+
+/**
+ * "Latest m entries" over n sequential timestamps: copying the tree into
+ * a vector and reading its tail, against walking m steps from rbegin().
+ * Also appends n keys in order through insert(end(), ...), which relies
+ * on the cached largest node.
+ */
+static void benchReverse(size_t n, size_t m, size_t queries)
+{
+    vector<pair<uint64_t, uint64_t> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(i, i);
+    }
+    PooledAVL tree;
+    tree.build_from_sorted(items.begin(), items.end());
+    string suffix = " m=" + to_string(m);
+
+    uint64_t sum = 0;
+    Stopwatch sw;
+    for(size_t i = 0; i < queries; ++i) {
+        vector<pair<uint64_t, uint64_t> > copy(tree.begin(), tree.end());
+        for(size_t j = copy.size() > m ? copy.size() - m : 0; j < copy.size(); ++j) {
+            sum += copy[j].second;
+        }
+    }
+    report("latest entries, copy to vector" + suffix, sw.seconds(), queries);
+
+    sw = Stopwatch();
+    for(size_t i = 0; i < queries; ++i) {
+        PooledAVL::const_reverse_iterator it = tree.crbegin();
+        for(size_t j = 0; j < m && it != tree.crend(); ++j, ++it) {
+            sum += it->second;
+        }
+    }
+    report("latest entries, crbegin()" + suffix, sw.seconds(), queries);
+    sink = sum;
+
+    BinarySearchTree<uint64_t, uint64_t> chain;
+    sw = Stopwatch();
+    for(size_t i = 0; i < n; ++i) {
+        chain.insert(chain.end(), items[i]);
+    }
+    report("BST insert(end(), item) in order", sw.seconds(), n);
+}
+
+/**
+ * Random lookups on n keys inserted in random order: the pointer tree's
+ * find() against the same keys frozen into an Eytzinger array, with a
+ * binary search over a sorted vector for reference.
+ */
+static void benchFrozen(size_t n, size_t lookups)
+{
+    vector<uint64_t> keys = randomKeys(n, 1);
+    PooledAVL tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(std::make_pair(keys[i], i));
+    }
+    vector<uint64_t> probes = randomKeys(lookups, 2);
+    for(size_t i = 0; i < lookups; ++i) {
+        probes[i] = keys[probes[i] % n];
+    }
+    string suffix = " n=" + to_string(n);
+
+    Stopwatch sw;
+    FrozenMap<uint64_t, uint64_t> frozen = tree.freeze();
+    report("freeze()" + suffix, sw.seconds(), n);
+
+    uint64_t sum = 0;
+    sw = Stopwatch();
+    for(size_t i = 0; i < lookups; ++i) {
+        sum += tree.find(probes[i])->second;
+    }
+    report("AVLTree find()" + suffix, sw.seconds(), lookups);
+
+    sw = Stopwatch();
+    for(size_t i = 0; i < lookups; ++i) {
+        sum += frozen.find(probes[i])->second;
+    }
+    report("FrozenMap find()" + suffix, sw.seconds(), lookups);
+
+    sw = Stopwatch();
+    for(size_t i = 0; i < lookups; ++i) {
+        sum += frozen.lower_bound(probes[i] + 1) != frozen.end();
+    }
+    report("FrozenMap lower_bound(), absent keys" + suffix, sw.seconds(), lookups);
+
+    vector<uint64_t> sorted(keys);
+    sort(sorted.begin(), sorted.end());
+    sw = Stopwatch();
+    for(size_t i = 0; i < lookups; ++i) {
+        sum += *lower_bound(sorted.begin(), sorted.end(), probes[i]);
+    }
+    report("sorted vector std::lower_bound()" + suffix, sw.seconds(), lookups);
+    sink = sum;
+}
+
+/**
+ * The same workload on AVLTree and BPlusTree with n random 64-bit keys:
+ * inserting them, random successful lookups, a full in-order scan and
+ * removing them all again.
+ */
+template<typename Tree>
+static void benchMapWorkload(const string& name, const vector<uint64_t>& keys,
+                             const vector<uint64_t>& probes, size_t scans)
+{
+    size_t n = keys.size();
+    string suffix = " n=" + to_string(n);
+    Tree tree;
+    Stopwatch sw;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(std::make_pair(keys[i], i));
+    }
+    report(name + " insert()" + suffix, sw.seconds(), n);
+
+    uint64_t sum = 0;
+    sw = Stopwatch();
+    for(size_t i = 0; i < probes.size(); ++i) {
+        sum += tree.find(probes[i])->second;
+    }
+    report(name + " find()" + suffix, sw.seconds(), probes.size());
+
+    sw = Stopwatch();
+    for(size_t s = 0; s < scans; ++s) {
+        for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+            sum += it->second;
+        }
+    }
+    report(name + " full scan, per item" + suffix, sw.seconds(), scans * n);
+
+    sw = Stopwatch();
+    for(size_t i = 0; i < n; ++i) {
+        tree.remove(keys[i]);
+    }
+    report(name + " remove()" + suffix, sw.seconds(), n);
+    sink = sum;
+}
+
+static void benchBPlus(size_t n, size_t lookups)
+{
+    vector<uint64_t> keys = randomKeys(n, 1);
+    vector<uint64_t> probes = randomKeys(lookups, 2);
+    for(size_t i = 0; i < lookups; ++i) {
+        probes[i] = keys[probes[i] % n];
+    }
+    benchMapWorkload<AVLTree<uint64_t, uint64_t> >("AVLTree", keys, probes, 10);
+    benchMapWorkload<BPlusTree<uint64_t, uint64_t> >("BPlusTree", keys, probes, 10);
+}
+
+/**
+ * AVL node sizes, with the balance kept in the parent link, and insert
+ * and remove throughput for n random keys on a pooled tree.
+ */
+static void benchNodeSize(size_t n)
+{
+    cout << "sizeof(Node<uint64_t, uint64_t>) = " << sizeof(Node<uint64_t, uint64_t>)
+         << ", sizeof(AVLNode<uint64_t, uint64_t>) = " << sizeof(AVLNode<uint64_t, uint64_t>)
+         << ", sizeof(AVLNode<int32_t, uint32_t>) = " << sizeof(AVLNode<int32_t, uint32_t>)
+         << ", sizeof(RankedAVLNode<uint64_t, uint64_t>) = " << sizeof(RankedAVLNode<uint64_t, uint64_t>) << endl;
+
+    vector<uint64_t> keys = randomKeys(n, 1);
+    string suffix = " n=" + to_string(n);
+    PooledAVL tree;
+    Stopwatch sw;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(std::make_pair(keys[i], i));
+    }
+    report("pooled AVLTree insert()" + suffix, sw.seconds(), n);
+    cout << "pooled AVLTree: " << setprecision(1)
+         << double(tree.getAllocator().bytesInUse()) / tree.size() << " bytes/entry" << endl;
+
+    sw = Stopwatch();
+    for(size_t i = 0; i < n; ++i) {
+        tree.remove(keys[i]);
+    }
+    report("pooled AVLTree remove()" + suffix, sw.seconds(), n);
+}
+
+/**
+ * Memory per entry and lookup speed of AVL trees of n 32-bit keys and
+ * values with pointer links (in a node pool, so no heap headers) and
+ * with compact index links.
+ */
+static void benchCompact(size_t n, size_t lookups)
+{
+    vector<uint64_t> keys = randomKeys(n, 1);
+    vector<uint64_t> probes = randomKeys(lookups, 2);
+    for(size_t i = 0; i < lookups; ++i) {
+        probes[i] = keys[probes[i] % n];
+    }
+    string suffix = " n=" + to_string(n);
+    cout << "sizeof(AVLNode), pointer links: " << sizeof(AVLNode<uint32_t, uint32_t>)
+         << " bytes, compact links: " << sizeof(AVLNode<uint32_t, uint32_t, CompactNodeLinks>) << " bytes" << endl;
+    double pointerBytes = 0;
+    double compactBytes = 0;
+
+    {
+        PooledPointerAVL tree;
+        Stopwatch sw;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(std::make_pair(static_cast<uint32_t>(keys[i]), static_cast<uint32_t>(i)));
+        }
+        report("pointer links insert()" + suffix, sw.seconds(), n);
+        uint64_t sum = 0;
+        sw = Stopwatch();
+        for(size_t i = 0; i < lookups; ++i) {
+            sum += tree.find(static_cast<uint32_t>(probes[i]))->second;
+        }
+        report("pointer links find()" + suffix, sw.seconds(), lookups);
+        sink = sum;
+        pointerBytes = double(tree.getAllocator().bytesInUse()) / tree.size();
+        cout << "pointer links: " << setprecision(1)
+             << pointerBytes << " bytes/entry in use, "
+             << double(tree.getAllocator().bytesReserved()) / tree.size() << " reserved" << endl;
+    }
+    {
+        CompactAVL tree;
+        size_t inUseBefore = tree.getAllocator().bytesInUse();
+        Stopwatch sw;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(std::make_pair(static_cast<uint32_t>(keys[i]), static_cast<uint32_t>(i)));
+        }
+        report("compact links insert()" + suffix, sw.seconds(), n);
+        uint64_t sum = 0;
+        sw = Stopwatch();
+        for(size_t i = 0; i < lookups; ++i) {
+            sum += tree.find(static_cast<uint32_t>(probes[i]))->second;
+        }
+        report("compact links find()" + suffix, sw.seconds(), lookups);
+        sink = sum;
+        compactBytes = double(tree.getAllocator().bytesInUse() - inUseBefore) / tree.size();
+        cout << "compact links: " << setprecision(1)
+             << compactBytes << " bytes/entry in use, "
+             << double(tree.getAllocator().bytesReserved()) / tree.size() << " reserved" << endl;
+    }
+    // both trees keep their nodes without heap headers, so this is the saving from the links alone
+    cout << "compact links save " << setprecision(0) << 100 * (1 - compactBytes / pointerBytes)
+         << "% per entry (short of half: key, value and three 4-byte links need 20 bytes)" << endl;
+    cout << "compact space released once empty: " << NodeIndexSpace<uint32_t, uint32_t>::releaseIfEmpty() << endl;
+}
+
+/**
+ * PersistentAVLTree against AVLTree on n random keys: what path copying
+ * costs inserts, removes and lookups, what snapshot() costs, and writer
+ * throughput while a reader thread keeps taking snapshots and walking them.
+ */
+static void benchPersistent(size_t n, size_t lookups)
+{
+    vector<uint64_t> keys = randomKeys(n, 1);
+    vector<uint64_t> probes = randomKeys(lookups, 2);
+    for(size_t i = 0; i < lookups; ++i) {
+        probes[i] = keys[probes[i] % n];
+    }
+    string suffix = " n=" + to_string(n);
+    benchMapWorkload<AVLTree<uint64_t, uint64_t> >("AVLTree", keys, probes, 1);
+
+    PersistentAVLTree<uint64_t, uint64_t> tree;
+    Stopwatch sw;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(std::make_pair(keys[i], i));
+    }
+    report("PersistentAVLTree insert()" + suffix, sw.seconds(), n);
+
+    uint64_t sum = 0;
+    sw = Stopwatch();
+    for(size_t i = 0; i < lookups; ++i) {
+        sum += tree.find(probes[i])->second;
+    }
+    report("PersistentAVLTree find()" + suffix, sw.seconds(), lookups);
+
+    sw = Stopwatch();
+    for(size_t i = 0; i < lookups; ++i) {
+        sum += tree.snapshot().size();
+    }
+    report("PersistentAVLTree snapshot()" + suffix, sw.seconds(), lookups);
+
+    atomic<bool> stop(false);
+    atomic<size_t> walked(0);
+    thread reader([&]() {
+        while(!stop) {
+            PersistentAVLTree<uint64_t, uint64_t>::Snapshot view = tree.snapshot();
+            size_t seen = 0;
+            for(size_t i = 0; i < 1000 && !stop; ++i) {
+                seen += view.find(probes[i % probes.size()]) != view.end();
+            }
+            walked += seen;
+        }
+    });
+    sw = Stopwatch();
+    for(size_t i = 0; i < n; ++i) {
+        tree.remove(keys[i]);
+        tree.insert(std::make_pair(keys[i], i));
+    }
+    double seconds = sw.seconds();
+    stop = true;
+    reader.join();
+    report("PersistentAVLTree update, reader running" + suffix, seconds, 2 * n);
+
+    sw = Stopwatch();
+    for(size_t i = 0; i < n; ++i) {
+        tree.remove(keys[i]);
+    }
+    report("PersistentAVLTree remove()" + suffix, sw.seconds(), n);
+    sink = sum + walked;
+}
+
+/**
+ * Runs ops operations on each of threads threads over keys drawn from
+ * twice as many keys as the tree starts with: updatePercent% of them
+ * split evenly between insert and remove, the rest find. Returns the
+ * wall-clock seconds.
+ */
+template<typename Find, typename Insert, typename Remove>
+static double runMixedThreads(size_t threads, size_t ops, const vector<uint64_t>& keys, unsigned updatePercent,
+                              Find find, Insert insert, Remove remove)
+{
+    vector<thread> workers;
+    atomic<uint64_t> totalFound(0);
+    Stopwatch sw;
+    for(size_t t = 0; t < threads; ++t) {
+        workers.push_back(thread([&, t]() {
+            mt19937_64 rng(t + 1);
+            uint64_t found = 0;
+            for(size_t i = 0; i < ops; ++i) {
+                uint64_t r = rng();
+                uint64_t key = keys[(r >> 8) % keys.size()];
+                unsigned op = r % 200;
+                if(op < updatePercent) {
+                    insert(key, i);
+                }
+                else if(op < 2 * updatePercent) {
+                    remove(key);
+                }
+                else {
+                    found += find(key);
+                }
+            }
+            totalFound += found;
+        }));
+    }
+    for(size_t t = 0; t < workers.size(); ++t) {
+        workers[t].join();
+    }
+    double seconds = sw.seconds();
+    sink = totalFound;
+    return seconds;
+}
+
+static void benchConcurrent(size_t n, size_t opsPerThread)
+{
+    vector<uint64_t> keys = randomKeys(2 * n, 1);
+    string suffix = " n=" + to_string(n);
+    const size_t threadCounts[] = { 1, 8, 32, 64 };
+    for(size_t c = 0; c < sizeof(threadCounts) / sizeof(threadCounts[0]); ++c) {
+        size_t threads = threadCounts[c];
+        string label = " t=" + to_string(threads) + suffix;
+
+        AVLTree<uint64_t, uint64_t> locked;
+        mutex lock;
+        for(size_t i = 0; i < n; ++i) {
+            locked.insert(std::make_pair(keys[2 * i], i));
+        }
+        double seconds = runMixedThreads(threads, opsPerThread, keys, 5,
+            [&](uint64_t key) { lock_guard<mutex> guard(lock); return locked.find(key) != locked.end(); },
+            [&](uint64_t key, uint64_t value) { lock_guard<mutex> guard(lock); locked.insert(std::make_pair(key, value)); },
+            [&](uint64_t key) { lock_guard<mutex> guard(lock); locked.remove(key); });
+        report("mutex AVLTree 95% find" + label, seconds, threads * opsPerThread);
+
+        ConcurrentAVLTree<uint64_t, uint64_t> tree;
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(std::make_pair(keys[2 * i], i));
+        }
+        seconds = runMixedThreads(threads, opsPerThread, keys, 5,
+            [&](uint64_t key) { return tree.contains(key); },
+            [&](uint64_t key, uint64_t value) { tree.insert(std::make_pair(key, value)); },
+            [&](uint64_t key) { tree.remove(key); });
+        report("ConcurrentAVLTree 95% find" + label, seconds, threads * opsPerThread);
+    }
+}
+
+static void benchSharded(size_t n, size_t opsPerThread)
+{
+    vector<uint64_t> keys = randomKeys(2 * n, 1);
+    string suffix = " n=" + to_string(n);
+    const size_t threadCounts[] = { 1, 8, 32, 64 };
+    const unsigned updatePercents[] = { 5, 50 };
+    for(size_t u = 0; u < sizeof(updatePercents) / sizeof(updatePercents[0]); ++u) {
+        unsigned updatePercent = updatePercents[u];
+        for(size_t c = 0; c < sizeof(threadCounts) / sizeof(threadCounts[0]); ++c) {
+            size_t threads = threadCounts[c];
+            string label = " " + to_string(updatePercent) + "% upd t=" + to_string(threads) + suffix;
+
+            AVLTree<uint64_t, uint64_t> locked;
+            mutex lock;
+            for(size_t i = 0; i < n; ++i) {
+                locked.insert(std::make_pair(keys[2 * i], i));
+            }
+            double seconds = runMixedThreads(threads, opsPerThread, keys, updatePercent,
+                [&](uint64_t key) { lock_guard<mutex> guard(lock); return locked.find(key) != locked.end(); },
+                [&](uint64_t key, uint64_t value) { lock_guard<mutex> guard(lock); locked.insert(std::make_pair(key, value)); },
+                [&](uint64_t key) { lock_guard<mutex> guard(lock); locked.remove(key); });
+            report("mutex AVLTree" + label, seconds, threads * opsPerThread);
+
+            ShardedAVLMap<uint64_t, uint64_t> sharded(16);
+            for(size_t i = 0; i < n; ++i) {
+                sharded.insert(std::make_pair(keys[2 * i], i));
+            }
+            seconds = runMixedThreads(threads, opsPerThread, keys, updatePercent,
+                [&](uint64_t key) { return sharded.contains(key); },
+                [&](uint64_t key, uint64_t value) { sharded.insert(std::make_pair(key, value)); },
+                [&](uint64_t key) { sharded.remove(key); });
+            report("ShardedAVLMap(16)" + label, seconds, threads * opsPerThread);
+        }
+    }
+}
+
+template<typename Tree>
+static void benchFindManyOn(const string& name, size_t n, const vector<uint64_t>& keys, const vector<uint64_t>& probes)
+{
+    string suffix = " n=" + to_string(n);
+    Tree tree;
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(std::make_pair(keys[i], i));
+    }
+
+    uint64_t sum = 0;
+    Stopwatch sw;
+    for(size_t i = 0; i < probes.size(); ++i) {
+        typename Tree::iterator it = tree.find(probes[i]);
+        sum += it != tree.end() ? it->second : 0;
+    }
+    report(name + " find() loop" + suffix, sw.seconds(), probes.size());
+
+    const size_t batchSizes[] = { 16, 64, 256 };
+    for(size_t b = 0; b < sizeof(batchSizes) / sizeof(batchSizes[0]); ++b) {
+        size_t batchSize = batchSizes[b];
+        vector<uint64_t> batch(batchSize);
+        vector<typename Tree::iterator> found;
+        sw = Stopwatch();
+        for(size_t i = 0; i + batchSize <= probes.size(); i += batchSize) {
+            std::copy(probes.begin() + i, probes.begin() + i + batchSize, batch.begin());
+            tree.find_many(batch, found);
+            for(size_t j = 0; j < batchSize; ++j) {
+                sum += found[j] != tree.end() ? found[j]->second : 0;
+            }
+        }
+        report(name + " find_many(" + to_string(batchSize) + ")" + suffix, sw.seconds(),
+               probes.size() / batchSize * batchSize);
+    }
+    sink = sum;
+}
+
+static void benchFindMany(size_t n, size_t lookups)
+{
+    vector<uint64_t> keys = randomKeys(n, 1);
+    vector<uint64_t> probes = randomKeys(lookups, 2);
+    for(size_t i = 0; i < lookups; i += 2) {
+        probes[i] = keys[probes[i] % n];   // half hits, half misses
+    }
+    benchFindManyOn<PooledAVL>("AVLTree", n, keys, probes);
+    benchFindManyOn<BinarySearchTree<uint64_t, uint64_t> >("BinarySearchTree", n, keys, probes);
+}
+
+/**
+* A composite key, an id within a tenant, and a three-way comparator for
+* it. std::less on the pair compares the names twice per call (a < b,
+* then b < a), and a search calls it up to twice per level.
+*/
+typedef std::pair<string, uint32_t> TenantKey;
+
+struct TenantKeyCompare
+{
+    bool operator()(const TenantKey& a, const TenantKey& b) const
+    {
+        return compare(a, b) < 0;
+    }
+    int compare(const TenantKey& a, const TenantKey& b) const
+    {
+        int order = a.first.compare(b.first);
+        if(order != 0) {
+            return order;
+        }
+        return (a.second > b.second) - (a.second < b.second);
+    }
+};
+
+template<typename Tree, typename Probe>
+static void benchCompareOn(const string& name, const Tree& tree, const vector<Probe>& probes)
+{
+    uint64_t sum = 0;
+    Stopwatch sw;
+    for(size_t i = 0; i < probes.size(); ++i) {
+        typename Tree::iterator it = tree.find(probes[i]);
+        sum += it != tree.end() ? it->second : 0;
+    }
+    report(name, sw.seconds(), probes.size());
+    sink = sum;
+}
+
+/**
+* Keys sharing a long prefix, as in "user/000000000000001234", so that
+* every comparison walks the prefix before it can decide. The trees
+* being compared are filled together so that neither gets the better
+* memory.
+*/
+static void benchCompare(size_t n, size_t lookups)
+{
+    vector<uint64_t> numbers = randomKeys(n, 1);
+    vector<string> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        string digits = to_string(numbers[i] % 1000000000000ULL);
+        keys[i] = "user/" + string(18 - digits.size(), '0') + digits;
+    }
+    vector<uint64_t> picks = randomKeys(lookups, 2);
+    vector<string> probes(lookups);
+    vector<const char*> rawProbes(lookups);
+    for(size_t i = 0; i < lookups; ++i) {
+        probes[i] = keys[picks[i] % n];
+        if(i % 2 == 1) {
+            probes[i] += "x";   // half misses
+        }
+        rawProbes[i] = probes[i].c_str();
+    }
+    string suffix = " n=" + to_string(n);
+    {
+        typedef std::allocator<std::pair<const string, uint64_t> > StringAlloc;
+        AVLTree<string, uint64_t> lessTree;
+        AVLTree<string, uint64_t, StringAlloc, StringCompare> threeWayTree;
+        for(size_t i = 0; i < n; ++i) {
+            lessTree.insert(std::make_pair(keys[i], i));
+            threeWayTree.insert(std::make_pair(keys[i], i));
+        }
+        benchCompareOn("string, std::less find" + suffix, lessTree, probes);
+        benchCompareOn("string, std::less find(char*)" + suffix, lessTree, rawProbes);
+        benchCompareOn("string, StringCompare find" + suffix, threeWayTree, probes);
+        benchCompareOn("string, StringCompare find(char*)" + suffix, threeWayTree, rawProbes);
+    }
+
+    const uint32_t tenants = 64;
+    vector<TenantKey> tenantKeys(n);
+    vector<TenantKey> tenantProbes(lookups);
+    for(size_t i = 0; i < n; ++i) {
+        tenantKeys[i] = TenantKey(keys[numbers[i] % tenants], static_cast<uint32_t>(numbers[i] >> 32));
+    }
+    for(size_t i = 0; i < lookups; ++i) {
+        tenantProbes[i] = tenantKeys[picks[i] % n];
+        tenantProbes[i].second += i % 2;   // about half misses
+    }
+    typedef std::allocator<std::pair<const TenantKey, uint64_t> > TenantAlloc;
+    AVLTree<TenantKey, uint64_t> lessTree;
+    AVLTree<TenantKey, uint64_t, TenantAlloc, TenantKeyCompare> threeWayTree;
+    for(size_t i = 0; i < n; ++i) {
+        lessTree.insert(std::make_pair(tenantKeys[i], i));
+        threeWayTree.insert(std::make_pair(tenantKeys[i], i));
+    }
+    benchCompareOn("pair, std::less find" + suffix, lessTree, tenantProbes);
+    benchCompareOn("pair, three-way find" + suffix, threeWayTree, tenantProbes);
+}
+
+/**
+* count draws from a Zipf distribution over ranks 0..n-1 with exponent
+* skew: rank r comes up in proportion to 1 / (r + 1)^skew.
+*/
+static vector<size_t> zipfRanks(size_t n, double skew, size_t count, uint64_t seed)
+{
+    vector<double> cumulative(n);
+    double total = 0;
+    for(size_t r = 0; r < n; ++r) {
+        total += 1.0 / pow(static_cast<double>(r + 1), skew);
+        cumulative[r] = total;
+    }
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> uniform(0, total);
+    vector<size_t> ranks(count);
+    for(size_t i = 0; i < count; ++i) {
+        ranks[i] = std::lower_bound(cumulative.begin(), cumulative.end(), uniform(rng)) - cumulative.begin();
+        ranks[i] = std::min(ranks[i], n - 1);
+    }
+    return ranks;
+}
+
+template<typename Tree>
+static void benchSplayOn(const string& name, Tree& tree, const vector<uint64_t>& probes, size_t warmup)
+{
+    uint64_t sum = 0;
+    for(size_t i = 0; i < warmup; ++i) {
+        sum += tree.find(probes[i]) != tree.end();
+    }
+    Stopwatch sw;
+    for(size_t i = 0; i < probes.size(); ++i) {
+        typename Tree::iterator it = tree.find(probes[i]);
+        sum += it != tree.end() ? it->second : 0;
+    }
+    report(name, sw.seconds(), probes.size());
+    sink = sum;
+}
+
+/**
+* Lookups whose popularity follows Zipf's law, with the popular keys
+* spread at random over the key space, against AVLTree; then a uniform
+* workload, where splaying only costs. Each tree is built from the same
+* shuffled keys, and the splay trees are warmed up with the first tenth
+* of the lookups before timing.
+*/
+static void benchSplay(size_t n, size_t lookups)
+{
+    vector<uint64_t> keys = randomKeys(n, 1);
+    AVLTree<uint64_t, uint64_t> avl;
+    SplayTree<uint64_t, uint64_t> splay;
+    SplayTree<uint64_t, uint64_t> splayEvery16;
+    splayEvery16.setSplayInterval(16);
+    for(size_t i = 0; i < n; ++i) {
+        avl.insert(std::make_pair(keys[i], i));
+        splay.insert(std::make_pair(keys[i], i));
+        splayEvery16.insert(std::make_pair(keys[i], i));
+    }
+
+    const double skews[] = { 0.0, 0.99, 1.2 };
+    const string skewNames[] = { "uniform", "zipf 0.99", "zipf 1.2" };
+    for(size_t s = 0; s < sizeof(skews) / sizeof(skews[0]); ++s) {
+        vector<uint64_t> probes(lookups);
+        size_t hot = 0;
+        if(skews[s] == 0.0) {
+            vector<uint64_t> picks = randomKeys(lookups, 2);
+            for(size_t i = 0; i < lookups; ++i) {
+                probes[i] = keys[picks[i] % n];
+            }
+        }
+        else {
+            vector<size_t> ranks = zipfRanks(n, skews[s], lookups, 2);
+            for(size_t i = 0; i < lookups; ++i) {
+                probes[i] = keys[ranks[i]];
+                hot += ranks[i] < n / 100;
+            }
+        }
+        string label = skewNames[s] + " n=" + to_string(n);
+        if(skews[s] != 0.0) {
+            cout << label << ": " << to_string(100 * hot / lookups) << "% of lookups hit the top 1% of keys" << endl;
+        }
+        benchSplayOn(label + " AVLTree", avl, probes, 0);
+        benchSplayOn(label + " SplayTree", splay, probes, lookups / 10);
+        benchSplayOn(label + " SplayTree every 16th", splayEvery16, probes, lookups / 10);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    string which = argc > 1 ? argv[1] : "all";
+    size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+
+    if(which == "all" || which == "lookup") {
+        benchLookup(n, 2000000);
+    }
+    if(which == "all" || which == "build") {
+        benchBuild(n);
+    }
+    if(which == "all" || which == "range") {
+        benchRange(n, 20, 1000);
+    }
+    if(which == "all" || which == "retention") {
+        benchRetention(n, n / 100 > 0 ? n / 100 : 1);
+    }
+    if(which == "all" || which == "setops") {
+        benchSetOps(n);
+    }
+    if(which == "all" || which == "rank") {
+        benchRank(n, 100);
+    }
+    if(which == "all" || which == "batch") {
+        benchBatch(n, n / 100 > 0 ? n / 100 : 1);
+    }
+    if(which == "all" || which == "load") {
+        benchLoad(n);
+    }
+    if(which == "all" || which == "validate") {
+        benchValidate(n);
+    }
+    if(which == "all" || which == "degenerate") {
+        benchDegenerate(n);
+    }
+    if(which == "all" || which == "reverse") {
+        benchReverse(n, 100, 20);
+    }
+    if(which == "all" || which == "frozen") {
+        benchFrozen(n, 2000000);
+    }
+    if(which == "all" || which == "bplus") {
+        benchBPlus(n, 2000000);
+    }
+    if(which == "all" || which == "persistent") {
+        benchPersistent(n, 2000000);
+    }
+    if(which == "all" || which == "nodesize") {
+        benchNodeSize(n);
+    }
+    if(which == "all" || which == "compact") {
+        // the footprint report is meant for 10M entries unless told otherwise
+        benchCompact(argc > 2 ? n : 10000000, 2000000);
+    }
+    if(which == "all" || which == "concurrent") {
+        benchConcurrent(n, 200000);
+    }
+    if(which == "all" || which == "sharded") {
+        benchSharded(n, 200000);
+    }
+    if(which == "all" || which == "findmany") {
+        // meant for trees well past the last-level cache unless told otherwise
+        benchFindMany(argc > 2 ? n : 10000000, 2000000);
+    }
+    if(which == "all" || which == "compare") {
+        benchCompare(n, 2000000);
+    }
+    if(which == "all" || which == "splay") {
+        benchSplay(n, 2000000);
+    }
+    return 0;
+}
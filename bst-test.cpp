@@ -1,7 +1,15 @@
 #include <iostream>
 #include <map>
+#include <thread>
+#include <vector>
 #include "bst.h"
 #include "avlbst.h"
+#include "ranked_avl.h"
+#include "bplustree.h"
+#include "persistent_avl.h"
+#include "concurrent_avl.h"
+#include "sharded_avl.h"
+#include "splay_tree.h"
 
 using namespace std;
 
@@ -29,7 +37,10 @@ int main(int argc, char *argv[])
     // AVL Tree Tests
     AVLTree<char,int> at;
     at.insert(std::make_pair('a',1));
-    at.insert(std::make_pair('b',2));
+    at.insert(at.end(), std::make_pair('b',2));
+    if(!at.try_emplace('b', 3).second) {
+        cout << "b was already present" << endl;
+    }
 
     cout << "\nAVLTree contents:" << endl;
     for(AVLTree<char,int>::iterator it = at.begin(); it != at.end(); ++it) {
@@ -44,5 +55,94 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // Pooled AVL Tree Tests
+    AVLTree<int,int,NodePool<std::pair<const int,int> > > pt;
+    for(int i = 0; i < 1000; ++i) {
+        pt.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 1000; i += 2) {
+        pt.remove(i);
+    }
+    cout << "\nPooled AVLTree: " << pt.getAllocator().bytesInUse() << " of "
+         << pt.getAllocator().bytesReserved() << " bytes in use" << endl;
+    pt.clear();
+    cout << "After clear: " << pt.getAllocator().bytesReserved() << " bytes reserved" << endl;
+
+    // Ranked AVL Tree Tests
+    RankedAVLTree<int,int> rt;
+    for(int i = 1; i <= 200; ++i) {
+        rt.insert(std::make_pair(i * 5, i));
+    }
+    cout << "\nRankedAVLTree of " << rt.size() << " latencies: p50 = "
+         << rt.percentile(50)->first << ", p99 = " << rt.percentile(99)->first
+         << ", " << rt.rank(100) << " below 100" << endl;
+
+    // B+ Tree Tests
+    BPlusTree<int,int> bp;
+    for(int i = 0; i < 1000; ++i) {
+        bp.insert(std::make_pair(i, i * i));
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        bp.remove(i);
+    }
+    cout << "\nBPlusTree of " << bp.size() << " keys: first = " << bp.begin()->first
+         << ", bp[10] = " << bp[10] << endl;
+
+    // Persistent AVL Tree Tests
+    PersistentAVLTree<int,int> pv;
+    for(int i = 0; i < 100; ++i) {
+        pv.insert(std::make_pair(i, i));
+    }
+    PersistentAVLTree<int,int>::Snapshot before = pv.snapshot();
+    for(int i = 0; i < 100; i += 2) {
+        pv.remove(i);
+    }
+    cout << "\nPersistentAVLTree: " << pv.size() << " keys now, "
+         << before.size() << " in the snapshot, which still has 10: "
+         << (before.find(10) != before.end()) << endl;
+
+    // Concurrent AVL Tree Tests
+    ConcurrentAVLTree<int,int> cv;
+    std::vector<std::thread> writers;
+    for(int t = 0; t < 4; ++t) {
+        writers.push_back(std::thread([&cv, t]() {
+            for(int i = t; i < 1000; i += 4) {
+                cv.insert(std::make_pair(i, i * i));
+            }
+        }));
+    }
+    for(size_t t = 0; t < writers.size(); ++t) {
+        writers[t].join();
+    }
+    int square = 0;
+    cv.find(12, square);
+    cout << "\nConcurrentAVLTree filled by 4 threads: " << cv.size() << " keys, "
+         << "balanced: " << cv.isBalanced() << ", 12 -> " << square << endl;
+
+    // Sharded AVL Map Tests
+    ShardedAVLMap<int,int> sm(4);
+    for(int i = 0; i < 10000; ++i) {
+        sm.insert(std::make_pair(i, -i));
+    }
+    std::vector<std::size_t> shardSizes = sm.shardSizes();
+    cout << "\nShardedAVLMap of " << sm.size() << " keys, shard sizes:";
+    for(size_t i = 0; i < shardSizes.size(); ++i) {
+        cout << " " << shardSizes[i];
+    }
+    cout << endl;
+
+    // Splay Tree Tests
+    SplayTree<int,int> st;
+    for(int i = 0; i < 1000; ++i) {
+        st.insert(std::make_pair(i, i * i));
+    }
+    st.setSplayInterval(4);
+    cout << "\nSplayTree of " << st.size() << " keys, splaying every "
+         << st.getSplayInterval() << "th access, 250 -> " << st.find(250)->second << endl;
+
+#ifdef BST_TRACE
+    cout << "\nTrace events recorded: " << defaultTraceRing().recorded() << endl;
+#endif
+
     return 0;
 }
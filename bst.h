@@ -5,20 +5,88 @@
 #include <exception>
 #include <cstdlib>
 #include <utility>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#include "node_pool.h"
+#include "node_index.h"
+#include "frozen_map.h"
+#include "bst_trace.h"
+#include "key_compare.h"
 
 /**
- * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * Builds a node's item in place, from arguments the node never sees.
+ * Nodes are made through the trees' virtual createNode, which cannot
+ * be a template, so the arguments travel behind this interface and the
+ * node constructor hands build() its own storage: nothing is moved or
+ * copied on the way. build() is called once.
  */
 template <typename Key, typename Value>
+class NodeItemBuilder
+{
+public:
+    virtual void build(std::pair<const Key, Value>* item) = 0;
+
+protected:
+    ~NodeItemBuilder() {}
+};
+
+/**
+ * A NodeItemBuilder that calls construct(item), which must construct
+ * the item at that address, typically with placement new.
+ */
+template <typename Key, typename Value, typename Construct>
+class CallableItemBuilder : public NodeItemBuilder<Key, Value>
+{
+public:
+    explicit CallableItemBuilder(Construct& construct);
+    virtual void build(std::pair<const Key, Value>* item);
+
+private:
+    Construct& construct_;
+};
+
+template <typename Key, typename Value, typename Construct>
+CallableItemBuilder<Key, Value, Construct>::CallableItemBuilder(Construct& construct) :
+    construct_(construct)
+{
+}
+
+template <typename Key, typename Value, typename Construct>
+void CallableItemBuilder<Key, Value, Construct>::build(std::pair<const Key, Value>* item)
+{
+    construct_(item);
+}
+
+/**
+ * A templated class for a Node in a search tree.
+ * Nothing here is virtual, so nodes carry no vtable pointer and
+ * traversal inlines. Derived nodes for other kinds of search trees,
+ * such as Red Black trees and AVL trees, hide the parent/left/right
+ * getters with versions returning their own type, and the trees free
+ * nodes through their concrete type. Splay trees keep nothing extra
+ * and use Node as it is.
+ * The links are pointers unless Links is CompactNodeLinks (see
+ * node_index.h), in which case they are 32-bit indices that the
+ * getters and setters translate. A tree picks the kind through its
+ * allocator. Either way the parent link has NODE_LINK_TAG_BITS spare
+ * bits, which derived nodes reach through getParentTag and
+ * setParentTag.
+ */
+template <typename Key, typename Value, typename Links = PointerNodeLinks>
 class Node
 {
 public:
-    Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    Node(const Key& key, const Value& value, Node<Key, Value, Links>* parent);
+    Node(Key&& key, Value&& value, Node<Key, Value, Links>* parent);
+    Node(NodeItemBuilder<Key, Value>& item, Node<Key, Value, Links>* parent);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,20 +94,31 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value, Links>* getParent() const;
+    Node<Key, Value, Links>* getLeft() const;
+    Node<Key, Value, Links>* getRight() const;
 
-    void setParent(Node<Key, Value>* parent);
-    void setLeft(Node<Key, Value>* left);
-    void setRight(Node<Key, Value>* right);
+    void setParent(Node<Key, Value, Links>* parent);
+    void setLeft(Node<Key, Value, Links>* left);
+    void setRight(Node<Key, Value, Links>* right);
     void setValue(const Value &value);
+    void setValue(Value&& value);
 
 protected:
-    std::pair<const Key, Value> item_;
-    Node<Key, Value>* parent_;
-    Node<Key, Value>* left_;
-    Node<Key, Value>* right_;
+    typedef typename node_link<Key, Value, Links>::type Link;
+    typedef typename node_link<Key, Value, Links>::tagged_type TaggedLink;
+
+    unsigned getParentTag() const;
+    void setParentTag(unsigned tag);
+
+    typedef std::pair<const Key, Value> Item;
+
+    union {
+        Item item_;   // a union member, so that it can be built in place; ~Node destroys it
+    };
+    TaggedLink parent_;   // setParent keeps the tag
+    Link left_;
+    Link right_;
 };
 
 /*
@@ -51,32 +130,55 @@ protected:
 /**
 * Explicit constructor for a node.
 */
-template<typename Key, typename Value>
-Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
+template<typename Key, typename Value, typename Links>
+Node<Key, Value, Links>::Node(const Key& key, const Value& value, Node<Key, Value, Links>* parent) :
     item_(key, value),
     parent_(parent),
     left_(NULL),
     right_(NULL)
 {
+}
+
+/**
+* Constructor that takes over the key and value instead of copying them.
+*/
+template<typename Key, typename Value, typename Links>
+Node<Key, Value, Links>::Node(Key&& key, Value&& value, Node<Key, Value, Links>* parent) :
+    item_(std::move(key), std::move(value)),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+}
 
+/**
+* Constructor that has item build the key and value in place.
+*/
+template<typename Key, typename Value, typename Links>
+Node<Key, Value, Links>::Node(NodeItemBuilder<Key, Value>& item, Node<Key, Value, Links>* parent) :
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+    item.build(&item_);
 }
 
 /**
-* Destructor, which does not need to do anything since the pointers inside of a node
+* Destructor, which only destroys the item, since the pointers inside of a node
 * are only used as references to existing nodes. The nodes pointed to by parent/left/right
 * are freed by the BinarySearchTree.
 */
-template<typename Key, typename Value>
-Node<Key, Value>::~Node()
+template<typename Key, typename Value, typename Links>
+Node<Key, Value, Links>::~Node()
 {
-
+    item_.~Item();
 }
 
 /**
 * A const getter for the item.
 */
-template<typename Key, typename Value>
-const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
+template<typename Key, typename Value, typename Links>
+const std::pair<const Key, Value>& Node<Key, Value, Links>::getItem() const
 {
     return item_;
 }
@@ -84,8 +186,8 @@ const std::pair<const Key, Value>& Node<Key, Value>::getItem() const
 /**
 * A non-const getter for the item.
 */
-template<typename Key, typename Value>
-std::pair<const Key, Value>& Node<Key, Value>::getItem()
+template<typename Key, typename Value, typename Links>
+std::pair<const Key, Value>& Node<Key, Value, Links>::getItem()
 {
     return item_;
 }
@@ -93,8 +195,8 @@ std::pair<const Key, Value>& Node<Key, Value>::getItem()
 /**
 * A const getter for the key.
 */
-template<typename Key, typename Value>
-const Key& Node<Key, Value>::getKey() const
+template<typename Key, typename Value, typename Links>
+const Key& Node<Key, Value, Links>::getKey() const
 {
     return item_.first;
 }
@@ -102,8 +204,8 @@ const Key& Node<Key, Value>::getKey() const
 /**
 * A const getter for the value.
 */
-template<typename Key, typename Value>
-const Value& Node<Key, Value>::getValue() const
+template<typename Key, typename Value, typename Links>
+const Value& Node<Key, Value, Links>::getValue() const
 {
     return item_.second;
 }
@@ -111,35 +213,35 @@ const Value& Node<Key, Value>::getValue() const
 /**
 * A non-const getter for the value.
 */
-template<typename Key, typename Value>
-Value& Node<Key, Value>::getValue()
+template<typename Key, typename Value, typename Links>
+Value& Node<Key, Value, Links>::getValue()
 {
     return item_.second;
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getParent() const
+template<typename Key, typename Value, typename Links>
+Node<Key, Value, Links>* Node<Key, Value, Links>::getParent() const
 {
     return parent_;
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getLeft() const
+template<typename Key, typename Value, typename Links>
+Node<Key, Value, Links>* Node<Key, Value, Links>::getLeft() const
 {
     return left_;
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
-template<typename Key, typename Value>
-Node<Key, Value>* Node<Key, Value>::getRight() const
+template<typename Key, typename Value, typename Links>
+Node<Key, Value, Links>* Node<Key, Value, Links>::getRight() const
 {
     return right_;
 }
@@ -147,8 +249,8 @@ Node<Key, Value>* Node<Key, Value>::getRight() const
 /**
 * A setter for setting the parent of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setParent(Node<Key, Value>* parent)
+template<typename Key, typename Value, typename Links>
+void Node<Key, Value, Links>::setParent(Node<Key, Value, Links>* parent)
 {
     parent_ = parent;
 }
@@ -156,8 +258,8 @@ void Node<Key, Value>::setParent(Node<Key, Value>* parent)
 /**
 * A setter for setting the left child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setLeft(Node<Key, Value>* left)
+template<typename Key, typename Value, typename Links>
+void Node<Key, Value, Links>::setLeft(Node<Key, Value, Links>* left)
 {
     left_ = left;
 }
@@ -165,21 +267,45 @@ void Node<Key, Value>::setLeft(Node<Key, Value>* left)
 /**
 * A setter for setting the right child of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setRight(Node<Key, Value>* right)
+template<typename Key, typename Value, typename Links>
+void Node<Key, Value, Links>::setRight(Node<Key, Value, Links>* right)
 {
     right_ = right;
 }
 
+/**
+* The spare bits kept beside the parent link, which start out zero.
+*/
+template<typename Key, typename Value, typename Links>
+unsigned Node<Key, Value, Links>::getParentTag() const
+{
+    return parent_.tag();
+}
+
+template<typename Key, typename Value, typename Links>
+void Node<Key, Value, Links>::setParentTag(unsigned tag)
+{
+    parent_.setTag(tag);
+}
+
 /**
 * A setter for the value of a node.
 */
-template<typename Key, typename Value>
-void Node<Key, Value>::setValue(const Value& value)
+template<typename Key, typename Value, typename Links>
+void Node<Key, Value, Links>::setValue(const Value& value)
 {
     item_.second = value;
 }
 
+/**
+* A setter for the value of a node that moves the new value in.
+*/
+template<typename Key, typename Value, typename Links>
+void Node<Key, Value, Links>::setValue(Value&& value)
+{
+    item_.second = std::move(value);
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
@@ -188,30 +314,72 @@ void Node<Key, Value>::setValue(const Value& value)
 
 /**
 * A templated unbalanced binary search tree.
+* Nodes are obtained from Alloc (rebound to the node type), so passing
+* a NodePool pools them and lets clear() drop the whole tree at once,
+* and passing a NodeIndexAllocator gives them compact links.
+* Keys are ordered by Compare, a less-than; key_compare.h has the
+* three-way and transparent comparators that make searches cheaper.
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Alloc = std::allocator<std::pair<const Key, Value> >,
+          typename Compare = std::less<Key> >
 class BinarySearchTree
 {
 public:
+    typedef Alloc allocator_type;
+    typedef Compare key_compare;
+    class iterator;
+    class const_iterator;
+    class range_view;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
     BinarySearchTree(); //TODO
+    explicit BinarySearchTree(const Alloc& alloc);
+    explicit BinarySearchTree(const Compare& comp, const Alloc& alloc = Alloc());
     virtual ~BinarySearchTree(); //TODO
-    virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    virtual std::pair<iterator, bool> insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    virtual std::pair<iterator, bool> insert(std::pair<const Key, Value>&& keyValuePair);
+    iterator insert(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    iterator insert(iterator hint, std::pair<const Key, Value>&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename ForwardIt>
+    void build_from_sorted(ForwardIt first, ForwardIt last);
+    FrozenMap<Key, Value, Compare> freeze() const;
     virtual void remove(const Key& key); //TODO
     void clear(); //TODO
     bool isBalanced() const; //TODO
 
     void print() const;
     bool empty() const;
+    std::size_t size() const;
+    allocator_type getAllocator() const;
+    key_compare key_comp() const;
 
     template<typename PPKey, typename PPValue>
     friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+protected:
+    // compact links if Alloc is a NodeIndexAllocator, pointers otherwise
+    typedef typename node_links_of<Alloc>::type NodeLinks;
+    typedef Node<Key, Value, NodeLinks> NodeType;
 public:
     /**
     * An internal iterator class for traversing the contents of the BST.
+    * It is bidirectional: decrementing end() gives the largest item.
     */
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -221,40 +389,180 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BinarySearchTree<Key, Value, Alloc, Compare>;
+        friend class const_iterator;
+        iterator(NodeType* ptr, const BinarySearchTree<Key, Value, Alloc, Compare>* tree);
+        NodeType *current_;
+        const BinarySearchTree<Key, Value, Alloc, Compare>* tree_;   // for stepping back from end()
+    };
+
+    /**
+    * Same as iterator, but the items are read-only. Any iterator converts
+    * to one, and the two compare with each other.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        friend bool operator==(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.current_ == rhs.current_;
+        }
+        friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs)
+        {
+            return lhs.current_ != rhs.current_;
+        }
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        NodeType *current_;
+        const BinarySearchTree<Key, Value, Alloc, Compare>* tree_;
+    };
+
+    /**
+    * The items of a key interval, as returned by range(). Iterating it visits
+    * only those items, in order.
+    */
+    class range_view
+    {
+    public:
+        iterator begin() const;
+        iterator end() const;
+        bool empty() const;
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
-        Node<Key, Value> *current_;
+        friend class BinarySearchTree<Key, Value, Alloc, Compare>;
+        range_view(const iterator& first, const iterator& last);
+        iterator first_;
+        iterator last_;
     };
 
 public:
     iterator begin() const;
     iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
     iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    // Lookups by any key type a transparent Compare accepts
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator lower_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator upper_bound(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    std::pair<iterator, iterator> equal_range(const K& key) const;
+    range_view range(const Key& lo, const Key& hi) const;
+    void find_many(const std::vector<Key>& keys, std::vector<iterator>& out) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
 protected:
+    iterator iteratorAt(NodeType* node) const;
+
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
-    Node<Key, Value> *getSmallestNode() const;  // TODO
-    static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
+    template<typename K>
+    NodeType* internalFind(const K& k) const; // TODO
+    static void prefetchNode(const NodeType* node);
+    template<typename K>
+    NodeType* lowerBoundNode(const K& key) const;
+    template<typename K>
+    NodeType* upperBoundNode(const K& key) const;
+    template<typename K>
+    std::pair<iterator, iterator> equalRangeHelper(const K& key) const;
+    NodeType *getSmallestNode() const;  // TODO
+    NodeType *getLargestNode() const;
+    static NodeType* predecessor(NodeType* current); // TODO
+    static NodeType* successor(NodeType* current);
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
 
     // Provided helper functions
-    virtual void printRoot (Node<Key, Value> *r) const;
-    virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
+    void printRoot (NodeType *r) const;
+    virtual void nodeSwap( NodeType* n1, NodeType* n2) ;
 
     // Add helper functions here
-    void clearHelper(Node<Key, Value>* current); 
-    bool isBalancedHelper(Node<Key, Value>* node) const;
-    int getHeight(Node<Key, Value>* node) const;
+    template<typename V>
+    std::pair<iterator, bool> insertValue(const Key& key, V&& value);
+    template<typename V>
+    std::pair<iterator, bool> insertValue(const Key& key, V&& value, std::true_type storable);
+    template<typename V>
+    std::pair<iterator, bool> insertValue(const Key& key, V&& value, std::false_type storable);
+    template<typename K, typename V>
+    std::pair<iterator, bool> insertHelper(K&& key, V&& value);
+    template<typename K, typename V>
+    iterator insertHintHelper(iterator hint, K&& key, V&& value);
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> tryEmplaceHelper(K&& key, Args&&... args);
+    NodeType* findInsertPosition(const Key& key, NodeType*& parent, bool& left) const;
+    NodeType* findInsertPositionBelow(NodeType* subtree, const Key& key,
+                                              NodeType*& parent, bool& left) const;
+    NodeType* climbToCover(NodeType* finger, const Key& key) const;
+    void linkNode(NodeType* node, NodeType* parent, bool left);
+    void trackLinked(NodeType* node);
+    void trackUnlinked(NodeType* node);
+    virtual NodeType* createNode(NodeItemBuilder<Key, Value>& item, NodeType* parent);
+    template<typename Construct>
+    NodeType* makeNode(Construct construct, NodeType* parent);
+    template<typename K, typename V>
+    NodeType* makeNode(K&& key, V&& value, NodeType* parent);
+    void overwriteValue(NodeType* node, Value&& value, std::true_type assignable);
+    void overwriteValue(NodeType* node, Value&& value, std::false_type assignable);
+    virtual void balanceAfterInsert(NodeType* node);
+    virtual void balanceAfterFind(NodeType* node);
+    template<typename ForwardIt>
+    NodeType* buildHelper(ForwardIt& next, std::size_t count, int& height);
+    virtual void balanceAfterBuild(NodeType* node, int leftHeight, int rightHeight);
+    void clearHelper(NodeType* current); 
+    void clearAll(std::true_type bulkRelease);
+    void clearAll(std::false_type bulkRelease);
+    bool isBalancedHelper(NodeType* node, int& height, int maxHeight) const;
+    virtual std::size_t countNodes() const;
+    int getHeight(NodeType* node) const;
+
+    // Node allocation through Alloc, rebound to the concrete node type
+    template<typename NodeT>
+    NodeT* allocateNode(NodeItemBuilder<Key, Value>& item, NodeT* parent);
+    template<typename NodeT>
+    void deallocateNode(NodeT* node);
+    virtual void destroyNode(NodeType* node);
 
 protected:
-    Node<Key, Value>* root_;
-    // You should not need other data members
+    NodeType* root_;
+    Alloc alloc_;
+    Compare comp_;
+    mutable std::size_t size_;   // UNKNOWN_SIZE until recounted, after nodes move between trees
+    mutable NodeType* rightmost_;   // largest node, or NULL until looked up again
+
+    static const std::size_t UNKNOWN_SIZE = static_cast<std::size_t>(-1);
+    static const std::size_t FIND_MANY_LANES = 16;   // searches find_many keeps in flight
 };
 
 /*
@@ -266,29 +574,32 @@ Begin implementations for the BinarySearchTree::iterator class.
 /**
 * Explicit constructor that initializes an iterator with a given node pointer.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::iterator(NodeType *ptr,
+                                                       const BinarySearchTree<Key, Value, Alloc, Compare>* tree)
 {
     // TODO
     current_ = ptr;
+    tree_ = tree;
 }
 
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::iterator() 
 {
     // TODO
     current_ = NULL;
+    tree_ = NULL;
 }
 
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class Compare>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -296,9 +607,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class Compare>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -307,10 +618,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Alloc, Compare>::iterator& rhs) const
 {
     //TODO
     return current_ == rhs.current_;
@@ -320,10 +631,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Alloc, Compare>::iterator& rhs) const
 {
     // TODO
     return current_ != rhs.current_;
@@ -333,9 +644,9 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator&
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator++()
 {
     // TODO
     if (current_ == NULL) {
@@ -349,7 +660,7 @@ BinarySearchTree<Key, Value>::iterator::operator++()
         }
     }
     else {
-        Node<Key, Value>* parent = current_->getParent();
+        NodeType* parent = current_->getParent();
         while (parent != nullptr && current_ != parent->getLeft()) { //make sure we dont go to root
             current_ = parent;
             parent = parent->getParent();
@@ -359,6 +670,42 @@ BinarySearchTree<Key, Value>::iterator::operator++()
     return *this;
 }
 
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator++(int)
+{
+    iterator old = *this;
+    ++*this;
+    return old;
+}
+
+/**
+* Steps back to the previous item in order. end() steps back to the
+* largest item, which the tree keeps cached, so --end() is O(1).
+* Decrementing begin() is undefined, as for standard containers.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator&
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator--()
+{
+    if (current_ == NULL) {
+        current_ = tree_->getLargestNode();
+    }
+    else {
+        current_ = predecessor(current_);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::iterator::operator--(int)
+{
+    iterator old = *this;
+    --*this;
+    return old;
+}
+
 
 /*
 -------------------------------------------------------------
@@ -366,6 +713,129 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/*
+-------------------------------------------------------------------
+Begin implementations for the BinarySearchTree::const_iterator class.
+-------------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::const_iterator() :
+    current_(NULL),
+    tree_(NULL)
+{
+
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::const_iterator(const iterator& it) :
+    current_(it.current_),
+    tree_(it.tree_)
+{
+
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator*() const
+{
+    return current_->getItem();
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator->() const
+{
+    return &(current_->getItem());
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator&
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator++()
+{
+    if (current_ != NULL) {
+        current_ = successor(current_);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old = *this;
+    ++*this;
+    return old;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator&
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator--()
+{
+    if (current_ == NULL) {
+        current_ = tree_->getLargestNode();
+    }
+    else {
+        current_ = predecessor(current_);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old = *this;
+    --*this;
+    return old;
+}
+
+/*
+-----------------------------------------------------------------
+End implementations for the BinarySearchTree::const_iterator class.
+-----------------------------------------------------------------
+*/
+
+/*
+-----------------------------------------------------------------
+Begin implementations for the BinarySearchTree::range_view class.
+-----------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::range_view::range_view(const iterator& first, const iterator& last) :
+    first_(first),
+    last_(last)
+{
+
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::range_view::begin() const
+{
+    return first_;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::range_view::end() const
+{
+    return last_;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+bool BinarySearchTree<Key, Value, Alloc, Compare>::range_view::empty() const
+{
+    return first_ == last_;
+}
+
+/*
+---------------------------------------------------------------
+End implementations for the BinarySearchTree::range_view class.
+---------------------------------------------------------------
+*/
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -375,15 +845,44 @@ Begin implementations for the BinarySearchTree class.
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::BinarySearchTree() 
 {
     // TODO
     root_ = NULL;
+    size_ = 0;
+    rightmost_ = NULL;
+}
+
+/**
+* Constructor that draws nodes from the given allocator.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::BinarySearchTree(const Alloc& alloc) :
+    root_(NULL),
+    alloc_(alloc),
+    size_(0),
+    rightmost_(NULL)
+{
+
+}
+
+/**
+* Constructor that orders keys by comp and draws nodes from alloc.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::BinarySearchTree(const Compare& comp, const Alloc& alloc) :
+    root_(NULL),
+    alloc_(alloc),
+    comp_(comp),
+    size_(0),
+    rightmost_(NULL)
+{
+
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+template<typename Key, typename Value, typename Alloc, typename Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::~BinarySearchTree()
 {
     // TODO
     clear();
@@ -392,14 +891,46 @@ BinarySearchTree<Key, Value>::~BinarySearchTree()
 /**
  * Returns true if tree is empty
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Alloc, class Compare>
+bool BinarySearchTree<Key, Value, Alloc, Compare>::empty() const
 {
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+/**
+ * Returns the number of keys in the tree
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t BinarySearchTree<Key, Value, Alloc, Compare>::size() const
+{
+    if (size_ == UNKNOWN_SIZE) {
+        size_ = countNodes();
+    }
+    return size_;
+}
+
+/**
+ * Returns a copy of the allocator used for the tree's nodes
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::allocator_type
+BinarySearchTree<Key, Value, Alloc, Compare>::getAllocator() const
+{
+    return alloc_;
+}
+
+/**
+ * Returns a copy of the comparator that orders the keys
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::key_compare
+BinarySearchTree<Key, Value, Alloc, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::print() const
 {
     printRoot(root_);
     std::cout << "\n";
@@ -408,35 +939,80 @@ void BinarySearchTree<Key, Value>::print() const
 /**
 * Returns an iterator to the "smallest" item in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::begin() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
+    BinarySearchTree<Key, Value, Alloc, Compare>::iterator begin(getSmallestNode(), this);
     return begin;
 }
 
 /**
 * Returns an iterator whose value means INVALID
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::end() const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
+    BinarySearchTree<Key, Value, Alloc, Compare>::iterator end(NULL, this);
     return end;
 }
 
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::cbegin() const
+{
+    return begin();
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::cend() const
+{
+    return end();
+}
+
+/**
+* Returns an iterator to the largest item that walks towards the smallest.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::crend() const
+{
+    return const_reverse_iterator(cbegin());
+}
+
 /**
 * Returns an iterator to the item with the given key, k
 * or the end iterator if k does not exist in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::find(const Key & k) const
 {
-    Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    NodeType *curr = internalFind(k);
+    BinarySearchTree<Key, Value, Alloc, Compare>::iterator it(curr, this);
     return it;
 }
 
@@ -444,101 +1020,724 @@ BinarySearchTree<Key, Value>::find(const Key & k) const
  * @precondition The key exists in the map
  * Returns the value associated with the key
  */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<class Key, class Value, class Alloc, class Compare>
+Value& BinarySearchTree<Key, Value, Alloc, Compare>::operator[](const Key& key)
 {
-    Node<Key, Value> *curr = internalFind(key);
+    NodeType *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+template<class Key, class Value, class Alloc, class Compare>
+Value const & BinarySearchTree<Key, Value, Alloc, Compare>::operator[](const Key& key) const
 {
-    Node<Key, Value> *curr = internalFind(key);
+    NodeType *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none.
 */
-
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::lower_bound(const Key& key) const
 {
-    // TODO
-    Node<Key, Value>* current_node = root_;
-    
-    if (root_ == NULL) {
-        Node<Key, Value>* new_node = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, NULL);
-        root_ = new_node;
-        return;
-    }
+    return iterator(lowerBoundNode(key), this);
+}
 
-    Node<Key, Value>* parent_node = NULL;
-    while (current_node != NULL) {
-        parent_node = current_node;
-        if (keyValuePair.first == current_node->getKey()) { //key are same
-            current_node->setValue(keyValuePair.second); //update value
-            return;
-        }
-        else if (keyValuePair.first < current_node->getKey()) {
-            current_node = current_node->getLeft();
-        }
-        else if (keyValuePair.first > current_node->getKey()) {
-            current_node = current_node->getRight();
-        }
-        
-    }
-    
-    //update parent node's left or right child
-    if (keyValuePair.first < parent_node->getKey()) {
-        Node<Key, Value>* new_node = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent_node); //dynamically create new node
-        parent_node->setLeft(new_node);
-    }
-    else if (keyValuePair.first > parent_node->getKey()) {
-        Node<Key, Value>* new_node = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent_node); //dynamically create new node
-        parent_node->setRight(new_node); 
-    }
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or end() if there is none.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::upper_bound(const Key& key) const
+{
+    return iterator(upperBoundNode(key), this);
 }
 
+/**
+* Returns the items with the given key as [first, second): either just
+* that item, or an empty range positioned where it would go.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator,
+          typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator>
+BinarySearchTree<Key, Value, Alloc, Compare>::equal_range(const Key& key) const
+{
+    return equalRangeHelper(key);
+}
 
 /**
-* A remove method to remove a specific key from a Binary Search Tree.
-* Recall: The writeup specifies that if a node has 2 children you
-* should swap with the predecessor and then remove.
+* The lookups above for a key of another type K, which Compare must
+* accept alongside Key. Only offered when Compare is transparent (has an
+* is_transparent member type), so that a plain std::less<Key> still
+* converts the key once rather than at every level.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::find(const K& key) const
 {
-    // TODO
-    if (root_ == NULL) {
-        return;
-    }
-    Node<Key, Value>* nodeToRemove = internalFind(key);
-    if (nodeToRemove == NULL) {
-        return; //key mismatch
-    }
+    return iterator(internalFind(key), this);
+}
 
-    if (nodeToRemove->getLeft() == NULL && nodeToRemove->getRight() == NULL) { //0 children
-        if (nodeToRemove == root_) {
-            root_ = nullptr; 
-        } 
-        else {
-            if (nodeToRemove->getParent()->getLeft() == nodeToRemove) {
-                nodeToRemove->getParent()->setLeft(nullptr);
-            } 
-            else {
-                nodeToRemove->getParent()->setRight(nullptr);
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::lower_bound(const K& key) const
+{
+    return iterator(lowerBoundNode(key), this);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::upper_bound(const K& key) const
+{
+    return iterator(upperBoundNode(key), this);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename C, typename>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator,
+          typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator>
+BinarySearchTree<Key, Value, Alloc, Compare>::equal_range(const K& key) const
+{
+    return equalRangeHelper(key);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator,
+          typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator>
+BinarySearchTree<Key, Value, Alloc, Compare>::equalRangeHelper(const K& key) const
+{
+    NodeType* first = lowerBoundNode(key);
+    if (first != NULL && !comp_(key, first->getKey())) { //key is present
+        return std::make_pair(iterator(first, this), iterator(successor(first), this));
+    }
+    return std::make_pair(iterator(first, this), iterator(first, this));
+}
+
+/**
+* Returns a view of the items with lo <= key < hi, found in O(log n);
+* walking it costs O(1) amortized per item. The view is empty unless
+* lo < hi. Like any iterator, it is invalidated by removing its items.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::range_view
+BinarySearchTree<Key, Value, Alloc, Compare>::range(const Key& lo, const Key& hi) const
+{
+    if (!comp_(lo, hi)) {
+        return range_view(end(), end());
+    }
+    return range_view(lower_bound(lo), lower_bound(hi));
+}
+
+/**
+* Looks up every key in keys, storing an iterator to its item (or end())
+* at the same position in out. A lone find() waits on one cache miss per
+* level; here FIND_MANY_LANES searches advance in turn, one level each,
+* and each prefetches the node it will visit next, so the misses of
+* different searches overlap. A lane that finishes takes the next key.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::find_many(const std::vector<Key>& keys, std::vector<iterator>& out) const
+{
+    out.assign(keys.size(), end());
+    NodeType* cursor[FIND_MANY_LANES];
+    std::size_t slot[FIND_MANY_LANES];
+    std::size_t next = 0;
+    std::size_t live = 0;
+    while (live < FIND_MANY_LANES && next < keys.size()) {
+        cursor[live] = root_;
+        slot[live++] = next++;
+    }
+    while (live > 0) {
+        std::size_t lane = 0;
+        while (lane < live) {
+            NodeType* node = cursor[lane];
+            const Key& key = keys[slot[lane]];
+            bool found = false;
+            if (node != NULL) {
+                int order = compareKeys(comp_, key, node->getKey());
+                if (order < 0) {
+                    node = node->getLeft();
+                }
+                else if (order > 0) {
+                    node = node->getRight();
+                }
+                else {
+                    found = true;
+                }
+            }
+            if (found) {
+                BST_TRACE_EVENT(TRACE_LOOKUP, node, 1);
+                out[slot[lane]] = iterator(node, this);
+            }
+            else if (node != NULL) {
+                prefetchNode(node);
+                cursor[lane++] = node;
+                continue;
+            }
+            else {
+                BST_TRACE_EVENT(TRACE_LOOKUP, root_, 0);
+            }
+            //this search is over: start the next key here, or close the lane
+            if (next < keys.size()) {
+                cursor[lane] = root_;
+                slot[lane++] = next++;
+            }
+            else {
+                --live;
+                cursor[lane] = cursor[live];
+                slot[lane] = slot[live];
+            }
+        }
+    }
+}
+
+/**
+* Starts loading node's cache line, for a search that will reach it soon.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::prefetchNode(const NodeType* node)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(node);
+#else
+    (void)node;
+#endif
+}
+
+/**
+* Wraps a node of this tree (or NULL, for end()) in an iterator, for
+* derived trees that cannot reach the iterator's constructor.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::iteratorAt(NodeType* node) const
+{
+    return iterator(node, this);
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+* Returns an iterator to the key's node and whether the key was new.
+*/
+
+template<class Key, class Value, class Alloc, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    // TODO
+    return insertValue(keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* Same as above, but the value is moved into the tree instead of copied.
+* (The key is const inside the pair, so it is still copied.)
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    return insertValue(keyValuePair.first, std::move(keyValuePair.second));
+}
+
+/**
+* The virtual inserts are instantiated with the tree, so they must compile
+* even for a Value that cannot be copied or moved in, which only emplace()
+* and try_emplace() can store. For such a Value they throw std::logic_error.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename V>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::insertValue(const Key& key, V&& value)
+{
+    typedef std::integral_constant<bool, std::is_constructible<Value, V&&>::value &&
+                                         std::is_assignable<Value&, V&&>::value> Storable;
+    return insertValue(key, std::forward<V>(value), Storable());
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+template<typename V>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::insertValue(const Key& key, V&& value, std::true_type)
+{
+    return insertHelper(key, std::forward<V>(value));
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+template<typename V>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::insertValue(const Key&, V&&, std::false_type)
+{
+    throw std::logic_error("insert: Value cannot be copied or moved into the tree; use try_emplace");
+}
+
+/**
+* Inserts using hint as the suggested position: the key is expected to go
+* just before hint (or last, if hint is end()). When that holds the new node
+* is linked next to hint without walking down from the root; otherwise this
+* falls back to a normal insert. Existing keys are overwritten as in insert().
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::insert(iterator hint, const std::pair<const Key, Value> &keyValuePair)
+{
+    return insertHintHelper(hint, keyValuePair.first, keyValuePair.second);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::insert(iterator hint, std::pair<const Key, Value>&& keyValuePair)
+{
+    return insertHintHelper(hint, keyValuePair.first, std::move(keyValuePair.second));
+}
+
+/**
+* Inserts an item constructed from args, which are forwarded to the
+* constructor of std::pair<const Key, Value>, so std::piecewise_construct
+* works as with std::map. The item is built in a new node before the key
+* is looked up; if the key is already in the tree its value is
+* overwritten, as insert() does, by move-assigning the new one, and the
+* new node is freed. With a Value that cannot be move-assigned that case
+* throws std::logic_error and leaves the tree as it was; try_emplace has
+* no such restriction.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::emplace(Args&&... args)
+{
+    typedef std::pair<const Key, Value> Item;
+    NodeType* node = makeNode([&](Item* item) {
+        ::new (static_cast<void*>(item)) Item(std::forward<Args>(args)...);
+    }, NULL);
+
+    NodeType* parent_node = NULL;
+    bool left = false;
+    NodeType* existing;
+    try {
+        existing = findInsertPosition(node->getKey(), parent_node, left);
+        if (existing != NULL) {
+            overwriteValue(existing, std::move(node->getValue()), std::is_move_assignable<Value>());
+        }
+    }
+    catch (...) {
+        destroyNode(node);
+        throw;
+    }
+    if (existing != NULL) {
+        destroyNode(node);
+        balanceAfterFind(existing);
+        return std::make_pair(iterator(existing, this), false);
+    }
+    node->setParent(parent_node);
+    linkNode(node, parent_node, left);
+    return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* Inserts key with a value constructed from args only if key is absent.
+* An existing key keeps its value and args are left untouched.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    return tryEmplaceHelper(key, std::forward<Args>(args)...);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    return tryEmplaceHelper(std::move(key), std::forward<Args>(args)...);
+}
+
+/**
+* Shared insert path: one walk from the root, then either overwrite the
+* existing value or link a new node where the walk fell off the tree.
+* key and value are forwarded, so rvalues are moved all the way into the node.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename V>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::insertHelper(K&& key, V&& value)
+{
+    NodeType* parent_node;
+    bool left;
+    NodeType* existing = findInsertPosition(key, parent_node, left);
+    if (existing != NULL) { //key are same
+        existing->setValue(std::forward<V>(value)); //update value
+        balanceAfterFind(existing);
+        return std::make_pair(iterator(existing, this), false);
+    }
+    NodeType* new_node = makeNode(std::forward<K>(key), std::forward<V>(value), parent_node); //dynamically create new node
+    linkNode(new_node, parent_node, left);
+    return std::make_pair(iterator(new_node, this), true);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename V>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::insertHintHelper(iterator hint, K&& key, V&& value)
+{
+    NodeType* next = hint.current_;
+    NodeType* prev = (next == NULL) ? getLargestNode() : predecessor(next);
+
+    int order = (next == NULL) ? -1 : compareKeys(comp_, key, next->getKey());
+    if (order == 0) {
+        next->setValue(std::forward<V>(value));
+        balanceAfterFind(next);
+        return hint;
+    }
+    if (root_ == NULL || order > 0 || (prev != NULL && !comp_(prev->getKey(), key))) {
+        //wrong hint
+        return insertHelper(std::forward<K>(key), std::forward<V>(value)).first;
+    }
+
+    //key belongs between prev and next: one of the two has a free slot facing it
+    NodeType* new_node;
+    if (next != NULL && next->getLeft() == NULL) {
+        new_node = makeNode(std::forward<K>(key), std::forward<V>(value), next);
+        next->setLeft(new_node);
+    }
+    else {
+        new_node = makeNode(std::forward<K>(key), std::forward<V>(value), prev);
+        prev->setRight(new_node);
+    }
+    trackLinked(new_node);
+    balanceAfterInsert(new_node);
+    return iterator(new_node, this);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::tryEmplaceHelper(K&& key, Args&&... args)
+{
+    NodeType* parent_node;
+    bool left;
+    NodeType* existing = findInsertPosition(key, parent_node, left);
+    if (existing != NULL) {
+        balanceAfterFind(existing);
+        return std::make_pair(iterator(existing, this), false);
+    }
+    typedef std::pair<const Key, Value> Item;
+    NodeType* new_node = makeNode([&](Item* item) {
+        ::new (static_cast<void*>(item)) Item(std::piecewise_construct,
+                                              std::forward_as_tuple(std::forward<K>(key)),
+                                              std::forward_as_tuple(std::forward<Args>(args)...));
+    }, parent_node);
+    linkNode(new_node, parent_node, left);
+    return std::make_pair(iterator(new_node, this), true);
+}
+
+/**
+* Replaces the contents of the tree with the items in [first, last), which
+* must be sorted by strictly increasing key. The items are linked into a
+* perfectly balanced tree in one in-order pass, so this is O(n) with no
+* comparisons or rotations. Dereferencing a move_iterator moves the items in.
+* If building a node throws, the nodes built so far are freed and the
+* tree is left empty.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ForwardIt>
+void BinarySearchTree<Key, Value, Alloc, Compare>::build_from_sorted(ForwardIt first, ForwardIt last)
+{
+    clear();
+    int height;
+    std::size_t count = std::distance(first, last);
+    root_ = buildHelper(first, count, height);
+}
+
+/**
+* Returns a read-only copy of the tree laid out for fast lookups (see
+* FrozenMap), ordered by the tree's Compare. The tree itself is left as
+* it is. O(n).
+*/
+template<class Key, class Value, class Alloc, class Compare>
+FrozenMap<Key, Value, Compare> BinarySearchTree<Key, Value, Alloc, Compare>::freeze() const
+{
+    return FrozenMap<Key, Value, Compare>(cbegin(), cend(), comp_);
+}
+
+/**
+* Builds a balanced subtree out of the next count items and returns its root
+* (with a NULL parent). The left half is built first so items are consumed
+* in order; height receives the height of the subtree. On an exception the
+* subtree's nodes are freed before it propagates.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ForwardIt>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::buildHelper(ForwardIt& next, std::size_t count, int& height)
+{
+    if (count == 0) {
+        height = 0;
+        return NULL;
+    }
+    int leftHeight, rightHeight;
+    std::size_t leftCount = count / 2;
+    NodeType* left = buildHelper(next, leftCount, leftHeight);
+    NodeType* node = NULL;
+    NodeType* right;
+    try {
+        node = makeNode((*next).first, (*next).second, NULL);
+        ++next;
+        right = buildHelper(next, count - leftCount - 1, rightHeight);
+    }
+    catch (...) { //nothing links what was built so far into the tree, so free it here
+        clearHelper(left);
+        if (node != NULL) {
+            destroyNode(node);
+        }
+        throw;
+    }
+
+    node->setLeft(left);
+    if (left != NULL) {
+        left->setParent(node);
+    }
+    node->setRight(right);
+    if (right != NULL) {
+        right->setParent(node);
+    }
+    balanceAfterBuild(node, leftHeight, rightHeight);
+    height = 1 + std::max(leftHeight, rightHeight);
+    return node;
+}
+
+/**
+* Called for each node of a bulk build once both subtrees are linked,
+* with their heights. An unbalanced tree has nothing to record.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::balanceAfterBuild(NodeType* node, int leftHeight, int rightHeight)
+{
+
+}
+
+/**
+* Walks down to key. Returns its node if present; otherwise returns NULL and
+* sets parent (NULL for an empty tree) and which side of it key belongs on.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::findInsertPosition(const Key& key, NodeType*& parent, bool& left) const
+{
+    return findInsertPositionBelow(root_, key, parent, left);
+}
+
+/**
+* Same as findInsertPosition, but starts at subtree instead of the root.
+* key must fall within the range of keys that subtree covers.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::findInsertPositionBelow(NodeType* subtree, const Key& key,
+                                                             NodeType*& parent, bool& left) const
+{
+    NodeType* current_node = subtree;
+    parent = (subtree == NULL) ? NULL : subtree->getParent();
+    left = (parent != NULL && parent->getLeft() == subtree);
+    while (current_node != NULL) {
+        int order = compareKeys(comp_, key, current_node->getKey());
+        if (order == 0) {
+            return current_node;
+        }
+        parent = current_node;
+        left = (order < 0);
+        current_node = left ? current_node->getLeft() : current_node->getRight();
+    }
+    return NULL;
+}
+
+/**
+* Finger search for ascending keys: climbs from finger to the lowest
+* ancestor whose subtree can hold key, which is where a descent for key
+* can start. Assumes every key left of finger's subtree is smaller than
+* key, as holds when walking a sorted batch of keys.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::climbToCover(NodeType* finger, const Key& key) const
+{
+    NodeType* subtree = finger;
+    while (subtree->getParent() != NULL) {
+        NodeType* parent = subtree->getParent();
+        if (subtree == parent->getLeft() && comp_(key, parent->getKey())) {
+            break; //parent bounds subtree from above and key is below it
+        }
+        subtree = parent;
+    }
+    return subtree;
+}
+
+/**
+* Hangs a freshly created node off parent (or makes it the root)
+* and lets the tree rebalance.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::linkNode(NodeType* node, NodeType* parent, bool left)
+{
+    if (parent == NULL) {
+        root_ = node;
+    }
+    else if (left) {
+        parent->setLeft(node);
+    }
+    else {
+        parent->setRight(node);
+    }
+    trackLinked(node);
+    balanceAfterInsert(node);
+}
+
+/**
+* Keeps the cached largest node current once node is linked in, before
+* any rotation: node is the new largest exactly if it hangs to the right
+* of the old one (or is the only node).
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::trackLinked(NodeType* node)
+{
+    if (rightmost_ != NULL ? rightmost_->getRight() == node : root_ == node) {
+        rightmost_ = node;
+    }
+}
+
+/**
+* Call before unlinking node. If it is the largest node its predecessor
+* takes over; the largest node has no right child, so removals never swap
+* it with another node first.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::trackUnlinked(NodeType* node)
+{
+    if (node == rightmost_) {
+        rightmost_ = predecessor(node);
+    }
+}
+
+/**
+* Builds the node type this tree uses, with item building its key and
+* value in place. Trees with derived nodes override it.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::createNode(NodeItemBuilder<Key, Value>& item, NodeType* parent)
+{
+    return allocateNode(item, parent);
+}
+
+/**
+* Creates a node (through createNode, so of this tree's node type) whose
+* item is constructed at its final address by construct(item).
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename Construct>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::makeNode(Construct construct, NodeType* parent)
+{
+    CallableItemBuilder<Key, Value, Construct> item(construct);
+    return createNode(item, parent);
+}
+
+/**
+* Creates a node holding key and value, each forwarded straight into the
+* node's item, so rvalues are moved once and lvalues copied once.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename V>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::makeNode(K&& key, V&& value, NodeType* parent)
+{
+    typedef std::pair<const Key, Value> Item;
+    return makeNode([&](Item* item) {
+        ::new (static_cast<void*>(item)) Item(std::forward<K>(key), std::forward<V>(value));
+    }, parent);
+}
+
+/**
+* Gives an existing node the value of an emplace() that found its key.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::overwriteValue(NodeType* node, Value&& value, std::true_type)
+{
+    node->setValue(std::move(value));
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::overwriteValue(NodeType*, Value&&, std::false_type)
+{
+    throw std::logic_error("emplace: the key is already in the tree and its value cannot be overwritten");
+}
+
+/**
+* Called after a new node is linked in. An unbalanced tree has nothing to do.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::balanceAfterInsert(NodeType* node)
+{
+
+}
+
+/**
+* Called when an insert finds its key already in the tree. Only trees
+* that adapt to accesses, such as SplayTree, have anything to do.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::balanceAfterFind(NodeType* node)
+{
+
+}
+
+
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+* Recall: The writeup specifies that if a node has 2 children you
+* should swap with the predecessor and then remove.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::remove(const Key& key)
+{
+    // TODO
+    if (root_ == NULL) {
+        return;
+    }
+    NodeType* nodeToRemove = internalFind(key);
+    if (nodeToRemove == NULL) {
+        return; //key mismatch
+    }
+    trackUnlinked(nodeToRemove);
+
+    if (nodeToRemove->getLeft() == NULL && nodeToRemove->getRight() == NULL) { //0 children
+        if (nodeToRemove == root_) {
+            root_ = nullptr; 
+        } 
+        else {
+            if (nodeToRemove->getParent()->getLeft() == nodeToRemove) {
+                nodeToRemove->getParent()->setLeft(nullptr);
+            } 
+            else {
+                nodeToRemove->getParent()->setRight(nullptr);
             }
         }
-        delete nodeToRemove;
+        deallocateNode(nodeToRemove);
     }
     else if (nodeToRemove->getLeft() == NULL || nodeToRemove->getRight() == NULL){ //1 child
-        Node<Key, Value>* child;
+        NodeType* child;
         if (nodeToRemove->getLeft() == nullptr) {
             child = nodeToRemove->getRight();
         } 
@@ -558,7 +1757,7 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
             }
             child->setParent(nodeToRemove->getParent());
         }
-        delete nodeToRemove;
+        deallocateNode(nodeToRemove);
     }
     else { //2 children
         nodeSwap(nodeToRemove, predecessor(nodeToRemove)); //swap node with predecessor
@@ -575,10 +1774,10 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
                     nodeToRemove->getParent()->setRight(nullptr);
                 }
             }
-            delete nodeToRemove;
+            deallocateNode(nodeToRemove);
         }
         else if (nodeToRemove->getLeft() == NULL || nodeToRemove->getRight() == NULL){ //1 child
-            Node<Key, Value>* child;
+            NodeType* child;
             if (nodeToRemove->getLeft() == nullptr) {
                 child = nodeToRemove->getRight();
             } 
@@ -598,16 +1797,16 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
                 }
                 child->setParent(nodeToRemove->getParent());
             }
-            delete nodeToRemove;
+            deallocateNode(nodeToRemove);
         }
     }
 
 }
 
 
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::predecessor(NodeType* current)
 {
     // TODO
     if (current->getLeft() != NULL) { //case 1: we have a left child
@@ -618,7 +1817,31 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
         return current;
     }
     else { //case 2: no left child
-        while (current != current->getParent()->getRight()) {
+        while (current->getParent() != NULL && current != current->getParent()->getRight()) {
+            current = current->getParent();
+        }
+        return current->getParent(); //NULL if we started at the smallest node
+    }
+}
+
+
+/**
+* Returns the node that follows current in key order, or NULL if current
+* holds the largest key.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::successor(NodeType* current)
+{
+    if (current->getRight() != NULL) { //case 1: we have a right child
+        current = current->getRight();
+        while (current->getLeft() != NULL) {
+            current = current->getLeft();
+        }
+        return current;
+    }
+    else { //case 2: no right child
+        while (current->getParent() != NULL && current != current->getParent()->getLeft()) {
             current = current->getParent();
         }
         return current->getParent();
@@ -630,133 +1853,381 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::clear()
 {
     // TODO
+    // a pool can drop every node at once if there is nothing to destruct
+    clearAll(std::integral_constant<bool, allocator_can_release<Alloc>::value &&
+        std::is_trivially_destructible<Key>::value &&
+        std::is_trivially_destructible<Value>::value>());
+    root_ = NULL;
+    size_ = 0;
+    rightmost_ = NULL;
+}
+
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::clearAll(std::true_type)
+{
+    if (!alloc_.releaseIfOnly(size())) { //another tree has nodes in the pool, which must survive
+        clearHelper(root_);
+    }
+}
+
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::clearAll(std::false_type)
+{
     //post order traversal
     clearHelper(root_);
-    root_ = NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearHelper(Node<Key, Value>* current)
+/**
+* Frees the subtree at current without recursion or extra space: while
+* current has a left child, rotate it right, which moves one node off the
+* left spine for good; once there is none, current can be freed and its
+* right subtree is next. Each node is rotated at most once, so this is
+* O(n) however unbalanced the tree. Parent pointers are left stale, since
+* every node is freed anyway.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::clearHelper(NodeType* current)
 {
-    if (current == nullptr) {
-        return;
+    while (current != nullptr) {
+        NodeType* left = current->getLeft();
+        if (left != nullptr) {
+            current->setLeft(left->getRight());
+            left->setRight(current);
+            current = left;
+        }
+        else {
+            NodeType* right = current->getRight();
+            destroyNode(current);
+            current = right;
+        }
     }
-    clearHelper(current->getLeft());
-    clearHelper(current->getRight());
-    delete current;
+}
+
+/**
+* Allocates and constructs a node of type NodeT through the tree's allocator.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename NodeT>
+NodeT* BinarySearchTree<Key, Value, Alloc, Compare>::allocateNode(NodeItemBuilder<Key, Value>& item, NodeT* parent)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<NodeT> NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc nodeAlloc(alloc_);
+    NodeT* node = NodeTraits::allocate(nodeAlloc, 1);
+    try {
+        NodeTraits::construct(nodeAlloc, node, item, parent);
+    }
+    catch (...) {
+        NodeTraits::deallocate(nodeAlloc, node, 1);
+        throw;
+    }
+    BST_TRACE_EVENT(TRACE_NODE_ALLOC, node, sizeof(NodeT));
+    if (size_ != UNKNOWN_SIZE) {
+        ++size_;
+    }
+    return node;
+}
+
+/**
+* Destructs a node of type NodeT and hands its memory back to the allocator.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename NodeT>
+void BinarySearchTree<Key, Value, Alloc, Compare>::deallocateNode(NodeT* node)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<NodeT> NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc nodeAlloc(alloc_);
+    BST_TRACE_EVENT(TRACE_NODE_FREE, node, sizeof(NodeT));
+    NodeTraits::destroy(nodeAlloc, node);
+    NodeTraits::deallocate(nodeAlloc, node, 1);
+    if (size_ != UNKNOWN_SIZE) {
+        --size_;
+    }
+}
+
+/**
+* Frees a node during clear(). Trees that allocate a derived node type
+* override this so the node is destroyed as the type it was built as.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::destroyNode(NodeType* node)
+{
+    deallocateNode(node);
 }
 
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+template<typename Key, typename Value, typename Alloc, typename Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::getSmallestNode() const
 {
     // TODO
     if(!root_) return root_;
-    Node<Key, Value>* current_node = root_;
+    NodeType* current_node = root_;
     while (current_node->getLeft() != NULL) {
         current_node = current_node->getLeft();
     }
     return current_node;
 }
 
+/**
+* A helper function to find the largest node in the tree. The result is
+* cached until something that moves nodes wholesale (clear, split, join,
+* a bulk build) drops the cache, so this is O(1) between such calls.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::getLargestNode() const
+{
+    if(!root_) return root_;
+    if (rightmost_ != NULL) {
+        return rightmost_;
+    }
+    NodeType* current_node = root_;
+    while (current_node->getRight() != NULL) {
+        current_node = current_node->getRight();
+    }
+    rightmost_ = current_node;
+    return current_node;
+}
+
 /**
 * Helper function to find a node with given key, k and
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::internalFind(const K& key) const
 {
     // TODO
-    Node<Key, Value>* current_node = root_;
+    NodeType* current_node = root_;
     while (current_node != NULL) {
-        if (key < current_node->getKey()) {
+        int order = compareKeys(comp_, key, current_node->getKey());
+        if (order < 0) {
             current_node = current_node->getLeft();
         }
-        else if (key > current_node->getKey()) {
+        else if (order > 0) {
             current_node = current_node->getRight();
         }
-        else if (key == current_node->getKey()) { //key are same
+        else { //key are same
+            BST_TRACE_EVENT(TRACE_LOOKUP, current_node, 1);
             return current_node;
         }
     }
+    BST_TRACE_EVENT(TRACE_LOOKUP, root_, 0);
     return NULL;
 }
 
+/**
+* Counts the nodes by walking the whole tree. Used by size() when the
+* running count has been lost; trees that know their size override it.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+std::size_t BinarySearchTree<Key, Value, Alloc, Compare>::countNodes() const
+{
+    std::size_t count = 0;
+    for (NodeType* node = getSmallestNode(); node != NULL; node = successor(node)) {
+        ++count;
+    }
+    return count;
+}
+
+/**
+* Finds the node with the smallest key that is not less than key, or NULL.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::lowerBoundNode(const K& key) const
+{
+    NodeType* bound = NULL;
+    NodeType* current_node = root_;
+    while (current_node != NULL) {
+        if (comp_(current_node->getKey(), key)) {
+            current_node = current_node->getRight();
+        }
+        else { //current node qualifies; look for a smaller one on the left
+            bound = current_node;
+            current_node = current_node->getLeft();
+        }
+    }
+    return bound;
+}
+
+/**
+* Finds the node with the smallest key that is greater than key, or NULL.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType*
+BinarySearchTree<Key, Value, Alloc, Compare>::upperBoundNode(const K& key) const
+{
+    NodeType* bound = NULL;
+    NodeType* current_node = root_;
+    while (current_node != NULL) {
+        if (comp_(key, current_node->getKey())) { //current node qualifies
+            bound = current_node;
+            current_node = current_node->getLeft();
+        }
+        else {
+            current_node = current_node->getRight();
+        }
+    }
+    return bound;
+}
+
 /**
  * Return true iff the BST is balanced.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Alloc, typename Compare>
+bool BinarySearchTree<Key, Value, Alloc, Compare>::isBalanced() const
 {
     // TODO
     //post order traversal
-    return isBalancedHelper(root_);
+    //no balanced tree of n nodes is taller than the sparsest AVL tree,
+    //which has minNodes[h] = minNodes[h-1] + minNodes[h-2] + 1 nodes
+    std::size_t n = size();
+    std::size_t shorter = 0, minNodes = 1;
+    int maxHeight = 1;
+    while (minNodes + shorter + 1 <= n) {
+        std::size_t taller = minNodes + shorter + 1;
+        shorter = minNodes;
+        minNodes = taller;
+        ++maxHeight;
+    }
+    int height;
+    return isBalancedHelper(root_, height, maxHeight);
 }
 
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalancedHelper(Node<Key, Value>* node) const
+/**
+ * Checks the subtree at node in one post-order pass, passing each height
+ * up instead of recomputing it with getHeight at every node, so the whole
+ * check is O(n). The walk follows parent pointers instead of recursing,
+ * and keeps only the left heights along the current path; any path longer
+ * than maxHeight proves the tree unbalanced, so that is all the space it
+ * needs. Stops at the first unbalanced node, in which case height is not
+ * set.
+ */
+template<typename Key, typename Value, typename Alloc, typename Compare>
+bool BinarySearchTree<Key, Value, Alloc, Compare>::isBalancedHelper(NodeType* node, int& height,
+                                                           int maxHeight) const
 {
     if (node == nullptr) {
+        height = 0;
         return true;
     }
 
-    int leftHeight = getHeight(node->getLeft());
-    int rightHeight = getHeight(node->getRight());
+    std::vector<int> leftHeights; //of each node on the current path
+    leftHeights.reserve(maxHeight);
+    NodeType* current = node;
+    NodeType* child = nullptr; //the child we just came up from, if any
+    int below = 0;                      //and the height of its subtree
+    for (;;) {
+        if (child == nullptr) { //first visit
+            if (static_cast<int>(leftHeights.size()) >= maxHeight) {
+                return false;
+            }
+            leftHeights.push_back(0);
+            if (current->getLeft() != nullptr) {
+                current = current->getLeft();
+                continue;
+            }
+        }
+        else if (child == current->getLeft()) {
+            leftHeights.back() = below;
+        }
+        if (current->getRight() != nullptr && child != current->getRight()) {
+            current = current->getRight();
+            child = nullptr;
+            continue;
+        }
 
-    if (abs(leftHeight - rightHeight) > 1) {
-        return false; 
+        int leftHeight = leftHeights.back();
+        int rightHeight = (child != nullptr && child == current->getRight()) ? below : 0;
+        leftHeights.pop_back();
+        if (abs(leftHeight - rightHeight) > 1) {
+            return false; 
+        }
+        below = 1 + std::max(leftHeight, rightHeight);
+        if (current == node) {
+            height = below;
+            return true;
+        }
+        child = current;
+        current = current->getParent();
     }
-
-    return isBalancedHelper(node->getLeft()) && isBalancedHelper(node->getRight());
 }
 
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::getHeight(Node<Key, Value>* node) const
+/**
+ * Height of the subtree at node, found by walking it through the parent
+ * pointers, so it needs no stack however deep the tree is.
+ */
+template<typename Key, typename Value, typename Alloc, typename Compare>
+int BinarySearchTree<Key, Value, Alloc, Compare>::getHeight(NodeType* node) const
 {
     if (node == nullptr) {
         return 0; 
     }
 
-    int leftHeight = getHeight(node->getLeft());
-    int rightHeight = getHeight(node->getRight());
-
-    if (leftHeight > rightHeight) {
-        return 1 + leftHeight;
-    }
-    else {
-        return 1 + rightHeight;
+    int height = 0;
+    int depth = 0;
+    NodeType* current = node;
+    NodeType* child = nullptr; //the child we just came up from, if any
+    for (;;) {
+        if (child == nullptr) { //first visit
+            ++depth;
+            height = std::max(height, depth);
+            if (current->getLeft() != nullptr) {
+                current = current->getLeft();
+                continue;
+            }
+        }
+        if (current->getRight() != nullptr && child != current->getRight()) {
+            current = current->getRight();
+            child = nullptr;
+            continue;
+        }
+        if (current == node) {
+            return height;
+        }
+        --depth;
+        child = current;
+        current = current->getParent();
     }
 }
 
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::nodeSwap( NodeType* n1, NodeType* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
-    Node<Key, Value>* n1p = n1->getParent();
-    Node<Key, Value>* n1r = n1->getRight();
-    Node<Key, Value>* n1lt = n1->getLeft();
+    if (rightmost_ == n1 || rightmost_ == n2) { //a swap can move it off the right spine
+        rightmost_ = NULL;
+    }
+    NodeType* n1p = n1->getParent();
+    NodeType* n1r = n1->getRight();
+    NodeType* n1lt = n1->getLeft();
     bool n1isLeft = false;
     if(n1p != NULL && (n1 == n1p->getLeft())) n1isLeft = true;
-    Node<Key, Value>* n2p = n2->getParent();
-    Node<Key, Value>* n2r = n2->getRight();
-    Node<Key, Value>* n2lt = n2->getLeft();
+    NodeType* n2p = n2->getParent();
+    NodeType* n2r = n2->getRight();
+    NodeType* n2lt = n2->getLeft();
     bool n2isLeft = false;
     if(n2p != NULL && (n2 == n2p->getLeft())) n2isLeft = true;
 
 
-    Node<Key, Value>* temp;
+    NodeType* temp;
     temp = n1->getParent();
     n1->setParent(n2->getParent());
     n2->setParent(temp);
@@ -0,0 +1,185 @@
+#ifndef BST_TRACE_H
+#define BST_TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Event tracing for the search trees.
+ *
+ * The trees report what they do through BST_TRACE_EVENT. Unless the
+ * build defines BST_TRACE (see DEFS in the Makefile) the macro expands
+ * to nothing, so tracing costs nothing when it is off. When it is on,
+ * every event goes to the current TraceObserver, which by default is
+ * a lock-free ring buffer holding the most recent events.
+ */
+
+enum TraceEventType
+{
+    TRACE_NODE_ALLOC,   // detail: size of the node in bytes
+    TRACE_NODE_FREE,    // detail: size of the node in bytes
+    TRACE_LOOKUP,       // detail: 1 if the key was found, 0 if not
+    TRACE_ROTATE_LEFT,  // node: the node that moved down
+    TRACE_ROTATE_RIGHT, // node: the node that moved down
+    TRACE_INSERT_FIX,   // detail: balance of the grandparent after the update
+    TRACE_REMOVE_FIX    // detail: balance of the node plus diff
+};
+
+struct TraceEvent
+{
+    uint64_t sequence;
+    TraceEventType type;
+    int detail;
+    const void* node;
+};
+
+/**
+ * Interface for anything that wants to receive tree events.
+ * onEvent() is called on the hot path, so it should not block.
+ */
+class TraceObserver
+{
+public:
+    virtual ~TraceObserver() { }
+    virtual void onEvent(TraceEventType type, const void* node, int detail) = 0;
+};
+
+/**
+ * A fixed-size ring of the most recent events. Any number of threads
+ * may record at once without locking; old events are overwritten.
+ * Each slot is guarded by its own sequence number so snapshot() can
+ * skip slots that are being rewritten while it reads.
+ */
+class TraceRing : public TraceObserver
+{
+public:
+    explicit TraceRing(std::size_t capacityLog2 = 16);
+
+    virtual void onEvent(TraceEventType type, const void* node, int detail);
+
+    std::vector<TraceEvent> snapshot() const;
+    uint64_t recorded() const;
+    std::size_t capacity() const;
+
+private:
+    TraceRing(const TraceRing&);
+    TraceRing& operator=(const TraceRing&);
+
+    struct Slot
+    {
+        std::atomic<uint64_t> stamp; // 2*sequence+1 while writing, 2*sequence+2 when done
+        std::atomic<int> type;
+        std::atomic<int> detail;
+        std::atomic<const void*> node;
+    };
+
+    std::vector<Slot> slots_;
+    std::size_t mask_;
+    std::atomic<uint64_t> head_;
+};
+
+inline TraceRing::TraceRing(std::size_t capacityLog2) :
+    slots_(std::size_t(1) << capacityLog2),
+    mask_((std::size_t(1) << capacityLog2) - 1),
+    head_(0)
+{
+    for (std::size_t i = 0; i < slots_.size(); ++i) {
+        slots_[i].stamp.store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Claims the next slot and writes the event into it.
+*/
+inline void TraceRing::onEvent(TraceEventType type, const void* node, int detail)
+{
+    uint64_t seq = head_.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slots_[seq & mask_];
+    slot.stamp.store(2 * seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.type.store(type, std::memory_order_relaxed);
+    slot.detail.store(detail, std::memory_order_relaxed);
+    slot.node.store(node, std::memory_order_relaxed);
+    slot.stamp.store(2 * seq + 2, std::memory_order_release);
+}
+
+/**
+* Copies out the events still held by the ring, oldest first.
+* Events overwritten or half-written during the copy are left out.
+*/
+inline std::vector<TraceEvent> TraceRing::snapshot() const
+{
+    std::vector<TraceEvent> events;
+    uint64_t end = head_.load(std::memory_order_acquire);
+    uint64_t begin = end > slots_.size() ? end - slots_.size() : 0;
+    for (uint64_t seq = begin; seq < end; ++seq) {
+        const Slot& slot = slots_[seq & mask_];
+        if (slot.stamp.load(std::memory_order_acquire) != 2 * seq + 2) {
+            continue;
+        }
+        TraceEvent event;
+        event.sequence = seq;
+        event.type = static_cast<TraceEventType>(slot.type.load(std::memory_order_relaxed));
+        event.detail = slot.detail.load(std::memory_order_relaxed);
+        event.node = slot.node.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.stamp.load(std::memory_order_relaxed) == 2 * seq + 2) {
+            events.push_back(event);
+        }
+    }
+    return events;
+}
+
+/**
+* Total number of events ever recorded, including overwritten ones.
+*/
+inline uint64_t TraceRing::recorded() const
+{
+    return head_.load(std::memory_order_relaxed);
+}
+
+inline std::size_t TraceRing::capacity() const
+{
+    return slots_.size();
+}
+
+/**
+* The ring that receives events until another observer is installed.
+*/
+inline TraceRing& defaultTraceRing()
+{
+    static TraceRing ring;
+    return ring;
+}
+
+inline std::atomic<TraceObserver*>& traceObserverSlot()
+{
+    static std::atomic<TraceObserver*> observer(&defaultTraceRing());
+    return observer;
+}
+
+/**
+* Installs the observer for all trees. Passing NULL drops events.
+*/
+inline void setTraceObserver(TraceObserver* observer)
+{
+    traceObserverSlot().store(observer, std::memory_order_release);
+}
+
+inline void traceEmit(TraceEventType type, const void* node, int detail)
+{
+    TraceObserver* observer = traceObserverSlot().load(std::memory_order_acquire);
+    if (observer != NULL) {
+        observer->onEvent(type, node, detail);
+    }
+}
+
+#ifdef BST_TRACE
+#define BST_TRACE_EVENT(type, node, detail) traceEmit((type), (node), (detail))
+#else
+#define BST_TRACE_EVENT(type, node, detail) ((void)0)
+#endif
+
+#endif
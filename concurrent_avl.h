@@ -0,0 +1,1072 @@
+#ifndef CONCURRENT_AVL_H
+#define CONCURRENT_AVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <utility>
+#include "bst_trace.h"
+#include "epoch.h"
+
+/**
+ * A node of a ConcurrentAVLTree. Every field that other threads read
+ * without the node's lock is atomic. value_ points at a boxed value, or
+ * is NULL for a routing node: a removed key whose node still has two
+ * children, kept only to direct searches until a rebalance can unlink it.
+ *
+ * version_ lets readers traverse without locking. A rotation that moves
+ * the node down (so keys that were below it may no longer be) marks it
+ * SHRINKING while it works and then bumps the count, and unlinking the
+ * node sets it to UNLINKED for good. A reader that sees the same version
+ * before and after following a link knows the link was still right.
+ */
+template <typename Key, typename Value>
+class ConcurrentAVLNode
+{
+public:
+    static const uint64_t UNLINKED = 1;
+    static const uint64_t SHRINKING = 2;
+    static const uint64_t VERSION_STEP = 4;
+
+    ConcurrentAVLNode(const Key& key, Value* value, ConcurrentAVLNode<Key, Value>* parent) :
+        key_(key),
+        version_(0),
+        left_(NULL),
+        right_(NULL),
+        value_(value),
+        parent_(parent),
+        height_(1),
+        locked_(false)
+    {
+
+    }
+
+    std::atomic<ConcurrentAVLNode<Key, Value>*>& child(int dir)
+    {
+        return dir < 0 ? left_ : right_;
+    }
+
+    void lock()
+    {
+        while (locked_.exchange(true, std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+
+    void unlock()
+    {
+        locked_.store(false, std::memory_order_release);
+    }
+
+    static int heightOf(const ConcurrentAVLNode<Key, Value>* node)
+    {
+        return node == NULL ? 0 : node->height_.load();
+    }
+
+    // what a lookup reads comes first, to share a cache line
+    const Key key_;
+    std::atomic<uint64_t> version_;
+    std::atomic<ConcurrentAVLNode<Key, Value>*> left_;
+    std::atomic<ConcurrentAVLNode<Key, Value>*> right_;
+    std::atomic<Value*> value_;
+    std::atomic<ConcurrentAVLNode<Key, Value>*> parent_;
+    std::atomic<int> height_;
+
+private:
+    std::atomic<bool> locked_;
+};
+
+/**
+ * An AVL map that any number of threads may read and update at once.
+ *
+ * Lookups take no locks: they check each node's version around every
+ * link they follow and back up a level if it changed (Bronson et al.,
+ * "A Practical Concurrent Binary Search Tree"). Updates lock only the
+ * nodes they change. Height fixes and rotations run bottom-up after the
+ * update, each step locking a parent, the node and the child it rotates
+ * with, always in that order, and the balance is relaxed while they are
+ * in flight. Removing a key with two children only clears its value; the
+ * node stays as a routing node until it is down to one child.
+ *
+ * Nodes and values that are unlinked are handed to defaultEpochDomain(),
+ * so a reader never sees memory freed under it. Values are copied out,
+ * never returned by reference. clear(), forEach() and isBalanced() must
+ * not run alongside any other operation. Key must be default
+ * constructible, for the holder node above the root.
+ */
+template <typename Key, typename Value>
+class ConcurrentAVLTree
+{
+public:
+    ConcurrentAVLTree();
+    ~ConcurrentAVLTree();
+
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    bool remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+
+    std::size_t size() const;
+    bool empty() const;
+    void clear();
+
+    template<typename Function>
+    void forEach(Function function) const;
+    bool isBalanced() const;
+
+protected:
+    typedef ConcurrentAVLNode<Key, Value> Node;
+
+    enum Outcome { RETRY, UNCHANGED, ADDED, REPLACED, REMOVED };
+    enum Lookup { LOOKUP_RETRY, LOOKUP_ABSENT, LOOKUP_FOUND };
+
+    // nodeCondition() results; anything else is the height a node should have
+    static const int NOTHING_REQUIRED = -3;
+    static const int REBALANCE_REQUIRED = -2;
+    static const int UNLINK_REQUIRED = -1;
+
+    /**
+    * Holds a node's lock for the current scope.
+    */
+    class NodeLock
+    {
+    public:
+        explicit NodeLock(Node* node) : node_(node) { node_->lock(); }
+        ~NodeLock() { node_->unlock(); }
+    private:
+        NodeLock(const NodeLock&);
+        NodeLock& operator=(const NodeLock&);
+        Node* node_;
+    };
+
+    static int compareKeys(const Key& a, const Key& b);
+    static bool isShrinking(uint64_t version);
+    static bool isUnlinked(uint64_t version);
+    static void waitUntilShrinkCompleted(Node* node, uint64_t version);
+
+    Lookup attemptGet(const Key& key, Node* node, int dir, uint64_t nodeVersion, Value& value) const;
+
+    Outcome update(const Key& key, const Value* value);
+    bool attemptInsertIntoEmpty(const Key& key, const Value& value);
+    Outcome attemptUpdate(const Key& key, const Value* value, Node* parent, Node* node, uint64_t nodeVersion);
+    Outcome attemptNodeUpdate(const Value* value, Node* parent, Node* node);
+    bool attemptUnlink(Node* parent, Node* node);
+
+    static int nodeCondition(Node* node);
+    Node* fixHeight(Node* node);
+    void fixHeightAndRebalance(Node* node);
+    Node* rebalance(Node* parent, Node* node);
+    Node* rebalanceToRight(Node* parent, Node* node, Node* left, int heightRight);
+    Node* rebalanceToLeft(Node* parent, Node* node, Node* right, int heightLeft);
+    Node* rotateRight(Node* parent, Node* node, Node* left, int heightRight,
+                      int heightLeftLeft, Node* leftRight, int heightLeftRight);
+    Node* rotateLeft(Node* parent, Node* node, Node* right, int heightLeft,
+                     int heightRightRight, Node* rightLeft, int heightRightLeft);
+    Node* rotateRightOverLeft(Node* parent, Node* node, Node* left, int heightRight,
+                              int heightLeftLeft, Node* leftRight, int heightLeftRightLeft);
+    Node* rotateLeftOverRight(Node* parent, Node* node, Node* right, int heightLeft,
+                              int heightRightRight, Node* rightLeft, int heightRightLeftRight);
+
+    static Node* makeNode(const Key& key, Value* value, Node* parent);
+    static void deleteNode(void* node);
+    static void deleteValue(void* value);
+    static void clearHelper(Node* node);
+    template<typename Function>
+    static void forEachHelper(const Node* node, Function& function);
+    static int checkBalance(const Node* node);
+
+    Node holder_;   // root_ is holder_.right_; the holder never moves or shrinks
+    std::atomic<std::size_t> size_;
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  -----------------------------------------------------
+*/
+
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::ConcurrentAVLTree() :
+    holder_(Key(), NULL, NULL),
+    size_(0)
+{
+
+}
+
+template<class Key, class Value>
+ConcurrentAVLTree<Key, Value>::~ConcurrentAVLTree()
+{
+    clear();
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+* Returns true if the key was new.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    EpochDomain::Guard guard(defaultEpochDomain());
+    Outcome outcome = update(keyValuePair.first, &keyValuePair.second);
+    if (outcome == ADDED) {
+        size_.fetch_add(1);
+    }
+    return outcome == ADDED;
+}
+
+/**
+* Removes the key if it is present. Returns true if it was.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::remove(const Key& key)
+{
+    EpochDomain::Guard guard(defaultEpochDomain());
+    Outcome outcome = update(key, NULL);
+    if (outcome == REMOVED) {
+        size_.fetch_sub(1);
+    }
+    return outcome == REMOVED;
+}
+
+/**
+* Copies the key's value into value and returns true, or returns false
+* if the key is not present. Takes no locks.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::find(const Key& key, Value& value) const
+{
+    EpochDomain::Guard guard(defaultEpochDomain());
+    Lookup lookup;
+    do {
+        lookup = attemptGet(key, const_cast<Node*>(&holder_), 1, 0, value);
+    } while (lookup == LOOKUP_RETRY);
+    BST_TRACE_EVENT(TRACE_LOOKUP, &holder_, lookup == LOOKUP_FOUND);
+    return lookup == LOOKUP_FOUND;
+}
+
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::contains(const Key& key) const
+{
+    Value value;
+    return find(key, value);
+}
+
+/**
+* The number of keys. Exact when no update is in flight.
+*/
+template<class Key, class Value>
+std::size_t ConcurrentAVLTree<Key, Value>::size() const
+{
+    return size_.load();
+}
+
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::empty() const
+{
+    return holder_.right_.load() == NULL;
+}
+
+/**
+* Frees every node at once rather than through the epoch domain, so no
+* other thread may be using the tree.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::clear()
+{
+    clearHelper(holder_.right_.load());
+    holder_.right_.store(NULL);
+    size_.store(0);
+}
+
+/**
+* Calls function(key, value) for every key in order. No other thread
+* may be updating the tree.
+*/
+template<class Key, class Value>
+template<typename Function>
+void ConcurrentAVLTree<Key, Value>::forEach(Function function) const
+{
+    forEachHelper(holder_.right_.load(), function);
+}
+
+/**
+* Checks the AVL property and the stored heights. Only meaningful when
+* no update is in flight, since the balance is relaxed while one is.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::isBalanced() const
+{
+    return checkBalance(holder_.right_.load()) >= 0;
+}
+
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::compareKeys(const Key& a, const Key& b)
+{
+    return a < b ? -1 : (b < a ? 1 : 0);
+}
+
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::isShrinking(uint64_t version)
+{
+    return (version & Node::SHRINKING) != 0;
+}
+
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::isUnlinked(uint64_t version)
+{
+    return version == Node::UNLINKED;
+}
+
+/**
+* Waits out a rotation that is moving node down. Spins briefly, then
+* takes the node's lock, which the rotation holds until it is done.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::waitUntilShrinkCompleted(Node* node, uint64_t version)
+{
+    if (!isShrinking(version)) {
+        return;
+    }
+    for (int i = 0; i < 100; ++i) {
+        if (node->version_.load() != version) {
+            return;
+        }
+    }
+    NodeLock lock(node);
+}
+
+/**
+* Looks for key below node's child in direction dir, given the version
+* of node that was seen when the link to it was followed. Returns
+* LOOKUP_RETRY if node changed, so the caller must look again from its
+* own node.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Lookup
+ConcurrentAVLTree<Key, Value>::attemptGet(const Key& key, Node* node, int dir, uint64_t nodeVersion, Value& value) const
+{
+    while (true) {
+        Node* child = node->child(dir).load();
+        if (node->version_.load() != nodeVersion) {
+            return LOOKUP_RETRY;
+        }
+        if (child == NULL) {
+            return LOOKUP_ABSENT;
+        }
+        int nextDir = compareKeys(key, child->key_);
+        if (nextDir == 0) {
+            Value* found = child->value_.load();
+            if (found == NULL) {
+                return LOOKUP_ABSENT;
+            }
+            value = *found;
+            return LOOKUP_FOUND;
+        }
+        uint64_t childVersion = child->version_.load();
+        if (isShrinking(childVersion)) {
+            waitUntilShrinkCompleted(child, childVersion);
+        }
+        else if (!isUnlinked(childVersion) && child == node->child(dir).load()) {
+            if (node->version_.load() != nodeVersion) {
+                return LOOKUP_RETRY;
+            }
+            Lookup lookup = attemptGet(key, child, nextDir, childVersion, value);
+            if (lookup != LOOKUP_RETRY) {
+                return lookup;
+            }
+        }
+        //otherwise child moved under us; read the link again
+    }
+}
+
+/**
+* Sets key to *value, or removes key if value is NULL.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::update(const Key& key, const Value* value)
+{
+    while (true) {
+        Node* root = holder_.right_.load();
+        if (root == NULL) {
+            if (value == NULL) {
+                return UNCHANGED;
+            }
+            if (attemptInsertIntoEmpty(key, *value)) {
+                return ADDED;
+            }
+        }
+        else {
+            uint64_t rootVersion = root->version_.load();
+            if (isShrinking(rootVersion)) {
+                waitUntilShrinkCompleted(root, rootVersion);
+            }
+            else if (root == holder_.right_.load()) {
+                Outcome outcome = attemptUpdate(key, value, &holder_, root, rootVersion);
+                if (outcome != RETRY) {
+                    return outcome;
+                }
+            }
+        }
+    }
+}
+
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::attemptInsertIntoEmpty(const Key& key, const Value& value)
+{
+    NodeLock lock(&holder_);
+    if (holder_.right_.load() != NULL) {
+        return false;
+    }
+    holder_.right_.store(makeNode(key, new Value(value), &holder_));
+    holder_.height_.store(2);
+    return true;
+}
+
+/**
+* Carries the update down from node, whose version was nodeVersion when
+* the link from parent was followed. Returns RETRY if node changed, so
+* the caller must try again from parent.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::attemptUpdate(const Key& key, const Value* value, Node* parent, Node* node, uint64_t nodeVersion)
+{
+    int dir = compareKeys(key, node->key_);
+    if (dir == 0) {
+        return attemptNodeUpdate(value, parent, node);
+    }
+    while (true) {
+        Node* child = node->child(dir).load();
+        if (node->version_.load() != nodeVersion) {
+            return RETRY;
+        }
+        if (child == NULL) {
+            if (value == NULL) {
+                return UNCHANGED;
+            }
+            Node* damaged;
+            {
+                NodeLock lock(node);
+                if (node->version_.load() != nodeVersion) {
+                    return RETRY;
+                }
+                if (node->child(dir).load() != NULL) {
+                    continue;   // someone else filled the slot; look again
+                }
+                node->child(dir).store(makeNode(key, new Value(*value), node));
+                damaged = fixHeight(node);
+            }
+            fixHeightAndRebalance(damaged);
+            return ADDED;
+        }
+        uint64_t childVersion = child->version_.load();
+        if (isShrinking(childVersion)) {
+            waitUntilShrinkCompleted(child, childVersion);
+        }
+        else if (child == node->child(dir).load()) {
+            if (node->version_.load() != nodeVersion) {
+                return RETRY;
+            }
+            Outcome outcome = attemptUpdate(key, value, node, child, childVersion);
+            if (outcome != RETRY) {
+                return outcome;
+            }
+        }
+    }
+}
+
+/**
+* Updates the node that holds the key. A removal unlinks the node if it
+* has at most one child, which needs the parent's lock as well, and
+* otherwise leaves it as a routing node.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Outcome
+ConcurrentAVLTree<Key, Value>::attemptNodeUpdate(const Value* value, Node* parent, Node* node)
+{
+    EpochDomain& domain = defaultEpochDomain();
+    if (value == NULL) {
+        if (node->value_.load() == NULL) {
+            return UNCHANGED;
+        }
+        if (node->left_.load() == NULL || node->right_.load() == NULL) {
+            Value* previous;
+            Node* damaged;
+            {
+                NodeLock parentLock(parent);
+                if (isUnlinked(parent->version_.load()) || node->parent_.load() != parent) {
+                    return RETRY;
+                }
+                {
+                    NodeLock nodeLock(node);
+                    previous = node->value_.load();
+                    if (previous == NULL) {
+                        return UNCHANGED;
+                    }
+                    if (!attemptUnlink(parent, node)) {
+                        return RETRY;
+                    }
+                }
+                damaged = fixHeight(parent);
+            }
+            domain.retire(previous, &ConcurrentAVLTree<Key, Value>::deleteValue);
+            domain.retire(node, &ConcurrentAVLTree<Key, Value>::deleteNode);
+            fixHeightAndRebalance(damaged);
+            return REMOVED;
+        }
+    }
+
+    Value* replacement = value == NULL ? NULL : new Value(*value);
+    Value* previous;
+    {
+        NodeLock lock(node);
+        if (isUnlinked(node->version_.load())
+            || (value == NULL && (node->left_.load() == NULL || node->right_.load() == NULL))) {
+            //unlinked, or lost a child so a removal must unlink it after all
+            delete replacement;
+            return RETRY;
+        }
+        previous = node->value_.exchange(replacement);
+    }
+    if (previous != NULL) {
+        domain.retire(previous, &ConcurrentAVLTree<Key, Value>::deleteValue);
+    }
+    if (value == NULL) {
+        return previous == NULL ? UNCHANGED : REMOVED;
+    }
+    return previous == NULL ? ADDED : REPLACED;
+}
+
+/**
+* Splices node, which has at most one child, out from under parent.
+* Both locks must be held. The caller retires the node.
+*/
+template<class Key, class Value>
+bool ConcurrentAVLTree<Key, Value>::attemptUnlink(Node* parent, Node* node)
+{
+    Node* parentLeft = parent->left_.load();
+    Node* parentRight = parent->right_.load();
+    if (parentLeft != node && parentRight != node) {
+        return false;
+    }
+    Node* left = node->left_.load();
+    Node* right = node->right_.load();
+    if (left != NULL && right != NULL) {
+        return false;
+    }
+    Node* splice = left != NULL ? left : right;
+    if (parentLeft == node) {
+        parent->left_.store(splice);
+    }
+    else {
+        parent->right_.store(splice);
+    }
+    if (splice != NULL) {
+        splice->parent_.store(parent);
+    }
+    node->version_.store(Node::UNLINKED);
+    node->value_.store(NULL);
+    return true;
+}
+
+/**
+* What node needs: unlinking (a routing node with at most one child), a
+* rotation, a new height (returned as such), or nothing.
+*/
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::nodeCondition(Node* node)
+{
+    Node* left = node->left_.load();
+    Node* right = node->right_.load();
+    if ((left == NULL || right == NULL) && node->value_.load() == NULL) {
+        return UNLINK_REQUIRED;
+    }
+    int height = node->height_.load();
+    int heightLeft = Node::heightOf(left);
+    int heightRight = Node::heightOf(right);
+    int newHeight = 1 + std::max(heightLeft, heightRight);
+    int balance = heightLeft - heightRight;
+    if (balance < -1 || balance > 1) {
+        return REBALANCE_REQUIRED;
+    }
+    return height != newHeight ? newHeight : NOTHING_REQUIRED;
+}
+
+/**
+* Fixes node's height, with node locked. Returns the next node that
+* needs attention: node itself if it needs more than a height fix, its
+* parent if its height changed, or NULL.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::fixHeight(Node* node)
+{
+    int condition = nodeCondition(node);
+    switch (condition) {
+    case REBALANCE_REQUIRED:
+    case UNLINK_REQUIRED:
+        return node;
+    case NOTHING_REQUIRED:
+        return NULL;
+    default:
+        node->height_.store(condition);
+        return node->parent_.load();
+    }
+}
+
+/**
+* Walks up from node to the root fixing heights, rotating and unlinking
+* routing nodes. A rotation can leave more than one node needing work,
+* and reports only the lowest, so the walk does not stop at the first
+* node that is fine: every node it leaves behind is on the way up.
+*/
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::fixHeightAndRebalance(Node* node)
+{
+    while (node != NULL && node->parent_.load() != NULL) {
+        if (isUnlinked(node->version_.load())) {
+            return;   // whoever unlinked it carries on from its parent
+        }
+        int condition = nodeCondition(node);
+        if (condition == NOTHING_REQUIRED) {
+            node = node->parent_.load();
+        }
+        else if (condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED) {
+            NodeLock lock(node);
+            Node* next = fixHeight(node);
+            node = next != NULL ? next : node->parent_.load();
+        }
+        else {
+            Node* parent = node->parent_.load();
+            NodeLock parentLock(parent);
+            if (!isUnlinked(parent->version_.load()) && node->parent_.load() == parent) {
+                NodeLock nodeLock(node);
+                Node* next = rebalance(parent, node);
+                node = next != NULL ? next : parent;
+            }
+            //otherwise node moved; look at it again
+        }
+    }
+}
+
+/**
+* Unlinks or rotates node, with parent and node locked. Returns the next
+* node that needs attention, as fixHeight does.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::rebalance(Node* parent, Node* node)
+{
+    Node* left = node->left_.load();
+    Node* right = node->right_.load();
+    if ((left == NULL || right == NULL) && node->value_.load() == NULL) {
+        if (attemptUnlink(parent, node)) {
+            defaultEpochDomain().retire(node, &ConcurrentAVLTree<Key, Value>::deleteNode);
+            return fixHeight(parent);
+        }
+        return node;
+    }
+    int height = node->height_.load();
+    int heightLeft = Node::heightOf(left);
+    int heightRight = Node::heightOf(right);
+    int newHeight = 1 + std::max(heightLeft, heightRight);
+    int balance = heightLeft - heightRight;
+    if (balance > 1) {
+        return rebalanceToRight(parent, node, left, heightRight);
+    }
+    else if (balance < -1) {
+        return rebalanceToLeft(parent, node, right, heightLeft);
+    }
+    else if (newHeight != height) {
+        node->height_.store(newHeight);
+        return fixHeight(parent);
+    }
+    return NULL;
+}
+
+/**
+* node is left heavy. Rotates right, first rotating left at left if its
+* inner subtree is the taller one.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::rebalanceToRight(Node* parent, Node* node, Node* left, int heightRight)
+{
+    NodeLock leftLock(left);
+    int heightLeft = left->height_.load();
+    if (heightLeft - heightRight <= 1) {
+        return node;   // left shrank before we locked it; look again
+    }
+    Node* leftRight = left->right_.load();
+    int heightLeftLeft = Node::heightOf(left->left_.load());
+    int heightLeftRight = Node::heightOf(leftRight);
+    if (heightLeftLeft >= heightLeftRight) {
+        return rotateRight(parent, node, left, heightRight, heightLeftLeft, leftRight, heightLeftRight);
+    }
+    {
+        NodeLock leftRightLock(leftRight);
+        heightLeftRight = leftRight->height_.load();
+        if (heightLeftLeft >= heightLeftRight) {
+            return rotateRight(parent, node, left, heightRight, heightLeftLeft, leftRight, heightLeftRight);
+        }
+        int heightLeftRightLeft = Node::heightOf(leftRight->left_.load());
+        int balance = heightLeftLeft - heightLeftRightLeft;
+        if (balance >= -1 && balance <= 1) {
+            return rotateRightOverLeft(parent, node, left, heightRight, heightLeftLeft, leftRight, heightLeftRightLeft);
+        }
+    }
+    //the double rotation would leave left unbalanced; fix left first
+    return rebalanceToLeft(node, left, leftRight, heightLeftLeft);
+}
+
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::rebalanceToLeft(Node* parent, Node* node, Node* right, int heightLeft)
+{
+    NodeLock rightLock(right);
+    int heightRight = right->height_.load();
+    if (heightLeft - heightRight >= -1) {
+        return node;
+    }
+    Node* rightLeft = right->left_.load();
+    int heightRightRight = Node::heightOf(right->right_.load());
+    int heightRightLeft = Node::heightOf(rightLeft);
+    if (heightRightRight >= heightRightLeft) {
+        return rotateLeft(parent, node, right, heightLeft, heightRightRight, rightLeft, heightRightLeft);
+    }
+    {
+        NodeLock rightLeftLock(rightLeft);
+        heightRightLeft = rightLeft->height_.load();
+        if (heightRightRight >= heightRightLeft) {
+            return rotateLeft(parent, node, right, heightLeft, heightRightRight, rightLeft, heightRightLeft);
+        }
+        int heightRightLeftRight = Node::heightOf(rightLeft->right_.load());
+        int balance = heightRightRight - heightRightLeftRight;
+        if (balance >= -1 && balance <= 1) {
+            return rotateLeftOverRight(parent, node, right, heightLeft, heightRightRight, rightLeft, heightRightLeftRight);
+        }
+    }
+    return rebalanceToRight(node, right, rightLeft, heightRightRight);
+}
+
+/**
+* Rotates left up into node's place, with parent, node and left locked.
+* node moves down, so it is marked as shrinking while the links change.
+* Returns whichever of the nodes still needs work, as fixHeight does.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::rotateRight(Node* parent, Node* node, Node* left, int heightRight,
+                                           int heightLeftLeft, Node* leftRight, int heightLeftRight)
+{
+    BST_TRACE_EVENT(TRACE_ROTATE_RIGHT, node, 0);
+    uint64_t version = node->version_.load();
+    Node* parentLeft = parent->left_.load();
+    node->version_.store(version | Node::SHRINKING);
+
+    node->left_.store(leftRight);
+    if (leftRight != NULL) {
+        leftRight->parent_.store(node);
+    }
+    left->right_.store(node);
+    node->parent_.store(left);
+    if (parentLeft == node) {
+        parent->left_.store(left);
+    }
+    else {
+        parent->right_.store(left);
+    }
+    left->parent_.store(parent);
+
+    int newHeight = 1 + std::max(heightLeftRight, heightRight);
+    node->height_.store(newHeight);
+    left->height_.store(1 + std::max(heightLeftLeft, newHeight));
+    node->version_.store(version + Node::VERSION_STEP);
+
+    int balance = heightLeftRight - heightRight;
+    if (balance < -1 || balance > 1) {
+        return node;
+    }
+    if ((leftRight == NULL || heightRight == 0) && node->value_.load() == NULL) {
+        return node;
+    }
+    int balanceLeft = heightLeftLeft - newHeight;
+    if (balanceLeft < -1 || balanceLeft > 1) {
+        return left;
+    }
+    if (heightLeftLeft == 0 && left->value_.load() == NULL) {
+        return left;
+    }
+    return fixHeight(parent);
+}
+
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::rotateLeft(Node* parent, Node* node, Node* right, int heightLeft,
+                                          int heightRightRight, Node* rightLeft, int heightRightLeft)
+{
+    BST_TRACE_EVENT(TRACE_ROTATE_LEFT, node, 0);
+    uint64_t version = node->version_.load();
+    Node* parentLeft = parent->left_.load();
+    node->version_.store(version | Node::SHRINKING);
+
+    node->right_.store(rightLeft);
+    if (rightLeft != NULL) {
+        rightLeft->parent_.store(node);
+    }
+    right->left_.store(node);
+    node->parent_.store(right);
+    if (parentLeft == node) {
+        parent->left_.store(right);
+    }
+    else {
+        parent->right_.store(right);
+    }
+    right->parent_.store(parent);
+
+    int newHeight = 1 + std::max(heightLeft, heightRightLeft);
+    node->height_.store(newHeight);
+    right->height_.store(1 + std::max(newHeight, heightRightRight));
+    node->version_.store(version + Node::VERSION_STEP);
+
+    int balance = heightRightLeft - heightLeft;
+    if (balance < -1 || balance > 1) {
+        return node;
+    }
+    if ((rightLeft == NULL || heightLeft == 0) && node->value_.load() == NULL) {
+        return node;
+    }
+    int balanceRight = heightRightRight - newHeight;
+    if (balanceRight < -1 || balanceRight > 1) {
+        return right;
+    }
+    if (heightRightRight == 0 && right->value_.load() == NULL) {
+        return right;
+    }
+    return fixHeight(parent);
+}
+
+/**
+* Rotates left's right child up two levels into node's place, with
+* parent, node, left and leftRight locked. Both node and left move down.
+*/
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::rotateRightOverLeft(Node* parent, Node* node, Node* left, int heightRight,
+                                                   int heightLeftLeft, Node* leftRight, int heightLeftRightLeft)
+{
+    BST_TRACE_EVENT(TRACE_ROTATE_LEFT, left, 0);
+    BST_TRACE_EVENT(TRACE_ROTATE_RIGHT, node, 0);
+    uint64_t version = node->version_.load();
+    uint64_t leftVersion = left->version_.load();
+    Node* parentLeft = parent->left_.load();
+    Node* leftRightLeft = leftRight->left_.load();
+    Node* leftRightRight = leftRight->right_.load();
+    int heightLeftRightRight = Node::heightOf(leftRightRight);
+    node->version_.store(version | Node::SHRINKING);
+    left->version_.store(leftVersion | Node::SHRINKING);
+
+    node->left_.store(leftRightRight);
+    if (leftRightRight != NULL) {
+        leftRightRight->parent_.store(node);
+    }
+    left->right_.store(leftRightLeft);
+    if (leftRightLeft != NULL) {
+        leftRightLeft->parent_.store(left);
+    }
+    leftRight->left_.store(left);
+    left->parent_.store(leftRight);
+    leftRight->right_.store(node);
+    node->parent_.store(leftRight);
+    if (parentLeft == node) {
+        parent->left_.store(leftRight);
+    }
+    else {
+        parent->right_.store(leftRight);
+    }
+    leftRight->parent_.store(parent);
+
+    int newHeight = 1 + std::max(heightLeftRightRight, heightRight);
+    node->height_.store(newHeight);
+    int newHeightLeft = 1 + std::max(heightLeftLeft, heightLeftRightLeft);
+    left->height_.store(newHeightLeft);
+    leftRight->height_.store(1 + std::max(newHeightLeft, newHeight));
+    node->version_.store(version + Node::VERSION_STEP);
+    left->version_.store(leftVersion + Node::VERSION_STEP);
+
+    if (left->value_.load() == NULL && (heightLeftLeft == 0 || heightLeftRightLeft == 0)) {
+        //left is a routing node that just lost a child; we hold its lock and its new parent's
+        attemptUnlink(leftRight, left);
+        defaultEpochDomain().retire(left, &ConcurrentAVLTree<Key, Value>::deleteNode);
+        newHeightLeft = std::max(heightLeftLeft, heightLeftRightLeft);
+        leftRight->height_.store(1 + std::max(newHeightLeft, newHeight));
+        if (newHeightLeft == 0 && leftRight->value_.load() == NULL) {
+            return leftRight;
+        }
+    }
+
+    int balance = heightLeftRightRight - heightRight;
+    if (balance < -1 || balance > 1) {
+        return node;
+    }
+    if ((leftRightRight == NULL || heightRight == 0) && node->value_.load() == NULL) {
+        return node;
+    }
+    int balanceLeftRight = newHeightLeft - newHeight;
+    if (balanceLeftRight < -1 || balanceLeftRight > 1) {
+        return leftRight;
+    }
+    return fixHeight(parent);
+}
+
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::rotateLeftOverRight(Node* parent, Node* node, Node* right, int heightLeft,
+                                                   int heightRightRight, Node* rightLeft, int heightRightLeftRight)
+{
+    BST_TRACE_EVENT(TRACE_ROTATE_RIGHT, right, 0);
+    BST_TRACE_EVENT(TRACE_ROTATE_LEFT, node, 0);
+    uint64_t version = node->version_.load();
+    uint64_t rightVersion = right->version_.load();
+    Node* parentLeft = parent->left_.load();
+    Node* rightLeftLeft = rightLeft->left_.load();
+    Node* rightLeftRight = rightLeft->right_.load();
+    int heightRightLeftLeft = Node::heightOf(rightLeftLeft);
+    node->version_.store(version | Node::SHRINKING);
+    right->version_.store(rightVersion | Node::SHRINKING);
+
+    node->right_.store(rightLeftLeft);
+    if (rightLeftLeft != NULL) {
+        rightLeftLeft->parent_.store(node);
+    }
+    right->left_.store(rightLeftRight);
+    if (rightLeftRight != NULL) {
+        rightLeftRight->parent_.store(right);
+    }
+    rightLeft->right_.store(right);
+    right->parent_.store(rightLeft);
+    rightLeft->left_.store(node);
+    node->parent_.store(rightLeft);
+    if (parentLeft == node) {
+        parent->left_.store(rightLeft);
+    }
+    else {
+        parent->right_.store(rightLeft);
+    }
+    rightLeft->parent_.store(parent);
+
+    int newHeight = 1 + std::max(heightLeft, heightRightLeftLeft);
+    node->height_.store(newHeight);
+    int newHeightRight = 1 + std::max(heightRightLeftRight, heightRightRight);
+    right->height_.store(newHeightRight);
+    rightLeft->height_.store(1 + std::max(newHeight, newHeightRight));
+    node->version_.store(version + Node::VERSION_STEP);
+    right->version_.store(rightVersion + Node::VERSION_STEP);
+
+    if (right->value_.load() == NULL && (heightRightRight == 0 || heightRightLeftRight == 0)) {
+        attemptUnlink(rightLeft, right);
+        defaultEpochDomain().retire(right, &ConcurrentAVLTree<Key, Value>::deleteNode);
+        newHeightRight = std::max(heightRightRight, heightRightLeftRight);
+        rightLeft->height_.store(1 + std::max(newHeight, newHeightRight));
+        if (newHeightRight == 0 && rightLeft->value_.load() == NULL) {
+            return rightLeft;
+        }
+    }
+
+    int balance = heightRightLeftLeft - heightLeft;
+    if (balance < -1 || balance > 1) {
+        return node;
+    }
+    if ((rightLeftLeft == NULL || heightLeft == 0) && node->value_.load() == NULL) {
+        return node;
+    }
+    int balanceRightLeft = newHeightRight - newHeight;
+    if (balanceRightLeft < -1 || balanceRightLeft > 1) {
+        return rightLeft;
+    }
+    return fixHeight(parent);
+}
+
+template<class Key, class Value>
+typename ConcurrentAVLTree<Key, Value>::Node*
+ConcurrentAVLTree<Key, Value>::makeNode(const Key& key, Value* value, Node* parent)
+{
+    Node* node = new Node(key, value, parent);
+    BST_TRACE_EVENT(TRACE_NODE_ALLOC, node, sizeof(Node));
+    return node;
+}
+
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::deleteNode(void* node)
+{
+    BST_TRACE_EVENT(TRACE_NODE_FREE, node, sizeof(Node));
+    delete static_cast<Node*>(node);
+}
+
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::deleteValue(void* value)
+{
+    delete static_cast<Value*>(value);
+}
+
+template<class Key, class Value>
+void ConcurrentAVLTree<Key, Value>::clearHelper(Node* node)
+{
+    if (node == NULL) {
+        return;
+    }
+    clearHelper(node->left_.load());
+    clearHelper(node->right_.load());
+    delete node->value_.load();
+    deleteNode(node);
+}
+
+template<class Key, class Value>
+template<typename Function>
+void ConcurrentAVLTree<Key, Value>::forEachHelper(const Node* node, Function& function)
+{
+    if (node == NULL) {
+        return;
+    }
+    forEachHelper(node->left_.load(), function);
+    const Value* value = node->value_.load();
+    if (value != NULL) {
+        function(node->key_, *value);
+    }
+    forEachHelper(node->right_.load(), function);
+}
+
+/**
+* Returns the height of node's subtree, or -1 if it is unbalanced,
+* a stored height is wrong, or a routing node was left behind.
+*/
+template<class Key, class Value>
+int ConcurrentAVLTree<Key, Value>::checkBalance(const Node* node)
+{
+    if (node == NULL) {
+        return 0;
+    }
+    const Node* left = node->left_.load();
+    const Node* right = node->right_.load();
+    if ((left == NULL || right == NULL) && node->value_.load() == NULL) {
+        return -1;
+    }
+    int heightLeft = checkBalance(left);
+    int heightRight = checkBalance(right);
+    if (heightLeft < 0 || heightRight < 0 || heightLeft - heightRight > 1 || heightRight - heightLeft > 1) {
+        return -1;
+    }
+    int height = 1 + std::max(heightLeft, heightRight);
+    return height == node->height_.load() ? height : -1;
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  ---------------------------------------------------
+*/
+
+#endif
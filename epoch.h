@@ -0,0 +1,300 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Epoch-based reclamation for the concurrent trees. A thread pins the
+ * domain (with a Guard) for as long as it may hold pointers into a
+ * shared structure. Memory unlinked from the structure is retired
+ * rather than freed, stamped with the global epoch, and freed once the
+ * epoch has moved on twice: the epoch only advances when every pinned
+ * thread has seen the current one, so by then no thread pinned early
+ * enough to have reached the retired memory is still pinned.
+ *
+ * Each thread keeps its own retired list, so retiring takes no lock.
+ * A thread's record is handed on to the next new thread when it exits,
+ * together with anything it had not yet freed. The domain must outlive
+ * every thread that used it, which the defaultEpochDomain does.
+ */
+class EpochDomain
+{
+public:
+    EpochDomain();
+    ~EpochDomain();
+
+    /**
+    * Pins the calling thread to the domain for its lifetime. Guards nest.
+    */
+    class Guard
+    {
+    public:
+        explicit Guard(EpochDomain& domain);
+        ~Guard();
+    private:
+        Guard(const Guard&);
+        Guard& operator=(const Guard&);
+        EpochDomain& domain_;
+        void* record_;
+    };
+
+    void retire(void* object, void (*deleter)(void*));
+    template<typename T>
+    void retire(T* object);
+
+    std::size_t pending() const;
+
+private:
+    EpochDomain(const EpochDomain&);
+    EpochDomain& operator=(const EpochDomain&);
+
+    struct Retired
+    {
+        void* object;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    struct ThreadRecord
+    {
+        ThreadRecord() : state(0), owned(true), nesting(0), sinceCollect(0), next(NULL) { }
+
+        std::atomic<uint64_t> state;   // (epoch << 1) | 1 while pinned, 0 otherwise
+        std::atomic<bool> owned;
+        unsigned nesting;
+        std::size_t sinceCollect;
+        std::vector<Retired> retired;
+        ThreadRecord* next;
+    };
+
+    /**
+    * Gives each thread's record back to its domain when the thread exits.
+    */
+    struct ThreadRecords
+    {
+        ~ThreadRecords();
+        std::vector<std::pair<EpochDomain*, ThreadRecord*> > records;
+    };
+
+    template<typename T>
+    static void deleteObject(void* object);
+
+    ThreadRecord* threadRecord();
+    ThreadRecord* acquireRecord();
+    void pin(ThreadRecord* record);
+    void unpin(ThreadRecord* record);
+    bool tryAdvance();
+    void collect(ThreadRecord* record);
+
+    static const std::size_t COLLECT_INTERVAL = 64;   // retires (or unpins) between collections
+
+    std::atomic<uint64_t> epoch_;
+    std::atomic<ThreadRecord*> records_;
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the EpochDomain class.
+  -----------------------------------------
+*/
+
+inline EpochDomain::EpochDomain() :
+    epoch_(0),
+    records_(NULL)
+{
+
+}
+
+/**
+* Frees everything still retired. No thread may be pinned any more.
+*/
+inline EpochDomain::~EpochDomain()
+{
+    ThreadRecord* record = records_.load();
+    while (record != NULL) {
+        ThreadRecord* next = record->next;
+        for (std::size_t i = 0; i < record->retired.size(); ++i) {
+            record->retired[i].deleter(record->retired[i].object);
+        }
+        delete record;
+        record = next;
+    }
+}
+
+inline EpochDomain::Guard::Guard(EpochDomain& domain) :
+    domain_(domain),
+    record_(domain.threadRecord())
+{
+    domain_.pin(static_cast<ThreadRecord*>(record_));
+}
+
+inline EpochDomain::Guard::~Guard()
+{
+    domain_.unpin(static_cast<ThreadRecord*>(record_));
+}
+
+/**
+* Hands object to deleter once no thread can still be using it. The
+* caller must already have unlinked it, so no new thread can reach it.
+*/
+inline void EpochDomain::retire(void* object, void (*deleter)(void*))
+{
+    ThreadRecord* record = threadRecord();
+    Retired retired = { object, deleter, epoch_.load() };
+    record->retired.push_back(retired);
+    if (++record->sinceCollect >= COLLECT_INTERVAL) {
+        record->sinceCollect = 0;
+        tryAdvance();
+        collect(record);
+    }
+}
+
+template<typename T>
+void EpochDomain::retire(T* object)
+{
+    retire(object, &EpochDomain::deleteObject<T>);
+}
+
+template<typename T>
+void EpochDomain::deleteObject(void* object)
+{
+    delete static_cast<T*>(object);
+}
+
+/**
+* How many retired objects are waiting to be freed, over all threads.
+* Only exact while no thread is retiring.
+*/
+inline std::size_t EpochDomain::pending() const
+{
+    std::size_t count = 0;
+    for (ThreadRecord* record = records_.load(); record != NULL; record = record->next) {
+        count += record->retired.size();
+    }
+    return count;
+}
+
+/**
+* The calling thread's record, found in a small thread-local table.
+*/
+inline EpochDomain::ThreadRecord* EpochDomain::threadRecord()
+{
+    static thread_local ThreadRecords local;
+    for (std::size_t i = 0; i < local.records.size(); ++i) {
+        if (local.records[i].first == this) {
+            return local.records[i].second;
+        }
+    }
+    ThreadRecord* record = acquireRecord();
+    local.records.push_back(std::make_pair(this, record));
+    return record;
+}
+
+/**
+* Adopts the record of a thread that has exited, or adds a new one.
+* Records are never removed, so walking the list needs no lock.
+*/
+inline EpochDomain::ThreadRecord* EpochDomain::acquireRecord()
+{
+    for (ThreadRecord* record = records_.load(); record != NULL; record = record->next) {
+        bool owned = false;
+        if (!record->owned.load() && record->owned.compare_exchange_strong(owned, true)) {
+            return record;
+        }
+    }
+    ThreadRecord* record = new ThreadRecord();
+    ThreadRecord* head = records_.load();
+    do {
+        record->next = head;
+    } while (!records_.compare_exchange_weak(head, record));
+    return record;
+}
+
+inline EpochDomain::ThreadRecords::~ThreadRecords()
+{
+    for (std::size_t i = 0; i < records.size(); ++i) {
+        //free what can be freed now; the rest waits for the record's next owner
+        records[i].first->tryAdvance();
+        records[i].first->collect(records[i].second);
+        records[i].second->owned.store(false);
+    }
+}
+
+/**
+* Publishes the epoch this thread has seen. If the epoch moves on
+* between the load and the store, the stale value only holds the next
+* advance back, which is the safe direction.
+*/
+inline void EpochDomain::pin(ThreadRecord* record)
+{
+    if (record->nesting++ == 0) {
+        record->state.store((epoch_.load() << 1) | 1);
+        //the reads this guard protects must not move above the store
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+inline void EpochDomain::unpin(ThreadRecord* record)
+{
+    if (--record->nesting == 0) {
+        record->state.store(0, std::memory_order_release);
+        if (!record->retired.empty() && ++record->sinceCollect >= COLLECT_INTERVAL) {
+            record->sinceCollect = 0;
+            tryAdvance();
+            collect(record);
+        }
+    }
+}
+
+/**
+* Moves the epoch on if every pinned thread has seen the current one.
+*/
+inline bool EpochDomain::tryAdvance()
+{
+    uint64_t epoch = epoch_.load();
+    for (ThreadRecord* record = records_.load(); record != NULL; record = record->next) {
+        uint64_t state = record->state.load();
+        if ((state & 1) != 0 && (state >> 1) != epoch) {
+            return false;
+        }
+    }
+    return epoch_.compare_exchange_strong(epoch, epoch + 1);
+}
+
+/**
+* Frees this thread's retired objects that are two epochs old.
+*/
+inline void EpochDomain::collect(ThreadRecord* record)
+{
+    uint64_t epoch = epoch_.load();
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < record->retired.size(); ++i) {
+        if (record->retired[i].epoch + 2 <= epoch) {
+            record->retired[i].deleter(record->retired[i].object);
+        }
+        else {
+            record->retired[kept++] = record->retired[i];
+        }
+    }
+    record->retired.resize(kept);
+}
+
+/*
+  ---------------------------------------
+  End implementations for the EpochDomain class.
+  ---------------------------------------
+*/
+
+/**
+* The domain the concurrent trees share.
+*/
+inline EpochDomain& defaultEpochDomain()
+{
+    static EpochDomain domain;
+    return domain;
+}
+
+#endif
@@ -9,7 +9,7 @@ using namespace std;
 
 
 // You may add any prototypes of helper functions here
-int height(Node * root);
+void recordLeaf(int depth, int& leafDepth, bool& equal);
 
 /**
  * @brief Returns true if all paths from leaves to root are the same length (height),
@@ -25,22 +25,52 @@ int height(Node * root);
 bool equalPaths(Node * root)
 {
     // Add your code below
-    if (root == NULL) {
-        return true;
-    }
-    if (root->left != NULL && root->right != NULL) {
-        if (height(root->left) != height(root->right)) {
-            return false;
+    // Morris traversal: instead of a stack, the rightmost node of each left
+    // subtree temporarily points back up to the node above it, so even a
+    // tree as deep as it is long needs O(1) extra space. Every thread is
+    // removed again on the way back up, which is why there is no early exit.
+    int leafDepth = -1;
+    bool equal = true;
+    int depth = 0;
+    Node* current = root;
+    while (current != NULL) {
+        if (current->left == NULL) {
+            if (current->right == NULL) { //the last node in order, and a leaf
+                recordLeaf(depth, leafDepth, equal);
+            }
+            current = current->right; //a child, or a thread back up
+            ++depth;
+            continue;
+        }
+        Node* pred = current->left;
+        int steps = 1;
+        while (pred->right != NULL && pred->right != current) {
+            pred = pred->right;
+            ++steps;
+        }
+        if (pred->right == NULL) { //first time here: thread pred back to current
+            if (pred->left == NULL) { //every other leaf is some node's predecessor
+                recordLeaf(depth + steps, leafDepth, equal);
+            }
+            pred->right = current;
+            current = current->left;
+            ++depth;
+        }
+        else { //came back up the thread from pred, which was depth + steps deep
+            pred->right = NULL;
+            depth -= steps + 1;
+            current = current->right;
+            ++depth;
         }
     }
-    
-    return equalPaths(root->left) && equalPaths(root->right);
+    return equal;
 }
 
-int height(Node * root) {
-    if (root == NULL) {
-        return 0;
+void recordLeaf(int depth, int& leafDepth, bool& equal) {
+    if (leafDepth < 0) {
+        leafDepth = depth;
+    }
+    else if (depth != leafDepth) {
+        equal = false;
     }
-    return 1 + max(height(root->left), height(root->right));
 }
-
@@ -0,0 +1,296 @@
+#ifndef FORK_JOIN_H
+#define FORK_JOIN_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A small fork-join thread pool for the divide-and-conquer tree
+ * algorithms (set operations, parallel build).
+ *
+ * invoke(f, g) runs f on the calling thread and offers g to the pool.
+ * If no worker has picked g up by the time f is done, the caller runs
+ * it too; otherwise the caller runs other pending tasks while it waits.
+ * Waiting threads therefore never block the pool, which is what makes
+ * nested invoke() calls safe. Tasks should be coarse (thousands of
+ * nodes each): every task goes through one shared queue.
+ */
+class ForkJoinPool
+{
+public:
+    explicit ForkJoinPool(unsigned threads = std::thread::hardware_concurrency());
+    ~ForkJoinPool();
+
+    template<typename F, typename G>
+    void invoke(F&& f, G&& g);
+
+    unsigned threads() const;
+
+private:
+    ForkJoinPool(const ForkJoinPool&);
+    ForkJoinPool& operator=(const ForkJoinPool&);
+
+    struct Task
+    {
+        std::function<void()> run;
+        std::exception_ptr error;
+        std::atomic<bool> done;
+    };
+
+    static void runTask(Task* task);
+    bool runPending();
+    void workerLoop();
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<Task*> pending_;
+    std::vector<std::thread> workers_;
+    bool stopping_;
+};
+
+/**
+* Starts threads - 1 workers; the thread calling invoke() is the last one.
+* A pool of one thread runs everything inline.
+*/
+inline ForkJoinPool::ForkJoinPool(unsigned threads) :
+    stopping_(false)
+{
+    for (unsigned i = 1; i < threads; ++i) {
+        workers_.push_back(std::thread(&ForkJoinPool::workerLoop, this));
+    }
+}
+
+inline ForkJoinPool::~ForkJoinPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::size_t i = 0; i < workers_.size(); ++i) {
+        workers_[i].join();
+    }
+}
+
+inline unsigned ForkJoinPool::threads() const
+{
+    return static_cast<unsigned>(workers_.size()) + 1;
+}
+
+/**
+* Runs f and g, possibly at the same time, and returns once both are done.
+* If either throws, the exception is rethrown here (f's first) after both
+* have finished.
+*/
+template<typename F, typename G>
+void ForkJoinPool::invoke(F&& f, G&& g)
+{
+    if (workers_.empty()) {
+        f();
+        g();
+        return;
+    }
+    Task task;
+    task.run = std::ref(g);
+    task.done.store(false, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(&task);
+    }
+    wake_.notify_one();
+
+    std::exception_ptr error;
+    try {
+        f();
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+
+    bool stolen = true;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::deque<Task*>::iterator it = std::find(pending_.begin(), pending_.end(), &task);
+        if (it != pending_.end()) {
+            pending_.erase(it);
+            stolen = false;
+        }
+    }
+    if (!stolen) {
+        runTask(&task);
+    }
+    while (!task.done.load(std::memory_order_acquire)) {
+        if (!runPending()) {
+            std::this_thread::yield();
+        }
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if (task.error) {
+        std::rethrow_exception(task.error);
+    }
+}
+
+inline void ForkJoinPool::runTask(Task* task)
+{
+    try {
+        task->run();
+    }
+    catch (...) {
+        task->error = std::current_exception();
+    }
+    task->done.store(true, std::memory_order_release);
+}
+
+/**
+* Runs the most recently offered task, if any. Returns false if there was
+* nothing to run.
+*/
+inline bool ForkJoinPool::runPending()
+{
+    Task* task;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.empty()) {
+            return false;
+        }
+        task = pending_.back();
+        pending_.pop_back();
+    }
+    runTask(task);
+    return true;
+}
+
+inline void ForkJoinPool::workerLoop()
+{
+    for (;;) {
+        Task* task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (pending_.empty() && !stopping_) {
+                wake_.wait(lock);
+            }
+            if (pending_.empty()) {
+                return; //stopping, and nothing left to do
+            }
+            task = pending_.front(); //oldest tasks are the biggest
+            pending_.pop_front();
+        }
+        runTask(task);
+    }
+}
+
+/**
+* The pool that tree operations use unless they are given one, sized to
+* the machine.
+*/
+inline ForkJoinPool& defaultForkJoinPool()
+{
+    static ForkJoinPool pool;
+    return pool;
+}
+
+/**
+* Calls fn(lo, hi) on consecutive chunks of [begin, end), each at most
+* grain long, spread over the pool.
+*/
+template<typename F>
+void parallelFor(ForkJoinPool& pool, std::size_t begin, std::size_t end, std::size_t grain, F&& fn)
+{
+    if (end - begin <= grain) {
+        if (begin < end) {
+            fn(begin, end);
+        }
+        return;
+    }
+    std::size_t mid = begin + (end - begin) / 2;
+    pool.invoke([&]() { parallelFor(pool, begin, mid, grain, fn); },
+                [&]() { parallelFor(pool, mid, end, grain, fn); });
+}
+
+/**
+* Stable merge of the sorted ranges [first1, last1) and [first2, last2)
+* into out, moving the elements. The larger range is cut at its middle
+* and the other at the matching bound, and the two halves are merged in
+* parallel; ties keep the elements of the first range first.
+*/
+template<typename T, typename Less>
+void parallelMerge(T* first1, T* last1, T* first2, T* last2, T* out,
+                   Less less, ForkJoinPool& pool, std::size_t grain)
+{
+    std::size_t n1 = last1 - first1;
+    std::size_t n2 = last2 - first2;
+    if (n1 + n2 <= grain) {
+        std::merge(std::make_move_iterator(first1), std::make_move_iterator(last1),
+                   std::make_move_iterator(first2), std::make_move_iterator(last2), out, less);
+        return;
+    }
+    T* cut1;
+    T* cut2;
+    if (n1 >= n2) {
+        cut1 = first1 + n1 / 2;
+        cut2 = std::lower_bound(first2, last2, *cut1, less);
+    }
+    else {
+        cut2 = first2 + n2 / 2;
+        cut1 = std::upper_bound(first1, last1, *cut2, less);
+    }
+    T* outCut = out + (cut1 - first1) + (cut2 - first2);
+    pool.invoke([&]() { parallelMerge(first1, cut1, first2, cut2, out, less, pool, grain); },
+                [&]() { parallelMerge(cut1, last1, cut2, last2, outCut, less, pool, grain); });
+}
+
+/**
+* Stable-sorts [data, data + n), leaving the result in data, or in buffer
+* if toBuffer. Both halves are sorted in parallel into the other array and
+* then merged back, so the two arrays swap roles at each level.
+*/
+template<typename T, typename Less>
+void parallelSortRange(T* data, T* buffer, std::size_t n, bool toBuffer,
+                       Less less, ForkJoinPool& pool, std::size_t grain)
+{
+    if (n <= grain) {
+        std::stable_sort(data, data + n, less);
+        if (toBuffer) {
+            std::move(data, data + n, buffer);
+        }
+        return;
+    }
+    std::size_t half = n / 2;
+    pool.invoke([&]() { parallelSortRange(data, buffer, half, !toBuffer, less, pool, grain); },
+                [&]() { parallelSortRange(data + half, buffer + half, n - half, !toBuffer, less, pool, grain); });
+    if (toBuffer) {
+        parallelMerge(data, data + half, data + half, data + n, buffer, less, pool, grain);
+    }
+    else {
+        parallelMerge(buffer, buffer + half, buffer + half, buffer + n, data, less, pool, grain);
+    }
+}
+
+/**
+* Stable sort of items on the pool. buffer is scratch space, resized to
+* match items, so T must be default constructible.
+*/
+template<typename T, typename Less>
+void parallelStableSort(std::vector<T>& items, std::vector<T>& buffer, Less less,
+                        ForkJoinPool& pool, std::size_t grain = 1 << 14)
+{
+    buffer.resize(items.size());
+    if (grain < 2) { //merging needs at least two elements per leaf to make progress
+        grain = 2;
+    }
+    parallelSortRange(items.data(), buffer.data(), items.size(), false, less, pool, grain);
+}
+
+#endif
@@ -0,0 +1,490 @@
+#ifndef FROZEN_MAP_H
+#define FROZEN_MAP_H
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * Keys that share one cache line. The descendants of node k that lie
+ * log2(value) levels down are the value keys from k * value on, so the
+ * search prefetches that one line.
+ */
+template <typename Key>
+struct frozen_keys_per_line
+{
+    static const std::size_t value = sizeof(Key) >= 64 ? 1 : 64 / sizeof(Key);
+};
+
+/**
+ * An immutable sorted map for data that is built once and then only read,
+ * as made by BinarySearchTree::freeze().
+ *
+ * The keys sit in one array in Eytzinger (BFS) order: the root at index 1
+ * and the children of k at 2k and 2k + 1, with index 0 unused. A search
+ * is then one comparison per level and no pointer chasing: the result of
+ * the comparison picks the next index, so the loop has no unpredictable
+ * branch, and the top levels, which every search reads, share a few
+ * cache lines. Each step also prefetches the keys a few levels below.
+ * Values are kept in a separate array in the same order, so they do not
+ * dilute the cache lines the search reads.
+ *
+ * Keys are ordered by Compare, a less-than, as in the tree it was frozen
+ * from. Iteration visits the keys in that order. Its items are (key, value) pairs
+ * of references, so `it->first` and `(*it).second` work as for the trees,
+ * but there is no pair object to take the address of.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenMap
+{
+public:
+    class const_iterator;
+    typedef const_iterator iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef Compare key_compare;
+
+    explicit FrozenMap(const Compare& comp = Compare());
+    template<typename ForwardIt>
+    FrozenMap(ForwardIt first, ForwardIt last, const Compare& comp = Compare());
+
+    bool empty() const;
+    std::size_t size() const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_reverse_iterator rbegin() const;
+    const_reverse_iterator rend() const;
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+    key_compare key_comp() const;
+
+    /**
+    * A read-only bidirectional iterator over the map, in key order.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key&, const Value&> reference;
+
+        /**
+        * What operator-> hands out: holds the item so that
+        * it->first can reach into it.
+        */
+        class pointer
+        {
+        public:
+            const reference* operator->() const { return &item_; }
+        private:
+            friend class const_iterator;
+            explicit pointer(const reference& item) : item_(item) { }
+            reference item_;
+        };
+
+        const_iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class FrozenMap<Key, Value, Compare>;
+        const_iterator(const FrozenMap<Key, Value, Compare>* map, std::size_t index);
+        const FrozenMap<Key, Value, Compare>* map_;
+        std::size_t index_;   // Eytzinger index, 0 for end()
+    };
+
+protected:
+    std::size_t searchLower(const Key& key) const;
+    std::size_t searchUpper(const Key& key) const;
+    std::size_t first() const;
+    std::size_t next(std::size_t k) const;
+    std::size_t prev(std::size_t k) const;
+    static std::size_t climbPastRight(std::size_t k);
+    static std::size_t climbPastLeft(std::size_t k);
+    void prefetch(std::size_t k) const;
+
+    std::size_t size_;
+    std::vector<Key> keys_;       // Eytzinger order, keys_[0] unused
+    std::vector<Value> values_;   // values_[k] belongs to keys_[k]
+    std::size_t last_;            // index of the largest key, 0 if empty
+    Compare comp_;
+};
+
+/*
+  -------------------------------------------------------
+  Begin implementations for the FrozenMap::const_iterator class.
+  -------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+FrozenMap<Key, Value, Compare>::const_iterator::const_iterator() :
+    map_(NULL),
+    index_(0)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+FrozenMap<Key, Value, Compare>::const_iterator::const_iterator(const FrozenMap<Key, Value, Compare>* map, std::size_t index) :
+    map_(map),
+    index_(index)
+{
+
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator::reference
+FrozenMap<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return reference(map_->keys_[index_], map_->values_[index_]);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator::pointer
+FrozenMap<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return pointer(**this);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenMap<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return index_ == rhs.index_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenMap<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return index_ != rhs.index_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator&
+FrozenMap<Key, Value, Compare>::const_iterator::operator++()
+{
+    index_ = map_->next(index_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator
+FrozenMap<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old = *this;
+    ++*this;
+    return old;
+}
+
+/**
+* Decrementing end() gives the largest key.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator&
+FrozenMap<Key, Value, Compare>::const_iterator::operator--()
+{
+    index_ = (index_ == 0) ? map_->last_ : map_->prev(index_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator
+FrozenMap<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old = *this;
+    --*this;
+    return old;
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the FrozenMap::const_iterator class.
+  -----------------------------------------------------
+*/
+
+/*
+  ----------------------------------------------
+  Begin implementations for the FrozenMap class.
+  ----------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+FrozenMap<Key, Value, Compare>::FrozenMap(const Compare& comp) :
+    size_(0),
+    keys_(1),
+    values_(1),
+    last_(0),
+    comp_(comp)
+{
+
+}
+
+/**
+* Builds the map from the items in [first, last), whose keys must be in
+* strictly increasing order under comp, in O(n). The items are copied straight into
+* their Eytzinger slots by walking the slots in key order. Key and Value
+* must be default constructible.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename ForwardIt>
+FrozenMap<Key, Value, Compare>::FrozenMap(ForwardIt first, ForwardIt last, const Compare& comp) :
+    size_(std::distance(first, last)),
+    keys_(size_ + 1),
+    values_(size_ + 1),
+    last_(0),
+    comp_(comp)
+{
+    for (std::size_t k = this->first(); k != 0; k = next(k)) {
+        keys_[k] = (*first).first;
+        values_[k] = (*first).second;
+        last_ = k;
+        ++first;
+    }
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenMap<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenMap<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator
+FrozenMap<Key, Value, Compare>::begin() const
+{
+    return const_iterator(this, first());
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator
+FrozenMap<Key, Value, Compare>::end() const
+{
+    return const_iterator(this, 0);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::const_reverse_iterator
+FrozenMap<Key, Value, Compare>::rbegin() const
+{
+    return const_reverse_iterator(end());
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::const_reverse_iterator
+FrozenMap<Key, Value, Compare>::rend() const
+{
+    return const_reverse_iterator(begin());
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator
+FrozenMap<Key, Value, Compare>::find(const Key& key) const
+{
+    std::size_t k = searchLower(key);
+    if (k != 0 && comp_(key, keys_[k])) {
+        k = 0;
+    }
+    return const_iterator(this, k);
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator
+FrozenMap<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return const_iterator(this, searchLower(key));
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or end() if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::const_iterator
+FrozenMap<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return const_iterator(this, searchUpper(key));
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value, typename Compare>
+Value const & FrozenMap<Key, Value, Compare>::operator[](const Key& key) const
+{
+    std::size_t k = searchLower(key);
+    if (k == 0 || comp_(key, keys_[k])) throw std::out_of_range("Invalid key");
+    return values_[k];
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenMap<Key, Value, Compare>::key_compare
+FrozenMap<Key, Value, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Index of the first key not less than key, or 0. The descent records
+* each turn in the low bit of k (1 for right, i.e. keys_[k] orders before key), so
+* the answer is the last node where it turned left: drop the trailing
+* right turns and that left turn.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenMap<Key, Value, Compare>::searchLower(const Key& key) const
+{
+    std::size_t k = 1;
+    while (k <= size_) {
+        prefetch(k);
+        k = 2 * k + comp_(keys_[k], key);
+    }
+    return climbPastRight(k);
+}
+
+/**
+* Same as searchLower, for the first key greater than key.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenMap<Key, Value, Compare>::searchUpper(const Key& key) const
+{
+    std::size_t k = 1;
+    while (k <= size_) {
+        prefetch(k);
+        k = 2 * k + !comp_(key, keys_[k]);
+    }
+    return climbPastRight(k);
+}
+
+/**
+* Index of the smallest key (the leftmost node), or 0 if empty.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenMap<Key, Value, Compare>::first() const
+{
+    if (size_ == 0) {
+        return 0;
+    }
+    std::size_t k = 1;
+    while (2 * k <= size_) {
+        k = 2 * k;
+    }
+    return k;
+}
+
+/**
+* In-order successor of node k, or 0 after the largest key.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenMap<Key, Value, Compare>::next(std::size_t k) const
+{
+    if (2 * k + 1 <= size_) { //leftmost node of the right subtree
+        k = 2 * k + 1;
+        while (2 * k <= size_) {
+            k = 2 * k;
+        }
+        return k;
+    }
+    return climbPastRight(k);
+}
+
+/**
+* In-order predecessor of node k, or 0 before the smallest key.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenMap<Key, Value, Compare>::prev(std::size_t k) const
+{
+    if (2 * k <= size_) { //rightmost node of the left subtree
+        k = 2 * k;
+        while (2 * k + 1 <= size_) {
+            k = 2 * k + 1;
+        }
+        return k;
+    }
+    return climbPastLeft(k);
+}
+
+/**
+* Climbs from k while it is a right child, then one step more: the
+* nearest ancestor that k is left of. Each trailing 1 bit is a right turn.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenMap<Key, Value, Compare>::climbPastRight(std::size_t k)
+{
+#if defined(__GNUC__)
+    return k >> (__builtin_ctzll(~static_cast<unsigned long long>(k)) + 1);
+#else
+    while (k & 1) {
+        k >>= 1;
+    }
+    return k >> 1;
+#endif
+}
+
+/**
+* Climbs from k while it is a left child, then one step more: the
+* nearest ancestor that k is right of. k must not be 0.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenMap<Key, Value, Compare>::climbPastLeft(std::size_t k)
+{
+#if defined(__GNUC__)
+    return k >> (__builtin_ctzll(static_cast<unsigned long long>(k)) + 1);
+#else
+    while (!(k & 1)) {
+        k >>= 1;
+    }
+    return k >> 1;
+#endif
+}
+
+/**
+* Starts loading the line of k's descendants a few levels down (see
+* frozen_keys_per_line), which the search reaches a few steps later.
+* The address may lie past the end of the array near the leaves;
+* prefetching it is harmless, so it is computed as an integer.
+*/
+template<typename Key, typename Value, typename Compare>
+void FrozenMap<Key, Value, Compare>::prefetch(std::size_t k) const
+{
+#if defined(__GNUC__)
+    std::size_t offset = k * frozen_keys_per_line<Key>::value * sizeof(Key);
+    __builtin_prefetch(reinterpret_cast<const void*>(reinterpret_cast<std::size_t>(keys_.data()) + offset));
+#else
+    (void)k;
+#endif
+}
+
+/*
+  --------------------------------------------
+  End implementations for the FrozenMap class.
+  --------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef KEY_COMPARE_H
+#define KEY_COMPARE_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+/**
+ * Comparators for the search trees. A tree's Compare is a less-than,
+ * std::less<Key> by default. Two optional extras make searches cheaper:
+ *
+ *  - A member int compare(const A& a, const B& b) const, negative, zero
+ *    or positive as a orders before, with or after b (and agreeing with
+ *    the less-than). With it a search settles each level in one call;
+ *    without it, it takes one or two calls of the less-than.
+ *  - A member type is_transparent, as for std::map. The trees then also
+ *    look keys up by any type the comparator accepts, without first
+ *    building a Key from it.
+ */
+
+template <typename T>
+struct key_compare_void
+{
+    typedef void type;
+};
+
+/**
+ * True when Compare has the three-way compare(A, B) described above.
+ */
+template <typename Compare, typename A, typename B, typename = void>
+struct has_three_way_compare : std::false_type { };
+
+template <typename Compare, typename A, typename B>
+struct has_three_way_compare<Compare, A, B, typename key_compare_void<
+    decltype(std::declval<const Compare&>().compare(std::declval<const A&>(), std::declval<const B&>()))>::type>
+    : std::true_type { };
+
+/**
+ * Compares a with b through comp: negative, zero or positive as a orders
+ * before, with or after b. That is one call for a three-way comparator
+ * and one or two calls of the less-than for any other.
+ */
+template <typename Compare, typename A, typename B>
+int compareKeys(const Compare& comp, const A& a, const B& b, std::true_type threeWay)
+{
+    return comp.compare(a, b);
+}
+
+template <typename Compare, typename A, typename B>
+int compareKeys(const Compare& comp, const A& a, const B& b, std::false_type threeWay)
+{
+    if (comp(a, b)) {
+        return -1;
+    }
+    return comp(b, a) ? 1 : 0;
+}
+
+template <typename Compare, typename A, typename B>
+int compareKeys(const Compare& comp, const A& a, const B& b)
+{
+    return compareKeys(comp, a, b, has_three_way_compare<Compare, A, B>());
+}
+
+/**
+ * std::less on strings gets the three-way std::string::compare it is
+ * built on, rather than two calls with the arguments swapped.
+ */
+template <typename Char, typename Traits, typename Alloc>
+int compareKeys(const std::less<std::basic_string<Char, Traits, Alloc> >& comp,
+                const std::basic_string<Char, Traits, Alloc>& a, const std::basic_string<Char, Traits, Alloc>& b)
+{
+    return a.compare(b);
+}
+
+/**
+ * A transparent less-than: compares any two types with operator<, so a
+ * tree of std::string keys can be searched with a const char*. (From
+ * C++14, std::less<> does the same.)
+ */
+struct TransparentLess
+{
+    typedef void is_transparent;
+
+    template <typename A, typename B>
+    bool operator()(const A& a, const B& b) const
+    {
+        return a < b;
+    }
+};
+
+/**
+ * A transparent, three-way comparator for std::string keys: one
+ * std::string::compare per search level, as std::less<std::string> gets
+ * too, but keys can also be looked up as std::string_view (from C++17)
+ * or const char*. The latter saves building a std::string, but measures
+ * the probe again at every level, so it suits one-off lookups of long
+ * keys rather than hot loops.
+ */
+struct StringCompare
+{
+    typedef void is_transparent;
+
+    template <typename A, typename B>
+    bool operator()(const A& a, const B& b) const
+    {
+        return compare(a, b) < 0;
+    }
+
+    int compare(const std::string& a, const std::string& b) const
+    {
+        return a.compare(b);
+    }
+    int compare(const std::string& a, const char* b) const
+    {
+        return a.compare(b);
+    }
+    int compare(const char* a, const std::string& b) const
+    {
+        int order = b.compare(a);
+        return (order < 0) - (order > 0);
+    }
+#if __cplusplus >= 201703L
+    int compare(std::string_view a, std::string_view b) const
+    {
+        return a.compare(b);
+    }
+#endif
+};
+
+#endif
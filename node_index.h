@@ -0,0 +1,445 @@
+#ifndef NODE_INDEX_H
+#define NODE_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+
+#include "node_pool.h"
+
+template <typename Key, typename Value, typename Links>
+class Node;
+
+/**
+ * How a tree's nodes link to each other, which the tree takes from its
+ * allocator (see node_links_of). Pointer links are the default. Compact
+ * links are 32-bit indices into a NodeIndexSpace rather than pointers:
+ * for 32-bit keys and values that shrinks an AVLNode from 32 bytes to
+ * 20, which the space rounds to 24, a quarter less per entry. Halving it
+ * is out of reach, since the key, the value and three 4-byte links alone
+ * take 20 bytes. The links are part of the node type, Node<Key, Value,
+ * Links>, so trees of either kind can share a program, or a translation
+ * unit, without disagreeing about what a node looks like.
+ */
+struct PointerNodeLinks { };
+struct CompactNodeLinks { };
+
+/**
+ * The address space that compact nodes of one Key/Value pair live in.
+ * It is made of 1 MiB slabs, each aligned to its own size, and an index
+ * is a slab number followed by an 8-byte granule within that slab. An
+ * index has 29 bits, leaving the top three of a link for a tag (see
+ * NODE_LINK_TAG_BITS), so 2^29 granules (4 GiB) can be addressed.
+ * Turning an index into a pointer costs one load from the slab table,
+ * and turning a pointer back one load from the header at the start of
+ * its slab. Index 0 falls in the first slab's header, so it doubles as
+ * NULL.
+ *
+ * Blocks of each size are recycled through their own free list. Since an
+ * index names its slab, a slab cannot be returned while any block in the
+ * space is live; releaseIfEmpty() returns them all once none is, say
+ * after the last compact tree of the pair is cleared. Every such tree
+ * shares the space, so allocation takes a lock; following links does not.
+ */
+template <typename Key, typename Value>
+class NodeIndexSpace
+{
+public:
+    static const unsigned GRANULE_BITS = 3;
+    static const unsigned SLAB_BITS = 17;   // granules per slab, as a power of two
+    static const std::size_t SLAB_BYTES = std::size_t(1) << (SLAB_BITS + GRANULE_BITS);
+    static const unsigned INDEX_BITS = 29;
+    static const std::size_t MAX_SLABS = std::size_t(1) << (INDEX_BITS - SLAB_BITS);
+    static const std::size_t MAX_BLOCK_GRANULES = 32;
+
+    static void* allocate(std::size_t bytes);
+    static void deallocate(void* block, std::size_t bytes);
+
+    static uint32_t indexOf(const void* block);
+    static void* pointerAt(uint32_t index);
+
+    static bool releaseIfEmpty();
+
+    static std::size_t bytesReserved();
+    static std::size_t bytesInUse();
+
+private:
+    struct SlabHeader
+    {
+        uint32_t number;
+        void* allocation;   // what operator new returned, before aligning
+    };
+
+    static const std::size_t HEADER_GRANULES =
+        (sizeof(SlabHeader) + (std::size_t(1) << GRANULE_BITS) - 1) >> GRANULE_BITS;
+    static const std::size_t SLAB_GRANULES = std::size_t(1) << SLAB_BITS;
+
+    static std::size_t granulesFor(std::size_t bytes);
+    static void addSlab();
+
+    // zero-initialized, so usable by trees built during static initialization
+    static char* slabs_[MAX_SLABS];
+    static uint32_t freeLists_[MAX_BLOCK_GRANULES + 1];   // by block size in granules
+    static std::size_t slabCount_;
+    static std::size_t cursor_;   // next free granule of the newest slab
+    static std::size_t inUse_;    // in granules
+    static std::mutex lock_;
+};
+
+template <typename Key, typename Value>
+char* NodeIndexSpace<Key, Value>::slabs_[NodeIndexSpace<Key, Value>::MAX_SLABS];
+
+template <typename Key, typename Value>
+uint32_t NodeIndexSpace<Key, Value>::freeLists_[NodeIndexSpace<Key, Value>::MAX_BLOCK_GRANULES + 1];
+
+template <typename Key, typename Value>
+std::size_t NodeIndexSpace<Key, Value>::slabCount_;
+
+template <typename Key, typename Value>
+std::size_t NodeIndexSpace<Key, Value>::cursor_;
+
+template <typename Key, typename Value>
+std::size_t NodeIndexSpace<Key, Value>::inUse_;
+
+template <typename Key, typename Value>
+std::mutex NodeIndexSpace<Key, Value>::lock_;
+
+/*
+  -----------------------------------------
+  Begin implementations for the NodeIndexSpace class.
+  -----------------------------------------
+*/
+
+template <typename Key, typename Value>
+std::size_t NodeIndexSpace<Key, Value>::granulesFor(std::size_t bytes)
+{
+    std::size_t granules = (bytes + (std::size_t(1) << GRANULE_BITS) - 1) >> GRANULE_BITS;
+    return granules == 0 ? 1 : granules;
+}
+
+/**
+* Hands out one block of at most MAX_BLOCK_GRANULES granules, preferring
+* a recently freed block of the same size.
+*/
+template <typename Key, typename Value>
+void* NodeIndexSpace<Key, Value>::allocate(std::size_t bytes)
+{
+    std::size_t granules = granulesFor(bytes);
+    if (granules > MAX_BLOCK_GRANULES) {
+        throw std::bad_alloc();
+    }
+    std::lock_guard<std::mutex> guard(lock_);
+    uint32_t head = freeLists_[granules];
+    if (head != 0) {
+        void* block = pointerAt(head);
+        freeLists_[granules] = *static_cast<uint32_t*>(block);
+        inUse_ += granules;
+        return block;
+    }
+    if (slabCount_ == 0 || cursor_ + granules > SLAB_GRANULES) {
+        addSlab();
+    }
+    void* block = slabs_[slabCount_ - 1] + (cursor_ << GRANULE_BITS);
+    cursor_ += granules;
+    inUse_ += granules;
+    return block;
+}
+
+/**
+* Pushes a block onto the free list for its size, linked by index.
+*/
+template <typename Key, typename Value>
+void NodeIndexSpace<Key, Value>::deallocate(void* block, std::size_t bytes)
+{
+    std::size_t granules = granulesFor(bytes);
+    std::lock_guard<std::mutex> guard(lock_);
+    *static_cast<uint32_t*>(block) = freeLists_[granules];
+    freeLists_[granules] = indexOf(block);
+    inUse_ -= granules;
+}
+
+/**
+* The index of a block handed out by allocate, or 0 for NULL.
+*/
+template <typename Key, typename Value>
+uint32_t NodeIndexSpace<Key, Value>::indexOf(const void* block)
+{
+    if (block == NULL) {
+        return 0;
+    }
+    std::uintptr_t address = reinterpret_cast<std::uintptr_t>(block);
+    std::uintptr_t slab = address & ~static_cast<std::uintptr_t>(SLAB_BYTES - 1);
+    uint32_t number = reinterpret_cast<const SlabHeader*>(slab)->number;
+    return static_cast<uint32_t>((number << SLAB_BITS) | ((address - slab) >> GRANULE_BITS));
+}
+
+/**
+* The block at index, or NULL for index 0.
+*/
+template <typename Key, typename Value>
+void* NodeIndexSpace<Key, Value>::pointerAt(uint32_t index)
+{
+    if (index == 0) {
+        return NULL;
+    }
+    return slabs_[index >> SLAB_BITS] + (static_cast<std::size_t>(index & (SLAB_GRANULES - 1)) << GRANULE_BITS);
+}
+
+/**
+* Frees every slab if no block is in use, and says whether it did. Any
+* index taken before then is meaningless afterwards, but with no live
+* node no tree holds one.
+*/
+template <typename Key, typename Value>
+bool NodeIndexSpace<Key, Value>::releaseIfEmpty()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    if (inUse_ != 0) {
+        return false;
+    }
+    for (std::size_t i = 0; i < slabCount_; ++i) {
+        ::operator delete(reinterpret_cast<SlabHeader*>(slabs_[i])->allocation);
+        slabs_[i] = NULL;
+    }
+    for (std::size_t i = 0; i <= MAX_BLOCK_GRANULES; ++i) {
+        freeLists_[i] = 0;
+    }
+    slabCount_ = 0;
+    cursor_ = 0;
+    return true;
+}
+
+template <typename Key, typename Value>
+std::size_t NodeIndexSpace<Key, Value>::bytesReserved()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return slabCount_ * SLAB_BYTES;
+}
+
+template <typename Key, typename Value>
+std::size_t NodeIndexSpace<Key, Value>::bytesInUse()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return inUse_ << GRANULE_BITS;
+}
+
+/**
+* Starts a new slab, aligned to SLAB_BYTES by over-allocating. Only the
+* aligned part is ever touched, so the slack costs address space, not
+* memory. Called with the lock held.
+*/
+template <typename Key, typename Value>
+void NodeIndexSpace<Key, Value>::addSlab()
+{
+    if (slabCount_ == MAX_SLABS) {
+        throw std::bad_alloc();
+    }
+    void* allocation = ::operator new(2 * SLAB_BYTES);
+    std::uintptr_t aligned = (reinterpret_cast<std::uintptr_t>(allocation) + SLAB_BYTES - 1) &
+        ~static_cast<std::uintptr_t>(SLAB_BYTES - 1);
+    char* slab = reinterpret_cast<char*>(aligned);
+    SlabHeader* header = reinterpret_cast<SlabHeader*>(slab);
+    header->number = static_cast<uint32_t>(slabCount_);
+    header->allocation = allocation;
+    slabs_[slabCount_++] = slab;
+    cursor_ = HEADER_GRANULES;
+}
+
+/*
+  ---------------------------------------
+  End implementations for the NodeIndexSpace class.
+  ---------------------------------------
+*/
+
+/**
+ * Bits a tagged link keeps beside its target, for derived nodes to
+ * store small fields in (AVLNode keeps its balance there).
+ */
+static const unsigned NODE_LINK_TAG_BITS = 3;
+
+/**
+ * A parent/left/right link stored as a 32-bit NodeIndexSpace index, with
+ * a tag in the top bits. It converts to and from Node pointers, so
+ * Node's getters and setters read the same either way; assigning a node
+ * keeps the tag. Nodes derived from Node keep it as their first base, so
+ * a node and its Node part share an address.
+ */
+template <typename Key, typename Value>
+class NodeIndex
+{
+public:
+    NodeIndex(Node<Key, Value, CompactNodeLinks>* node) :
+        bits_(NodeIndexSpace<Key, Value>::indexOf(node))
+    {
+
+    }
+
+    NodeIndex& operator=(Node<Key, Value, CompactNodeLinks>* node)
+    {
+        bits_ = NodeIndexSpace<Key, Value>::indexOf(node) | (bits_ & ~INDEX_MASK);
+        return *this;
+    }
+
+    operator Node<Key, Value, CompactNodeLinks>*() const
+    {
+        return static_cast<Node<Key, Value, CompactNodeLinks>*>(NodeIndexSpace<Key, Value>::pointerAt(bits_ & INDEX_MASK));
+    }
+
+    unsigned tag() const
+    {
+        return bits_ >> NodeIndexSpace<Key, Value>::INDEX_BITS;
+    }
+
+    void setTag(unsigned tag)
+    {
+        bits_ = (bits_ & INDEX_MASK) | (static_cast<uint32_t>(tag) << NodeIndexSpace<Key, Value>::INDEX_BITS);
+    }
+
+private:
+    static const uint32_t INDEX_MASK = (uint32_t(1) << NodeIndexSpace<Key, Value>::INDEX_BITS) - 1;
+
+    uint32_t bits_;
+};
+
+/**
+ * A pointer link with a tag in its low bits, which are always zero since
+ * nodes are 8-byte aligned. Like NodeIndex, it converts to and from Node
+ * pointers and assigning a node keeps the tag.
+ */
+template <typename Key, typename Value>
+class TaggedNodePointer
+{
+public:
+    TaggedNodePointer(Node<Key, Value, PointerNodeLinks>* node) :
+        bits_(reinterpret_cast<std::uintptr_t>(node))
+    {
+
+    }
+
+    TaggedNodePointer& operator=(Node<Key, Value, PointerNodeLinks>* node)
+    {
+        bits_ = reinterpret_cast<std::uintptr_t>(node) | (bits_ & TAG_MASK);
+        return *this;
+    }
+
+    operator Node<Key, Value, PointerNodeLinks>*() const
+    {
+        return reinterpret_cast<Node<Key, Value, PointerNodeLinks>*>(bits_ & ~TAG_MASK);
+    }
+
+    unsigned tag() const
+    {
+        return static_cast<unsigned>(bits_ & TAG_MASK);
+    }
+
+    void setTag(unsigned tag)
+    {
+        bits_ = (bits_ & ~TAG_MASK) | tag;
+    }
+
+private:
+    static const std::uintptr_t TAG_MASK = (std::uintptr_t(1) << NODE_LINK_TAG_BITS) - 1;
+
+    std::uintptr_t bits_;
+};
+
+/**
+ * The types Node uses for its links. With pointer links only the parent
+ * link is tagged, and the child links stay plain pointers so searches
+ * need no masking. With compact links all three are NodeIndex, which
+ * has room for the tag anyway.
+ */
+template <typename Key, typename Value, typename Links>
+struct node_link;
+
+template <typename Key, typename Value>
+struct node_link<Key, Value, PointerNodeLinks>
+{
+    typedef Node<Key, Value, PointerNodeLinks>* type;
+    typedef TaggedNodePointer<Key, Value> tagged_type;
+};
+
+template <typename Key, typename Value>
+struct node_link<Key, Value, CompactNodeLinks>
+{
+    typedef NodeIndex<Key, Value> type;
+    typedef NodeIndex<Key, Value> tagged_type;
+};
+
+/**
+ * A standard allocator that draws single objects from the NodeIndexSpace
+ * of one Key/Value pair. Passing it as a tree's Alloc, e.g.
+ *
+ *     AVLTree<uint32_t, uint32_t, NodeIndexAllocator<std::pair<const uint32_t, uint32_t> > >
+ *
+ * gives that tree compact links. Key and Value default to those of the
+ * pair T, and rebinding keeps them, so every node type of the tree comes
+ * from the same space. Copies are interchangeable, since the space is
+ * global to the pair; it takes a lock, so several threads may allocate.
+ */
+template <typename T,
+          typename Key = typename std::remove_const<typename T::first_type>::type,
+          typename Value = typename T::second_type>
+class NodeIndexAllocator
+{
+public:
+    typedef T value_type;
+
+    NodeIndexAllocator() { }
+    template <typename U>
+    NodeIndexAllocator(const NodeIndexAllocator<U, Key, Value>&) { }
+
+    T* allocate(std::size_t n)
+    {
+        static_assert(alignof(T) <= (std::size_t(1) << NodeIndexSpace<Key, Value>::GRANULE_BITS),
+            "compact nodes must fit the space's 8-byte alignment");
+        if (n != 1) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(NodeIndexSpace<Key, Value>::allocate(sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t)
+    {
+        NodeIndexSpace<Key, Value>::deallocate(p, sizeof(T));
+    }
+
+    std::size_t bytesReserved() const
+    {
+        return NodeIndexSpace<Key, Value>::bytesReserved();
+    }
+
+    std::size_t bytesInUse() const
+    {
+        return NodeIndexSpace<Key, Value>::bytesInUse();
+    }
+
+    template <typename U>
+    bool operator==(const NodeIndexAllocator<U, Key, Value>&) const { return true; }
+    template <typename U>
+    bool operator!=(const NodeIndexAllocator<U, Key, Value>&) const { return false; }
+};
+
+/**
+ * The links of the nodes a tree allocates through Alloc: compact for a
+ * NodeIndexAllocator, pointers for any other.
+ */
+template <typename Alloc>
+struct node_links_of
+{
+    typedef PointerNodeLinks type;
+};
+
+template <typename T, typename Key, typename Value>
+struct node_links_of<NodeIndexAllocator<T, Key, Value> >
+{
+    typedef CompactNodeLinks type;
+};
+
+template <typename T, typename Key, typename Value>
+struct allocator_is_thread_safe<NodeIndexAllocator<T, Key, Value> > : std::true_type { };
+
+#endif
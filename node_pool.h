@@ -0,0 +1,389 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/**
+ * Slab storage shared by every copy (and rebind) of a NodePool.
+ * Blocks are carved out of large slabs, recycled through an
+ * intrusive free list, and all handed back at once by release().
+ * An arena serves a single block size and alignment, fixed by its
+ * first allocation, since a tree only ever allocates one kind of node.
+ * Blocks are rounded up to that alignment and slabs are carved at it,
+ * so nodes with over-aligned keys or values are placed correctly.
+ */
+class NodeArena
+{
+public:
+    explicit NodeArena(std::size_t firstSlabBlocks = 64);
+    ~NodeArena();
+
+    void* allocate(std::size_t bytes, std::size_t align);
+    void deallocate(void* block);
+    void* allocateUnpooled(std::size_t bytes);
+    void deallocateUnpooled(void* object);
+    void release();
+
+    bool serves(std::size_t bytes, std::size_t align) const;
+    std::size_t bytesReserved() const;
+    std::size_t bytesInUse() const;
+    std::size_t blocksInUse() const;
+    std::size_t unpooledInUse() const;
+
+private:
+    NodeArena(const NodeArena&);
+    NodeArena& operator=(const NodeArena&);
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    void addSlab();
+
+    std::vector<char*> slabs_;
+    FreeBlock* freeList_;
+    char* cursor_;
+    char* slabEnd_;
+    std::size_t objectSize_;
+    std::size_t blockSize_;
+    std::size_t align_;
+    std::size_t nextSlabBlocks_;
+    std::size_t reserved_;
+    std::size_t inUse_;      // blocks handed out from the slabs
+    std::size_t unpooled_;   // objects handed out from the global heap
+};
+
+/**
+ * Largest slab we grow to, in blocks. Slabs double from the initial
+ * size up to this cap so small trees stay small.
+ */
+static const std::size_t NODE_ARENA_MAX_SLAB_BLOCKS = 65536;
+
+inline NodeArena::NodeArena(std::size_t firstSlabBlocks) :
+    freeList_(NULL),
+    cursor_(NULL),
+    slabEnd_(NULL),
+    objectSize_(0),
+    blockSize_(0),
+    align_(0),
+    nextSlabBlocks_(firstSlabBlocks == 0 ? 1 : firstSlabBlocks),
+    reserved_(0),
+    inUse_(0),
+    unpooled_(0)
+{
+
+}
+
+inline NodeArena::~NodeArena()
+{
+    release();
+}
+
+/**
+* Returns true if blocks of the given size and alignment come from the
+* slabs (as opposed to falling back to the global heap).
+*/
+inline bool NodeArena::serves(std::size_t bytes, std::size_t align) const
+{
+    return objectSize_ == 0 || (bytes == objectSize_ && align <= align_);
+}
+
+/**
+* Hands out one block, preferring recently freed ones.
+*/
+inline void* NodeArena::allocate(std::size_t bytes, std::size_t align)
+{
+    if (blockSize_ == 0) {
+        // every block must be able to hold (and align) a free-list link
+        std::size_t size = bytes < sizeof(FreeBlock) ? sizeof(FreeBlock) : bytes;
+        objectSize_ = bytes;
+        align_ = align < alignof(FreeBlock) ? alignof(FreeBlock) : align;
+        blockSize_ = (size + align_ - 1) / align_ * align_;
+    }
+    if (freeList_ != NULL) {
+        FreeBlock* block = freeList_;
+        freeList_ = block->next;
+        ++inUse_;
+        return block;
+    }
+    if (cursor_ == slabEnd_) {
+        addSlab();
+    }
+    void* block = cursor_;
+    cursor_ += blockSize_;
+    ++inUse_;
+    return block;
+}
+
+/**
+* Returns a block to the free list. The memory stays reserved.
+*/
+inline void NodeArena::deallocate(void* block)
+{
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = freeList_;
+    freeList_ = freed;
+    --inUse_;
+}
+
+/**
+* Allocates an object the slabs do not serve from the global heap, and
+* counts it, so that the arena knows release() would not free it.
+*/
+inline void* NodeArena::allocateUnpooled(std::size_t bytes)
+{
+    void* object = ::operator new(bytes);
+    ++unpooled_;
+    return object;
+}
+
+inline void NodeArena::deallocateUnpooled(void* object)
+{
+    ::operator delete(object);
+    --unpooled_;
+}
+
+/**
+* Frees every slab at once. Any block still handed out is invalidated,
+* so this is only safe when nothing needs to be destroyed.
+*/
+inline void NodeArena::release()
+{
+    for (std::size_t i = 0; i < slabs_.size(); ++i) {
+        ::operator delete(slabs_[i]);
+    }
+    slabs_.clear();
+    freeList_ = NULL;
+    cursor_ = NULL;
+    slabEnd_ = NULL;
+    reserved_ = 0;
+    inUse_ = 0;
+}
+
+inline std::size_t NodeArena::bytesReserved() const
+{
+    return reserved_;
+}
+
+inline std::size_t NodeArena::bytesInUse() const
+{
+    return inUse_ * blockSize_;
+}
+
+inline std::size_t NodeArena::blocksInUse() const
+{
+    return inUse_;
+}
+
+inline std::size_t NodeArena::unpooledInUse() const
+{
+    return unpooled_;
+}
+
+/**
+* Allocates the next slab, with room to start it at the block alignment,
+* which ::operator new only guarantees up to alignof(std::max_align_t).
+*/
+inline void NodeArena::addSlab()
+{
+    std::size_t bytes = nextSlabBlocks_ * blockSize_;
+    std::size_t slack = align_ > alignof(std::max_align_t) ? align_ - 1 : 0;
+    char* slab = static_cast<char*>(::operator new(bytes + slack));
+    slabs_.push_back(slab);
+    std::uintptr_t start = reinterpret_cast<std::uintptr_t>(slab);
+    cursor_ = slab + (align_ - start % align_) % align_;
+    slabEnd_ = cursor_ + bytes;
+    reserved_ += bytes + slack;
+    if (nextSlabBlocks_ < NODE_ARENA_MAX_SLAB_BLOCKS) {
+        nextSlabBlocks_ *= 2;
+    }
+}
+
+/**
+ * A standard allocator that draws single objects from a NodeArena.
+ * Pass it as the Alloc parameter of BinarySearchTree or AVLTree to
+ * pool the tree's nodes. Copies and rebinds share the same arena.
+ * Trees that exchange nodes (AVLTree::split and join) must share one,
+ * by building the second tree from the first one's getAllocator().
+ *
+ * A tree's clear() drops the whole arena at once, rather than freeing
+ * its nodes one by one, when Key and Value are trivially destructible
+ * and the tree owns everything in the arena: the arena's live blocks
+ * are exactly the tree's size() nodes and nothing came from the heap
+ * (see releaseIfOnly). How many pools share the arena plays no part,
+ * so a tree built from a pool the caller keeps is still cleared in
+ * O(number of slabs), while a tree sharing the arena with another that
+ * still has nodes frees only its own.
+ */
+template <typename T>
+class NodePool
+{
+public:
+    typedef T value_type;
+
+    NodePool();
+    explicit NodePool(std::size_t firstSlabBlocks);
+    template <typename U>
+    NodePool(const NodePool<U>& other);
+
+    T* allocate(std::size_t n);
+    void deallocate(T* p, std::size_t n);
+    void release();
+    bool releaseIfOnly(std::size_t count);
+
+    std::size_t bytesReserved() const;
+    std::size_t bytesInUse() const;
+
+    template <typename U>
+    bool operator==(const NodePool<U>& rhs) const;
+    template <typename U>
+    bool operator!=(const NodePool<U>& rhs) const;
+
+private:
+    template <typename U> friend class NodePool;
+    std::shared_ptr<NodeArena> arena_;
+};
+
+/*
+  -----------------------------------------
+  Begin implementations for the NodePool class.
+  -----------------------------------------
+*/
+
+template <typename T>
+NodePool<T>::NodePool() :
+    arena_(std::make_shared<NodeArena>())
+{
+
+}
+
+template <typename T>
+NodePool<T>::NodePool(std::size_t firstSlabBlocks) :
+    arena_(std::make_shared<NodeArena>(firstSlabBlocks))
+{
+
+}
+
+/**
+* Rebinding constructor, which shares the other pool's arena.
+*/
+template <typename T>
+template <typename U>
+NodePool<T>::NodePool(const NodePool<U>& other) :
+    arena_(other.arena_)
+{
+
+}
+
+/**
+* Single objects of the arena's block size come from the slabs;
+* anything else falls through to the global heap. Before C++17 that
+* cannot align beyond std::max_align_t, so over-aligned objects the
+* arena does not serve are refused rather than misplaced.
+*/
+template <typename T>
+T* NodePool<T>::allocate(std::size_t n)
+{
+    if (n == 1 && arena_->serves(sizeof(T), alignof(T))) {
+        return static_cast<T*>(arena_->allocate(sizeof(T), alignof(T)));
+    }
+    if (alignof(T) > alignof(std::max_align_t)) {
+        throw std::bad_alloc();
+    }
+    return static_cast<T*>(arena_->allocateUnpooled(n * sizeof(T)));
+}
+
+template <typename T>
+void NodePool<T>::deallocate(T* p, std::size_t n)
+{
+    if (n == 1 && arena_->serves(sizeof(T), alignof(T))) {
+        arena_->deallocate(p);
+        return;
+    }
+    arena_->deallocateUnpooled(p);
+}
+
+/**
+* Drops every node in O(number of slabs) without running destructors.
+*/
+template <typename T>
+void NodePool<T>::release()
+{
+    arena_->release();
+}
+
+/**
+* Drops every node, as release() does, if the arena holds exactly count
+* live objects and all of them are in its slabs; says whether it did.
+* A caller that holds count objects from the arena thereby knows they
+* are all there is, so nothing anyone else holds is invalidated.
+*/
+template <typename T>
+bool NodePool<T>::releaseIfOnly(std::size_t count)
+{
+    if (arena_->unpooledInUse() != 0 || arena_->blocksInUse() != count) {
+        return false;
+    }
+    arena_->release();
+    return true;
+}
+
+template <typename T>
+std::size_t NodePool<T>::bytesReserved() const
+{
+    return arena_->bytesReserved();
+}
+
+template <typename T>
+std::size_t NodePool<T>::bytesInUse() const
+{
+    return arena_->bytesInUse();
+}
+
+template <typename T>
+template <typename U>
+bool NodePool<T>::operator==(const NodePool<U>& rhs) const
+{
+    return arena_ == rhs.arena_;
+}
+
+template <typename T>
+template <typename U>
+bool NodePool<T>::operator!=(const NodePool<U>& rhs) const
+{
+    return arena_ != rhs.arena_;
+}
+
+/*
+  ---------------------------------------
+  End implementations for the NodePool class.
+  ---------------------------------------
+*/
+
+/**
+ * True for allocators that can drop all of their objects at once.
+ */
+template <typename Alloc>
+struct allocator_can_release : std::false_type { };
+
+template <typename T>
+struct allocator_can_release<NodePool<T> > : std::true_type { };
+
+/**
+ * True for allocators that several threads may use at once, which lets
+ * a parallel build create its nodes on every thread. NodePool is not:
+ * its arena has no locking.
+ */
+template <typename Alloc>
+struct allocator_is_thread_safe : std::false_type { };
+
+template <typename T>
+struct allocator_is_thread_safe<std::allocator<T> > : std::true_type { };
+
+#endif
@@ -0,0 +1,749 @@
+#ifndef PERSISTENT_AVL_H
+#define PERSISTENT_AVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "bst_trace.h"
+
+/**
+ * A node of a PersistentAVLTree. Nodes never change once built, so any
+ * number of tree versions can share them; refs_ counts the versions and
+ * parent nodes holding this one. There is no parent link, since a shared
+ * node has many parents.
+ */
+template <typename Key, typename Value>
+class PersistentAVLNode
+{
+public:
+    PersistentAVLNode(const std::pair<const Key, Value>& item,
+                      PersistentAVLNode<Key, Value>* left, PersistentAVLNode<Key, Value>* right) :
+        item_(item),
+        left_(left),
+        right_(right),
+        height_(static_cast<unsigned char>(1 + std::max(heightOf(left), heightOf(right)))),
+        refs_(1)
+    {
+
+    }
+
+    static int heightOf(const PersistentAVLNode<Key, Value>* node)
+    {
+        return node == NULL ? 0 : node->height_;
+    }
+
+    const std::pair<const Key, Value> item_;
+    PersistentAVLNode<Key, Value>* const left_;
+    PersistentAVLNode<Key, Value>* const right_;
+    const unsigned char height_;
+    mutable std::atomic<std::size_t> refs_;
+};
+
+/**
+ * The read-only side of a PersistentAVLTree version: lookups and in-order
+ * iteration over one root. Shared by the tree itself and its snapshots.
+ */
+template <typename Key, typename Value>
+class PersistentAVLView
+{
+public:
+    class const_iterator;
+    typedef const_iterator iterator;
+
+    bool empty() const;
+    std::size_t size() const;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator find(const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+
+    /**
+    * A forward iterator over the items in key order. With no parent links
+    * to climb, it keeps the nodes it still has to come back to on a stack.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+
+    protected:
+        friend class PersistentAVLView<Key, Value>;
+        void pushLeftSpine(const PersistentAVLNode<Key, Value>* node);
+        std::vector<const PersistentAVLNode<Key, Value>*> stack_;   // empty for end()
+    };
+
+protected:
+    PersistentAVLView(PersistentAVLNode<Key, Value>* root, std::size_t size);
+
+    PersistentAVLNode<Key, Value>* findNode(const Key& key) const;
+
+    PersistentAVLNode<Key, Value>* root_;
+    std::size_t size_;
+};
+
+/**
+ * An AVL tree whose updates never modify a node. insert and remove copy
+ * the O(log n) nodes on the path they change and share the rest with the
+ * previous version, so snapshot() is O(1): it just takes a reference to
+ * the current root. Nodes are reference counted and freed once no
+ * version uses them. Copying a PersistentAVLTree is O(1) as well.
+ *
+ * A snapshot never changes, and is safe to read from any thread while
+ * the tree keeps being updated; snapshot() itself may be called from any
+ * thread. Updates (insert, remove, clear, assignment) must come from one
+ * thread at a time, which is also the only thread that should read the
+ * tree directly. Nodes are freed by whichever thread drops the last
+ * reference, so the allocator must be thread-safe if snapshots are
+ * released on other threads (see allocator_is_thread_safe).
+ */
+template <typename Key, typename Value, typename Alloc = std::allocator<std::pair<const Key, Value> > >
+class PersistentAVLTree : public PersistentAVLView<Key, Value>
+{
+public:
+    typedef Alloc allocator_type;
+    class Snapshot;
+
+    PersistentAVLTree();
+    explicit PersistentAVLTree(const Alloc& alloc);
+    PersistentAVLTree(const PersistentAVLTree& other);
+    PersistentAVLTree& operator=(const PersistentAVLTree& other);
+    ~PersistentAVLTree();
+
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    Snapshot snapshot() const;
+
+    allocator_type getAllocator() const;
+
+    /**
+    * One version of the tree, which holds on to its nodes until it is
+    * destroyed. Copies share the version.
+    */
+    class Snapshot : public PersistentAVLView<Key, Value>
+    {
+    public:
+        Snapshot();
+        Snapshot(const Snapshot& other);
+        Snapshot& operator=(const Snapshot& other);
+        ~Snapshot();
+
+    private:
+        friend class PersistentAVLTree<Key, Value, Alloc>;
+        Snapshot(PersistentAVLNode<Key, Value>* root, std::size_t size, const Alloc& alloc);
+        Alloc alloc_;
+    };
+
+protected:
+    typedef PersistentAVLNode<Key, Value> NodeType;
+
+    /**
+    * Releases a node it owns when it goes out of scope, so a half-built
+    * path is freed if an allocation throws.
+    */
+    class NodeHolder
+    {
+    public:
+        NodeHolder(NodeType* node, const Alloc& alloc) : node_(node), alloc_(alloc) { }
+        ~NodeHolder() { release(node_, alloc_); }
+        NodeType* get() const { return node_; }
+    private:
+        NodeHolder(const NodeHolder&);
+        NodeHolder& operator=(const NodeHolder&);
+        NodeType* node_;
+        const Alloc& alloc_;
+    };
+
+    NodeType* insertHelper(NodeType* node, const std::pair<const Key, Value>& keyValuePair, bool& added);
+    NodeType* removeHelper(NodeType* node, const Key& key);
+    NodeType* removeSmallest(NodeType* node);
+    NodeType* balanceNode(const std::pair<const Key, Value>& item, NodeType* left, NodeType* right);
+    NodeType* makeNode(const std::pair<const Key, Value>& item, NodeType* left, NodeType* right);
+    void publish(NodeType* root, std::size_t size);
+
+    static void retain(NodeType* node);
+    static void release(NodeType* node, const Alloc& alloc);
+
+    Alloc alloc_;
+    mutable std::mutex rootLock_;   // guards root_ and size_ against snapshot() on other threads
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the PersistentAVLView class.
+  -----------------------------------------------------
+*/
+
+template<class Key, class Value>
+PersistentAVLView<Key, Value>::PersistentAVLView(PersistentAVLNode<Key, Value>* root, std::size_t size) :
+    root_(root),
+    size_(size)
+{
+
+}
+
+template<class Key, class Value>
+bool PersistentAVLView<Key, Value>::empty() const
+{
+    return root_ == NULL;
+}
+
+template<class Key, class Value>
+std::size_t PersistentAVLView<Key, Value>::size() const
+{
+    return size_;
+}
+
+template<class Key, class Value>
+typename PersistentAVLView<Key, Value>::const_iterator
+PersistentAVLView<Key, Value>::begin() const
+{
+    const_iterator it;
+    it.pushLeftSpine(root_);
+    return it;
+}
+
+template<class Key, class Value>
+typename PersistentAVLView<Key, Value>::const_iterator
+PersistentAVLView<Key, Value>::end() const
+{
+    return const_iterator();
+}
+
+/**
+* Returns an iterator to the item with the given key, or end(). The
+* iterator's stack holds the nodes where the search went left.
+*/
+template<class Key, class Value>
+typename PersistentAVLView<Key, Value>::const_iterator
+PersistentAVLView<Key, Value>::find(const Key& key) const
+{
+    const_iterator it;
+    const PersistentAVLNode<Key, Value>* node = root_;
+    while (node != NULL) {
+        if (key < node->item_.first) {
+            it.stack_.push_back(node);
+            node = node->left_;
+        }
+        else if (node->item_.first < key) {
+            node = node->right_;
+        }
+        else {
+            it.stack_.push_back(node);
+            return it;
+        }
+    }
+    return end();
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key.
+*/
+template<class Key, class Value>
+typename PersistentAVLView<Key, Value>::const_iterator
+PersistentAVLView<Key, Value>::lower_bound(const Key& key) const
+{
+    const_iterator it;
+    const PersistentAVLNode<Key, Value>* node = root_;
+    while (node != NULL) {
+        if (node->item_.first < key) {
+            node = node->right_;
+        }
+        else {
+            it.stack_.push_back(node);
+            node = node->left_;
+        }
+    }
+    return it;
+}
+
+template<class Key, class Value>
+Value const & PersistentAVLView<Key, Value>::operator[](const Key& key) const
+{
+    PersistentAVLNode<Key, Value>* node = findNode(key);
+    if(node == NULL) throw std::out_of_range("Invalid key");
+    return node->item_.second;
+}
+
+template<class Key, class Value>
+PersistentAVLNode<Key, Value>* PersistentAVLView<Key, Value>::findNode(const Key& key) const
+{
+    PersistentAVLNode<Key, Value>* node = root_;
+    while (node != NULL) {
+        if (key < node->item_.first) {
+            node = node->left_;
+        }
+        else if (node->item_.first < key) {
+            node = node->right_;
+        }
+        else {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the PersistentAVLView class.
+  -----------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------------------------
+  Begin implementations for the PersistentAVLView::const_iterator class.
+  -----------------------------------------------------------------
+*/
+
+template<class Key, class Value>
+PersistentAVLView<Key, Value>::const_iterator::const_iterator()
+{
+
+}
+
+template<class Key, class Value>
+typename PersistentAVLView<Key, Value>::const_iterator::reference
+PersistentAVLView<Key, Value>::const_iterator::operator*() const
+{
+    return stack_.back()->item_;
+}
+
+template<class Key, class Value>
+typename PersistentAVLView<Key, Value>::const_iterator::pointer
+PersistentAVLView<Key, Value>::const_iterator::operator->() const
+{
+    return &stack_.back()->item_;
+}
+
+/**
+* Iterators are equal if they stand on the same node; the stacks below
+* it then match as well.
+*/
+template<class Key, class Value>
+bool PersistentAVLView<Key, Value>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    if (stack_.empty() || rhs.stack_.empty()) {
+        return stack_.empty() == rhs.stack_.empty();
+    }
+    return stack_.back() == rhs.stack_.back();
+}
+
+template<class Key, class Value>
+bool PersistentAVLView<Key, Value>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* The next item is the smallest one in the right subtree if there is
+* one, and otherwise the nearest node the walk went left at.
+*/
+template<class Key, class Value>
+typename PersistentAVLView<Key, Value>::const_iterator&
+PersistentAVLView<Key, Value>::const_iterator::operator++()
+{
+    if (stack_.empty()) {
+        return *this;
+    }
+    const PersistentAVLNode<Key, Value>* node = stack_.back();
+    stack_.pop_back();
+    pushLeftSpine(node->right_);
+    return *this;
+}
+
+template<class Key, class Value>
+typename PersistentAVLView<Key, Value>::const_iterator
+PersistentAVLView<Key, Value>::const_iterator::operator++(int)
+{
+    const_iterator old = *this;
+    ++*this;
+    return old;
+}
+
+template<class Key, class Value>
+void PersistentAVLView<Key, Value>::const_iterator::pushLeftSpine(const PersistentAVLNode<Key, Value>* node)
+{
+    while (node != NULL) {
+        stack_.push_back(node);
+        node = node->left_;
+    }
+}
+
+/*
+  ---------------------------------------------------------------
+  End implementations for the PersistentAVLView::const_iterator class.
+  ---------------------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::Snapshot class.
+  ---------------------------------------------------------
+*/
+
+template<class Key, class Value, class Alloc>
+PersistentAVLTree<Key, Value, Alloc>::Snapshot::Snapshot() :
+    PersistentAVLView<Key, Value>(NULL, 0)
+{
+
+}
+
+/**
+* Takes over a reference to root that the caller already holds.
+*/
+template<class Key, class Value, class Alloc>
+PersistentAVLTree<Key, Value, Alloc>::Snapshot::Snapshot(PersistentAVLNode<Key, Value>* root, std::size_t size,
+                                                         const Alloc& alloc) :
+    PersistentAVLView<Key, Value>(root, size),
+    alloc_(alloc)
+{
+
+}
+
+template<class Key, class Value, class Alloc>
+PersistentAVLTree<Key, Value, Alloc>::Snapshot::Snapshot(const Snapshot& other) :
+    PersistentAVLView<Key, Value>(other.root_, other.size_),
+    alloc_(other.alloc_)
+{
+    retain(this->root_);
+}
+
+template<class Key, class Value, class Alloc>
+typename PersistentAVLTree<Key, Value, Alloc>::Snapshot&
+PersistentAVLTree<Key, Value, Alloc>::Snapshot::operator=(const Snapshot& other)
+{
+    retain(other.root_);
+    release(this->root_, alloc_);
+    this->root_ = other.root_;
+    this->size_ = other.size_;
+    alloc_ = other.alloc_;
+    return *this;
+}
+
+template<class Key, class Value, class Alloc>
+PersistentAVLTree<Key, Value, Alloc>::Snapshot::~Snapshot()
+{
+    release(this->root_, alloc_);
+}
+
+/*
+  -------------------------------------------------------
+  End implementations for the PersistentAVLTree::Snapshot class.
+  -------------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  -----------------------------------------------------
+*/
+
+template<class Key, class Value, class Alloc>
+PersistentAVLTree<Key, Value, Alloc>::PersistentAVLTree() :
+    PersistentAVLView<Key, Value>(NULL, 0)
+{
+
+}
+
+template<class Key, class Value, class Alloc>
+PersistentAVLTree<Key, Value, Alloc>::PersistentAVLTree(const Alloc& alloc) :
+    PersistentAVLView<Key, Value>(NULL, 0),
+    alloc_(alloc)
+{
+
+}
+
+/**
+* Shares the other tree's current version, in O(1).
+*/
+template<class Key, class Value, class Alloc>
+PersistentAVLTree<Key, Value, Alloc>::PersistentAVLTree(const PersistentAVLTree& other) :
+    PersistentAVLView<Key, Value>(NULL, 0),
+    alloc_(other.alloc_)
+{
+    std::lock_guard<std::mutex> guard(other.rootLock_);
+    retain(other.root_);
+    this->root_ = other.root_;
+    this->size_ = other.size_;
+}
+
+/**
+* Shares the other tree's current version, and its allocator, which the
+* shared nodes must be freed through. The old version is dropped through
+* the old allocator first, as a copy or snapshot would.
+*/
+template<class Key, class Value, class Alloc>
+PersistentAVLTree<Key, Value, Alloc>&
+PersistentAVLTree<Key, Value, Alloc>::operator=(const PersistentAVLTree& other)
+{
+    if (this != &other) {
+        Snapshot version = other.snapshot();
+        publish(NULL, 0);
+        retain(version.root_);
+        std::lock_guard<std::mutex> guard(rootLock_);
+        alloc_ = version.alloc_;
+        this->root_ = version.root_;
+        this->size_ = version.size_;
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Alloc>
+PersistentAVLTree<Key, Value, Alloc>::~PersistentAVLTree()
+{
+    release(this->root_, alloc_);
+}
+
+/**
+* Inserts a new item, or replaces the value if the key is already there,
+* as BinarySearchTree::insert does. Earlier snapshots are unaffected.
+*/
+template<class Key, class Value, class Alloc>
+void PersistentAVLTree<Key, Value, Alloc>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool added = false;
+    NodeType* root = insertHelper(this->root_, keyValuePair, added);
+    publish(root, this->size_ + (added ? 1 : 0));
+}
+
+/**
+* Removes the item with the given key, if any. Earlier snapshots keep it.
+*/
+template<class Key, class Value, class Alloc>
+void PersistentAVLTree<Key, Value, Alloc>::remove(const Key& key)
+{
+    if (this->findNode(key) == NULL) {
+        return;
+    }
+    NodeType* root = removeHelper(this->root_, key);
+    publish(root, this->size_ - 1);
+}
+
+template<class Key, class Value, class Alloc>
+void PersistentAVLTree<Key, Value, Alloc>::clear()
+{
+    publish(NULL, 0);
+}
+
+/**
+* Returns the current version, in O(1). Safe to call from any thread.
+*/
+template<class Key, class Value, class Alloc>
+typename PersistentAVLTree<Key, Value, Alloc>::Snapshot
+PersistentAVLTree<Key, Value, Alloc>::snapshot() const
+{
+    std::lock_guard<std::mutex> guard(rootLock_);
+    retain(this->root_);
+    return Snapshot(this->root_, this->size_, alloc_);
+}
+
+template<class Key, class Value, class Alloc>
+typename PersistentAVLTree<Key, Value, Alloc>::allocator_type
+PersistentAVLTree<Key, Value, Alloc>::getAllocator() const
+{
+    return alloc_;
+}
+
+/**
+* Swaps in a new version, whose root reference the caller hands over,
+* and drops the tree's reference to the old one.
+*/
+template<class Key, class Value, class Alloc>
+void PersistentAVLTree<Key, Value, Alloc>::publish(NodeType* root, std::size_t size)
+{
+    NodeType* old;
+    {
+        std::lock_guard<std::mutex> guard(rootLock_);
+        old = this->root_;
+        this->root_ = root;
+        this->size_ = size;
+    }
+    release(old, alloc_);
+}
+
+/**
+* Returns a new version of the subtree at node with the item inserted.
+* The helpers below all return a node the caller owns a reference to,
+* and only borrow the nodes they are passed.
+*/
+template<class Key, class Value, class Alloc>
+typename PersistentAVLTree<Key, Value, Alloc>::NodeType*
+PersistentAVLTree<Key, Value, Alloc>::insertHelper(NodeType* node, const std::pair<const Key, Value>& keyValuePair,
+                                                   bool& added)
+{
+    if (node == NULL) {
+        added = true;
+        return makeNode(keyValuePair, NULL, NULL);
+    }
+    if (keyValuePair.first < node->item_.first) {
+        NodeHolder left(insertHelper(node->left_, keyValuePair, added), alloc_);
+        return balanceNode(node->item_, left.get(), node->right_);
+    }
+    if (node->item_.first < keyValuePair.first) {
+        NodeHolder right(insertHelper(node->right_, keyValuePair, added), alloc_);
+        return balanceNode(node->item_, node->left_, right.get());
+    }
+    return makeNode(keyValuePair, node->left_, node->right_);
+}
+
+/**
+* Returns a new version of the subtree at node without key, which must
+* be in it. A node with two children is replaced by its successor.
+*/
+template<class Key, class Value, class Alloc>
+typename PersistentAVLTree<Key, Value, Alloc>::NodeType*
+PersistentAVLTree<Key, Value, Alloc>::removeHelper(NodeType* node, const Key& key)
+{
+    if (key < node->item_.first) {
+        NodeHolder left(removeHelper(node->left_, key), alloc_);
+        return balanceNode(node->item_, left.get(), node->right_);
+    }
+    if (node->item_.first < key) {
+        NodeHolder right(removeHelper(node->right_, key), alloc_);
+        return balanceNode(node->item_, node->left_, right.get());
+    }
+    if (node->left_ == NULL || node->right_ == NULL) {
+        NodeType* child = node->left_ != NULL ? node->left_ : node->right_;
+        retain(child);
+        return child;
+    }
+    NodeType* successor = node->right_;
+    while (successor->left_ != NULL) {
+        successor = successor->left_;
+    }
+    NodeHolder right(removeSmallest(node->right_), alloc_);
+    return balanceNode(successor->item_, node->left_, right.get());
+}
+
+template<class Key, class Value, class Alloc>
+typename PersistentAVLTree<Key, Value, Alloc>::NodeType*
+PersistentAVLTree<Key, Value, Alloc>::removeSmallest(NodeType* node)
+{
+    if (node->left_ == NULL) {
+        retain(node->right_);
+        return node->right_;
+    }
+    NodeHolder left(removeSmallest(node->left_), alloc_);
+    return balanceNode(node->item_, left.get(), node->right_);
+}
+
+/**
+* Builds a node holding item over left and right, whose heights differ
+* by at most two, rotating if they differ by two. Rotations copy the
+* nodes they move, since those may be shared.
+*/
+template<class Key, class Value, class Alloc>
+typename PersistentAVLTree<Key, Value, Alloc>::NodeType*
+PersistentAVLTree<Key, Value, Alloc>::balanceNode(const std::pair<const Key, Value>& item,
+                                                  NodeType* left, NodeType* right)
+{
+    int leftHeight = NodeType::heightOf(left);
+    int rightHeight = NodeType::heightOf(right);
+    if (leftHeight > rightHeight + 1) {
+        if (NodeType::heightOf(left->left_) >= NodeType::heightOf(left->right_)) { //single rotation
+            NodeHolder down(makeNode(item, left->right_, right), alloc_);
+            return makeNode(left->item_, left->left_, down.get());
+        }
+        NodeType* middle = left->right_; //double rotation
+        NodeHolder lower(makeNode(left->item_, left->left_, middle->left_), alloc_);
+        NodeHolder upper(makeNode(item, middle->right_, right), alloc_);
+        return makeNode(middle->item_, lower.get(), upper.get());
+    }
+    if (rightHeight > leftHeight + 1) {
+        if (NodeType::heightOf(right->right_) >= NodeType::heightOf(right->left_)) { //single rotation
+            NodeHolder down(makeNode(item, left, right->left_), alloc_);
+            return makeNode(right->item_, down.get(), right->right_);
+        }
+        NodeType* middle = right->left_; //double rotation
+        NodeHolder lower(makeNode(item, left, middle->left_), alloc_);
+        NodeHolder upper(makeNode(right->item_, middle->right_, right->right_), alloc_);
+        return makeNode(middle->item_, lower.get(), upper.get());
+    }
+    return makeNode(item, left, right);
+}
+
+/**
+* Allocates a node through the tree's allocator, which takes a reference
+* to each child once it is built.
+*/
+template<class Key, class Value, class Alloc>
+typename PersistentAVLTree<Key, Value, Alloc>::NodeType*
+PersistentAVLTree<Key, Value, Alloc>::makeNode(const std::pair<const Key, Value>& item,
+                                               NodeType* left, NodeType* right)
+{
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<NodeType> NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc nodeAlloc(alloc_);
+    NodeType* node = NodeTraits::allocate(nodeAlloc, 1);
+    try {
+        NodeTraits::construct(nodeAlloc, node, item, left, right);
+    }
+    catch (...) {
+        NodeTraits::deallocate(nodeAlloc, node, 1);
+        throw;
+    }
+    BST_TRACE_EVENT(TRACE_NODE_ALLOC, node, sizeof(NodeType));
+    retain(left);
+    retain(right);
+    return node;
+}
+
+template<class Key, class Value, class Alloc>
+void PersistentAVLTree<Key, Value, Alloc>::retain(NodeType* node)
+{
+    if (node != NULL) {
+        node->refs_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+* Drops a reference to node, freeing it (and releasing its children) if
+* it was the last. The recursion only follows nodes that die, and is
+* bounded by the height.
+*/
+template<class Key, class Value, class Alloc>
+void PersistentAVLTree<Key, Value, Alloc>::release(NodeType* node, const Alloc& alloc)
+{
+    if (node == NULL || node->refs_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    release(node->left_, alloc);
+    release(node->right_, alloc);
+    typedef typename std::allocator_traits<Alloc>::template rebind_alloc<NodeType> NodeAlloc;
+    typedef std::allocator_traits<NodeAlloc> NodeTraits;
+    NodeAlloc nodeAlloc(alloc);
+    BST_TRACE_EVENT(TRACE_NODE_FREE, node, sizeof(NodeType));
+    NodeTraits::destroy(nodeAlloc, node);
+    NodeTraits::deallocate(nodeAlloc, node, 1);
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the PersistentAVLTree class.
+  ---------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,370 @@
+#ifndef RANKED_AVL_H
+#define RANKED_AVL_H
+
+#include <cstddef>
+#include "avlbst.h"
+
+/**
+* An AVL node that also records how many nodes its subtree holds
+* (itself included), which is what rank and select are computed from.
+*/
+template <typename Key, typename Value, typename Links = PointerNodeLinks>
+class RankedAVLNode : public AVLNode<Key, Value, Links>
+{
+public:
+    // Constructor/destructor.
+    RankedAVLNode(const Key& key, const Value& value, RankedAVLNode<Key, Value, Links>* parent);
+    RankedAVLNode(Key&& key, Value&& value, RankedAVLNode<Key, Value, Links>* parent);
+    RankedAVLNode(NodeItemBuilder<Key, Value>& item, RankedAVLNode<Key, Value, Links>* parent);
+    ~RankedAVLNode();
+
+    // Getter/setter for the size of the node's subtree.
+    std::size_t getSize() const;
+    void setSize(std::size_t size);
+
+    // Hide the AVLNode versions, as AVLNode does for Node.
+    RankedAVLNode<Key, Value, Links>* getParent() const;
+    RankedAVLNode<Key, Value, Links>* getLeft() const;
+    RankedAVLNode<Key, Value, Links>* getRight() const;
+
+    static std::size_t sizeOf(const RankedAVLNode<Key, Value, Links>* node);
+
+protected:
+    std::size_t size_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RankedAVLNode class.
+  -------------------------------------------------
+*/
+
+/**
+* A new node is a leaf, so its subtree holds just itself.
+*/
+template<class Key, class Value, class Links>
+RankedAVLNode<Key, Value, Links>::RankedAVLNode(const Key& key, const Value& value, RankedAVLNode<Key, Value, Links>* parent) :
+    AVLNode<Key, Value, Links>(key, value, parent), size_(1)
+{
+
+}
+
+template<class Key, class Value, class Links>
+RankedAVLNode<Key, Value, Links>::RankedAVLNode(Key&& key, Value&& value, RankedAVLNode<Key, Value, Links>* parent) :
+    AVLNode<Key, Value, Links>(std::move(key), std::move(value), parent), size_(1)
+{
+
+}
+
+template<class Key, class Value, class Links>
+RankedAVLNode<Key, Value, Links>::RankedAVLNode(NodeItemBuilder<Key, Value>& item, RankedAVLNode<Key, Value, Links>* parent) :
+    AVLNode<Key, Value, Links>(item, parent), size_(1)
+{
+
+}
+
+template<class Key, class Value, class Links>
+RankedAVLNode<Key, Value, Links>::~RankedAVLNode()
+{
+
+}
+
+template<class Key, class Value, class Links>
+std::size_t RankedAVLNode<Key, Value, Links>::getSize() const
+{
+    return size_;
+}
+
+template<class Key, class Value, class Links>
+void RankedAVLNode<Key, Value, Links>::setSize(std::size_t size)
+{
+    size_ = size;
+}
+
+template<class Key, class Value, class Links>
+RankedAVLNode<Key, Value, Links>* RankedAVLNode<Key, Value, Links>::getParent() const
+{
+    return static_cast<RankedAVLNode<Key, Value, Links>*>(Node<Key, Value, Links>::getParent());
+}
+
+template<class Key, class Value, class Links>
+RankedAVLNode<Key, Value, Links>* RankedAVLNode<Key, Value, Links>::getLeft() const
+{
+    return static_cast<RankedAVLNode<Key, Value, Links>*>(Node<Key, Value, Links>::getLeft());
+}
+
+template<class Key, class Value, class Links>
+RankedAVLNode<Key, Value, Links>* RankedAVLNode<Key, Value, Links>::getRight() const
+{
+    return static_cast<RankedAVLNode<Key, Value, Links>*>(Node<Key, Value, Links>::getRight());
+}
+
+/**
+* Subtree size of node, where an empty subtree has size 0.
+*/
+template<class Key, class Value, class Links>
+std::size_t RankedAVLNode<Key, Value, Links>::sizeOf(const RankedAVLNode<Key, Value, Links>* node)
+{
+    return node == NULL ? 0 : node->size_;
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RankedAVLNode class.
+  -----------------------------------------------
+*/
+
+
+/**
+* An AVL tree with order statistics: select(k), rank(key) and
+* percentile(p) all run in O(log n). Each node keeps its subtree size,
+* which the AVL hooks below keep current through inserts, removals,
+* rotations and bulk builds. Use a plain AVLTree when these queries are
+* not needed, since keeping sizes costs a word per node and a walk to the
+* root on every insert and remove.
+*/
+template <class Key, class Value, class Alloc = std::allocator<std::pair<const Key, Value> >,
+          class Compare = std::less<Key> >
+class RankedAVLTree : public AVLTree<Key, Value, Alloc, Compare>
+{
+public:
+    typedef typename AVLTree<Key, Value, Alloc, Compare>::iterator iterator;
+
+    RankedAVLTree();
+    explicit RankedAVLTree(const Alloc& alloc);
+    explicit RankedAVLTree(const Compare& comp, const Alloc& alloc = Alloc());
+    virtual ~RankedAVLTree();
+
+    iterator select(std::size_t k) const;
+    std::size_t rank(const Key& key) const;
+    iterator percentile(double p) const;
+
+protected:
+    typedef typename AVLTree<Key, Value, Alloc, Compare>::NodeLinks NodeLinks;
+    typedef typename AVLTree<Key, Value, Alloc, Compare>::NodeType NodeType;
+    typedef typename AVLTree<Key, Value, Alloc, Compare>::AVLNodeType AVLNodeType;
+    typedef RankedAVLNode<Key, Value, NodeLinks> RankedNodeType;
+
+    virtual NodeType* createNode(NodeItemBuilder<Key, Value>& item, NodeType* parent);
+    virtual void destroyNode(NodeType* node);
+    virtual void balanceAfterInsert(NodeType* node);
+    virtual void balanceAfterBuild(NodeType* node, int leftHeight, int rightHeight);
+    virtual void nodeSwap(AVLNodeType* n1, AVLNodeType* n2);
+    virtual void updateAfterRotate(AVLNodeType* down, AVLNodeType* up);
+    virtual void updateAfterUnlink(AVLNodeType* parent);
+    virtual void updateAfterRelink(AVLNodeType* node);
+    virtual std::size_t countNodes() const;
+
+    static void recomputeSize(RankedNodeType* node);
+};
+
+template<class Key, class Value, class Alloc, class Compare>
+RankedAVLTree<Key, Value, Alloc, Compare>::RankedAVLTree()
+{
+
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+RankedAVLTree<Key, Value, Alloc, Compare>::RankedAVLTree(const Alloc& alloc) :
+    AVLTree<Key, Value, Alloc, Compare>(alloc)
+{
+
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+RankedAVLTree<Key, Value, Alloc, Compare>::RankedAVLTree(const Compare& comp, const Alloc& alloc) :
+    AVLTree<Key, Value, Alloc, Compare>(comp, alloc)
+{
+
+}
+
+/**
+* Clears here for the same reason as AVLTree: destroyNode has to reach
+* the RankedAVLNode version.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+RankedAVLTree<Key, Value, Alloc, Compare>::~RankedAVLTree()
+{
+    this->clear();
+}
+
+/**
+* Returns an iterator to the k-th smallest key (counting from 0), or
+* end() if the tree holds k keys or fewer.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename RankedAVLTree<Key, Value, Alloc, Compare>::iterator
+RankedAVLTree<Key, Value, Alloc, Compare>::select(std::size_t k) const
+{
+    RankedNodeType* current = static_cast<RankedNodeType*>(this->root_);
+    while (current != NULL) {
+        std::size_t leftSize = RankedNodeType::sizeOf(current->getLeft());
+        if (k < leftSize) {
+            current = current->getLeft();
+        }
+        else if (k > leftSize) {
+            k -= leftSize + 1;
+            current = current->getRight();
+        }
+        else {
+            return this->iteratorAt(current);
+        }
+    }
+    return this->end();
+}
+
+/**
+* Returns the number of keys in the tree that are smaller than key,
+* whether or not key itself is present.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t RankedAVLTree<Key, Value, Alloc, Compare>::rank(const Key& key) const
+{
+    std::size_t below = 0;
+    RankedNodeType* current = static_cast<RankedNodeType*>(this->root_);
+    while (current != NULL) {
+        int order = compareKeys(this->comp_, key, current->getKey());
+        if (order < 0) {
+            current = current->getLeft();
+        }
+        else if (order > 0) {
+            below += RankedNodeType::sizeOf(current->getLeft()) + 1;
+            current = current->getRight();
+        }
+        else {
+            return below + RankedNodeType::sizeOf(current->getLeft());
+        }
+    }
+    return below;
+}
+
+/**
+* Returns the p-th percentile (0 <= p <= 100) by the nearest-rank method:
+* the smallest key with at least p percent of the keys at or below it.
+* p = 0 gives the smallest key. Returns end() for an empty tree.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename RankedAVLTree<Key, Value, Alloc, Compare>::iterator
+RankedAVLTree<Key, Value, Alloc, Compare>::percentile(double p) const
+{
+    std::size_t n = this->size();
+    if (n == 0) {
+        return this->end();
+    }
+    if (p <= 0) {
+        return select(0);
+    }
+    if (p >= 100) {
+        return select(n - 1);
+    }
+    double position = p / 100 * n;
+    std::size_t k = static_cast<std::size_t>(position);
+    if (k == position) { //exactly on a key: that key is the nearest rank
+        --k;
+    }
+    return select(k < n ? k : n - 1);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename RankedAVLTree<Key, Value, Alloc, Compare>::NodeType*
+RankedAVLTree<Key, Value, Alloc, Compare>::createNode(NodeItemBuilder<Key, Value>& item, NodeType* parent)
+{
+    return this->allocateNode(item, static_cast<RankedNodeType*>(parent));
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+void RankedAVLTree<Key, Value, Alloc, Compare>::destroyNode(NodeType* node)
+{
+    this->deallocateNode(static_cast<RankedNodeType*>(node));
+}
+
+/**
+* Counts the new node in every subtree above it, then rebalances. The
+* sizes have to be current before insertFix, whose rotations rely on them.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void RankedAVLTree<Key, Value, Alloc, Compare>::balanceAfterInsert(NodeType* node)
+{
+    RankedNodeType* ancestor = static_cast<RankedNodeType*>(node)->getParent();
+    while (ancestor != NULL) {
+        ancestor->setSize(ancestor->getSize() + 1);
+        ancestor = ancestor->getParent();
+    }
+    AVLTree<Key, Value, Alloc, Compare>::balanceAfterInsert(node);
+}
+
+/**
+* build_from_sorted links children before their parent, so each size can
+* be summed from the children's.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void RankedAVLTree<Key, Value, Alloc, Compare>::balanceAfterBuild(NodeType* node, int leftHeight, int rightHeight)
+{
+    recomputeSize(static_cast<RankedNodeType*>(node));
+    AVLTree<Key, Value, Alloc, Compare>::balanceAfterBuild(node, leftHeight, rightHeight);
+}
+
+/**
+* Sizes belong to positions in the tree, so they swap along with the nodes.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void RankedAVLTree<Key, Value, Alloc, Compare>::nodeSwap(AVLNodeType* n1, AVLNodeType* n2)
+{
+    AVLTree<Key, Value, Alloc, Compare>::nodeSwap(n1, n2);
+    RankedNodeType* r1 = static_cast<RankedNodeType*>(n1);
+    RankedNodeType* r2 = static_cast<RankedNodeType*>(n2);
+    std::size_t tempS = r1->getSize();
+    r1->setSize(r2->getSize());
+    r2->setSize(tempS);
+}
+
+/**
+* A rotation only changes the subtrees of the two nodes involved: the one
+* that moved down is recomputed first, since the one above includes it.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void RankedAVLTree<Key, Value, Alloc, Compare>::updateAfterRotate(AVLNodeType* down, AVLNodeType* up)
+{
+    recomputeSize(static_cast<RankedNodeType*>(down));
+    recomputeSize(static_cast<RankedNodeType*>(up));
+}
+
+/**
+* Uncounts the removed node from every subtree above it.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void RankedAVLTree<Key, Value, Alloc, Compare>::updateAfterUnlink(AVLNodeType* parent)
+{
+    RankedNodeType* ancestor = static_cast<RankedNodeType*>(parent);
+    while (ancestor != NULL) {
+        ancestor->setSize(ancestor->getSize() - 1);
+        ancestor = ancestor->getParent();
+    }
+}
+
+/**
+* split and join relink nodes bottom-up, so the children are already counted.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void RankedAVLTree<Key, Value, Alloc, Compare>::updateAfterRelink(AVLNodeType* node)
+{
+    recomputeSize(static_cast<RankedNodeType*>(node));
+}
+
+/**
+* The root already knows, so size() stays O(1) after a split.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t RankedAVLTree<Key, Value, Alloc, Compare>::countNodes() const
+{
+    return RankedNodeType::sizeOf(static_cast<RankedNodeType*>(this->root_));
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+void RankedAVLTree<Key, Value, Alloc, Compare>::recomputeSize(RankedNodeType* node)
+{
+    node->setSize(1 + RankedNodeType::sizeOf(node->getLeft())
+                    + RankedNodeType::sizeOf(node->getRight()));
+}
+
+#endif
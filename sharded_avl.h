@@ -0,0 +1,567 @@
+#ifndef SHARDED_AVL_H
+#define SHARDED_AVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "avlbst.h"
+#include "epoch.h"
+
+/**
+ * A reader-writer spin lock: any number of readers, or one writer.
+ * A waiting writer keeps new readers out, so writers are not starved.
+ * Waiters yield rather than block, which suits the short critical
+ * sections of a map operation.
+ */
+class ReadWriteLock
+{
+public:
+    ReadWriteLock() : state_(0) { }
+
+    void lock();
+    void unlock();
+    void lockShared();
+    void unlockShared();
+
+private:
+    ReadWriteLock(const ReadWriteLock&);
+    ReadWriteLock& operator=(const ReadWriteLock&);
+
+    static const uint32_t WRITER = 1u << 31;
+    static const uint32_t WRITER_WAITING = 1u << 30;
+    static const uint32_t READERS = WRITER_WAITING - 1;
+
+    std::atomic<uint32_t> state_;   // WRITER, WRITER_WAITING and the reader count
+};
+
+inline void ReadWriteLock::lock()
+{
+    uint32_t state = state_.load();
+    while (true) {
+        if ((state & (WRITER | READERS)) == 0) {
+            if (state_.compare_exchange_weak(state, WRITER)) {
+                return;
+            }
+            continue;
+        }
+        if ((state & WRITER_WAITING) == 0) {
+            state_.compare_exchange_weak(state, state | WRITER_WAITING);
+        }
+        std::this_thread::yield();
+        state = state_.load();
+    }
+}
+
+/**
+* Keeps WRITER_WAITING, so another waiting writer still goes first.
+*/
+inline void ReadWriteLock::unlock()
+{
+    state_.fetch_and(~WRITER);
+}
+
+inline void ReadWriteLock::lockShared()
+{
+    uint32_t state = state_.load();
+    while (true) {
+        if ((state & (WRITER | WRITER_WAITING)) == 0) {
+            if (state_.compare_exchange_weak(state, state + 1)) {
+                return;
+            }
+            continue;
+        }
+        std::this_thread::yield();
+        state = state_.load();
+    }
+}
+
+inline void ReadWriteLock::unlockShared()
+{
+    state_.fetch_sub(1);
+}
+
+/**
+ * An ordered map split by key range over a fixed number of AVLTree
+ * shards, each behind its own ReadWriteLock, so threads working on
+ * different ranges never wait for each other.
+ *
+ * Shard i holds the keys in [splitters[i-1], splitters[i]). The map
+ * starts with all keys in shard 0. Each time a shard in use fills up
+ * while some are unused, the keys are spread evenly over one more
+ * shard; once all are in use, they are spread evenly again whenever a
+ * shard grows well past its share or shrinks well below it. Spreading
+ * moves keys between neighbours with AVLTree::split and join, so the
+ * boundaries follow the keys actually present: after uniform inserts
+ * the shards stay within a small factor of each other, rather than
+ * each spill halving the range of the last. The splitters live in an
+ * immutable Layout that is replaced (and retired through
+ * defaultEpochDomain()) whenever a boundary moves. An operation finds
+ * its shard from the Layout, locks it, and starts over if the Layout
+ * changed meanwhile.
+ *
+ * Values are copied out, never returned by reference. forEach() visits
+ * the shards in key order, each under its read lock, and needs Key to
+ * be default constructible.
+ */
+template <typename Key, typename Value>
+class ShardedAVLMap
+{
+public:
+    explicit ShardedAVLMap(std::size_t shards = 16);
+    ~ShardedAVLMap();
+
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    bool remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+
+    std::size_t size() const;
+    bool empty() const;
+    void clear();
+
+    template<typename Function>
+    void forEach(Function function) const;
+
+    std::size_t shardCount() const;
+    std::vector<std::size_t> shardSizes() const;
+
+protected:
+    struct Layout
+    {
+        std::vector<Key> splitters;   // shards past splitters.size() are not in use yet
+    };
+
+    struct Shard
+    {
+        Shard() : count(0) { }
+        mutable ReadWriteLock lock;
+        AVLTree<Key, Value> tree;
+        std::atomic<std::size_t> count;
+    };
+
+    /**
+    * Releases a shard locked by lockShard() when it goes out of scope.
+    */
+    class ShardGuard
+    {
+    public:
+        ShardGuard(Shard& shard, bool exclusive) : shard_(shard), exclusive_(exclusive) { }
+        ~ShardGuard()
+        {
+            if (exclusive_) {
+                shard_.lock.unlock();
+            }
+            else {
+                shard_.lock.unlockShared();
+            }
+        }
+    private:
+        ShardGuard(const ShardGuard&);
+        ShardGuard& operator=(const ShardGuard&);
+        Shard& shard_;
+        bool exclusive_;
+    };
+
+    // the keys are spread again once a shard holds more than
+    // REBALANCE_FACTOR times its share plus REBALANCE_MIN, or less than
+    // its share over REBALANCE_FACTOR minus REBALANCE_MIN; while some
+    // shards are unused, one more is taken as soon as a shard holds
+    // REBALANCE_MIN
+    static const std::size_t REBALANCE_FACTOR = 2;
+    static const std::size_t REBALANCE_MIN = 1024;
+
+    static std::size_t shardOf(const Layout* layout, const Key& key);
+    std::size_t lockShard(const Key* key, bool exclusive, Key* upper, bool* hasUpper) const;
+    void maybeRebalance(std::size_t index);
+    void spread(std::size_t used);
+    void moveRight(std::size_t from, std::size_t to, std::size_t count, Layout* layout);
+    void moveLeft(std::size_t from, std::size_t to, std::size_t count, Layout* layout);
+
+    std::vector<Shard*> shards_;
+    std::atomic<Layout*> layout_;
+    std::atomic<std::size_t> inUse_;   // shards the layout has ranges for
+    std::atomic<std::size_t> size_;
+    std::mutex rebalanceLock_;   // one rebalance at a time; taken before any shard lock
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the ShardedAVLMap class.
+  -------------------------------------------------
+*/
+
+template<class Key, class Value>
+ShardedAVLMap<Key, Value>::ShardedAVLMap(std::size_t shards) :
+    layout_(new Layout()),
+    inUse_(1),
+    size_(0)
+{
+    if (shards == 0) {
+        shards = 1;
+    }
+    for (std::size_t i = 0; i < shards; ++i) {
+        shards_.push_back(new Shard());
+    }
+}
+
+/**
+* Retired layouts are the epoch domain's to free; only the current one
+* is freed here.
+*/
+template<class Key, class Value>
+ShardedAVLMap<Key, Value>::~ShardedAVLMap()
+{
+    for (std::size_t i = 0; i < shards_.size(); ++i) {
+        delete shards_[i];
+    }
+    delete layout_.load();
+}
+
+/**
+* Inserts the pair, overwriting the value if the key is already present.
+* Returns true if the key was new.
+*/
+template<class Key, class Value>
+bool ShardedAVLMap<Key, Value>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    std::size_t index = lockShard(&keyValuePair.first, true, NULL, NULL);
+    bool added;
+    {
+        Shard& shard = *shards_[index];
+        ShardGuard guard(shard, true);
+        added = shard.tree.insert(keyValuePair).second;
+        if (added) {
+            shard.count.fetch_add(1);
+            size_.fetch_add(1);
+        }
+    }
+    if (added) {
+        maybeRebalance(index);
+    }
+    return added;
+}
+
+/**
+* Removes the key if it is present. Returns true if it was.
+*/
+template<class Key, class Value>
+bool ShardedAVLMap<Key, Value>::remove(const Key& key)
+{
+    std::size_t index = lockShard(&key, true, NULL, NULL);
+    bool removed;
+    {
+        Shard& shard = *shards_[index];
+        ShardGuard guard(shard, true);
+        removed = shard.tree.find(key) != shard.tree.end();
+        if (removed) {
+            shard.tree.remove(key);
+            shard.count.fetch_sub(1);
+            size_.fetch_sub(1);
+        }
+    }
+    if (removed) {
+        maybeRebalance(index);
+    }
+    return removed;
+}
+
+/**
+* Copies the key's value into value and returns true, or returns false
+* if the key is not present.
+*/
+template<class Key, class Value>
+bool ShardedAVLMap<Key, Value>::find(const Key& key, Value& value) const
+{
+    Shard& shard = *shards_[lockShard(&key, false, NULL, NULL)];
+    ShardGuard guard(shard, false);
+    typename AVLTree<Key, Value>::iterator it = shard.tree.find(key);
+    if (it == shard.tree.end()) {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+template<class Key, class Value>
+bool ShardedAVLMap<Key, Value>::contains(const Key& key) const
+{
+    Shard& shard = *shards_[lockShard(&key, false, NULL, NULL)];
+    ShardGuard guard(shard, false);
+    return shard.tree.find(key) != shard.tree.end();
+}
+
+/**
+* The number of keys. Exact when no update is in flight.
+*/
+template<class Key, class Value>
+std::size_t ShardedAVLMap<Key, Value>::size() const
+{
+    return size_.load();
+}
+
+template<class Key, class Value>
+bool ShardedAVLMap<Key, Value>::empty() const
+{
+    return size_.load() == 0;
+}
+
+/**
+* Empties every shard. The shard boundaries stay where they are.
+*/
+template<class Key, class Value>
+void ShardedAVLMap<Key, Value>::clear()
+{
+    for (std::size_t i = 0; i < shards_.size(); ++i) {
+        Shard& shard = *shards_[i];
+        shard.lock.lock();
+        ShardGuard guard(shard, true);
+        size_.fetch_sub(shard.count.load());
+        shard.tree.clear();
+        shard.count.store(0);
+    }
+}
+
+/**
+* Calls function(key, value) for every key in order, one shard at a
+* time under its read lock. Each step starts from where the last one
+* ended rather than from the next shard, so a key that is present for
+* the whole walk is visited exactly once even if boundaries move.
+* function must not call back into the map.
+*/
+template<class Key, class Value>
+template<typename Function>
+void ShardedAVLMap<Key, Value>::forEach(Function function) const
+{
+    Key from;
+    bool started = false;
+    while (true) {
+        Key upper;
+        bool hasUpper;
+        Shard& shard = *shards_[lockShard(started ? &from : NULL, false, &upper, &hasUpper)];
+        {
+            ShardGuard guard(shard, false);
+            typename AVLTree<Key, Value>::iterator it = started ? shard.tree.lower_bound(from) : shard.tree.begin();
+            for ( ; it != shard.tree.end(); ++it) {
+                function(it->first, it->second);
+            }
+        }
+        if (!hasUpper) {
+            return;
+        }
+        from = upper;
+        started = true;
+    }
+}
+
+template<class Key, class Value>
+std::size_t ShardedAVLMap<Key, Value>::shardCount() const
+{
+    return shards_.size();
+}
+
+/**
+* How many keys each shard holds, in key order.
+*/
+template<class Key, class Value>
+std::vector<std::size_t> ShardedAVLMap<Key, Value>::shardSizes() const
+{
+    std::vector<std::size_t> sizes;
+    for (std::size_t i = 0; i < shards_.size(); ++i) {
+        sizes.push_back(shards_[i]->count.load());
+    }
+    return sizes;
+}
+
+/**
+* The shard whose range holds key: one past the last splitter <= key.
+*/
+template<class Key, class Value>
+std::size_t ShardedAVLMap<Key, Value>::shardOf(const Layout* layout, const Key& key)
+{
+    std::size_t low = 0;
+    std::size_t high = layout->splitters.size();
+    while (low < high) {
+        std::size_t middle = low + (high - low) / 2;
+        if (key < layout->splitters[middle]) {
+            high = middle;
+        }
+        else {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+/**
+* Locks the shard that holds key (or the first shard, if key is NULL)
+* and returns its index. The Layout is only a guess until the shard is
+* locked, since moving a boundary takes the locks of both shards it
+* separates; if the Layout changed in between, unlock and look again.
+* If upper is given, it receives the shard's upper bound, if it has one.
+*/
+template<class Key, class Value>
+std::size_t ShardedAVLMap<Key, Value>::lockShard(const Key* key, bool exclusive, Key* upper, bool* hasUpper) const
+{
+    EpochDomain::Guard guard(defaultEpochDomain());
+    while (true) {
+        Layout* layout = layout_.load();
+        std::size_t index = key == NULL ? 0 : shardOf(layout, *key);
+        Shard& shard = *shards_[index];
+        if (exclusive) {
+            shard.lock.lock();
+        }
+        else {
+            shard.lock.lockShared();
+        }
+        if (layout_.load() == layout) {
+            if (upper != NULL) {
+                *hasUpper = index < layout->splitters.size();
+                if (*hasUpper) {
+                    *upper = layout->splitters[index];
+                }
+            }
+            return index;
+        }
+        if (exclusive) {
+            shard.lock.unlock();
+        }
+        else {
+            shard.lock.unlockShared();
+        }
+    }
+}
+
+/**
+* Spreads the keys evenly again if shard index, which just grew or
+* shrank, is far from its share of them, or over one more shard if it
+* filled up while some are unused. Skipped if another rebalance is
+* already running; a later update will try again.
+*/
+template<class Key, class Value>
+void ShardedAVLMap<Key, Value>::maybeRebalance(std::size_t index)
+{
+    std::size_t used = inUse_.load();
+    std::size_t count = shards_[index]->count.load();
+    std::size_t share = size_.load() / used;
+    bool grow = used < shards_.size() && count > REBALANCE_MIN;
+    if (!grow && count <= REBALANCE_FACTOR * share + REBALANCE_MIN &&
+        count + REBALANCE_MIN >= share / REBALANCE_FACTOR) {
+        return;
+    }
+    std::unique_lock<std::mutex> rebalancing(rebalanceLock_, std::try_to_lock);
+    if (!rebalancing.owns_lock()) {
+        return;
+    }
+    used = layout_.load()->splitters.size() + 1;   // only rebalances change it
+    spread(grow && used < shards_.size() ? used + 1 : used);
+}
+
+/**
+* Moves keys between neighbouring shards until the first used shards
+* hold an equal share each. A first pass, in key order, pushes every
+* shard's surplus on to the next one; after it no shard but the last
+* holds more than its share. A second pass, in reverse, pushes the
+* surplus back, and since each shard then has at least its share
+* coming in from above, every one ends up with exactly its share.
+* Locks every shard involved, in index order, and must be called with
+* rebalanceLock_ held.
+*/
+template<class Key, class Value>
+void ShardedAVLMap<Key, Value>::spread(std::size_t used)
+{
+    for (std::size_t i = 0; i < used; ++i) {
+        shards_[i]->lock.lock();
+    }
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < used; ++i) {
+        total += shards_[i]->count.load();
+    }
+    if (total >= used) {   // otherwise some shard would be left with no keys, and no boundary
+        Layout* layout = layout_.load();
+        Layout* replacement = new Layout(*layout);
+        for (std::size_t i = 0; i + 1 < used; ++i) {
+            std::size_t share = total / used + (i < total % used ? 1 : 0);
+            std::size_t count = shards_[i]->count.load();
+            if (count > share) {
+                moveRight(i, i + 1, count - share, replacement);
+            }
+        }
+        for (std::size_t i = used - 1; i > 0; --i) {
+            std::size_t share = total / used + (i < total % used ? 1 : 0);
+            std::size_t count = shards_[i]->count.load();
+            if (count > share) {
+                moveLeft(i, i - 1, count - share, replacement);
+            }
+        }
+        layout_.store(replacement);
+        inUse_.store(replacement->splitters.size() + 1);
+        defaultEpochDomain().retire(layout);
+    }
+    for (std::size_t i = used; i > 0; --i) {
+        shards_[i - 1]->lock.unlock();
+    }
+}
+
+/**
+* Moves the count largest keys of shard from to shard to, just above it.
+* Both shards must be locked.
+*/
+template<class Key, class Value>
+void ShardedAVLMap<Key, Value>::moveRight(std::size_t from, std::size_t to, std::size_t count, Layout* layout)
+{
+    AVLTree<Key, Value>& source = shards_[from]->tree;
+    AVLTree<Key, Value>& target = shards_[to]->tree;
+    typename AVLTree<Key, Value>::iterator it = source.end();
+    for (std::size_t i = 0; i < count; ++i) {
+        --it;
+    }
+    Key splitter = it->first;
+    AVLTree<Key, Value> moved(source.getAllocator());
+    source.split(splitter, moved);
+    moved.join(target);
+    target.join(moved);   // target is empty, so this just takes moved's nodes
+    if (from < layout->splitters.size()) {
+        layout->splitters[from] = splitter;
+    }
+    else {
+        layout->splitters.push_back(splitter);   // to was not in use yet
+    }
+    shards_[from]->count.fetch_sub(count);
+    shards_[to]->count.fetch_add(count);
+}
+
+/**
+* Moves the count smallest keys of shard from to shard to, just below it.
+* Both shards must be locked.
+*/
+template<class Key, class Value>
+void ShardedAVLMap<Key, Value>::moveLeft(std::size_t from, std::size_t to, std::size_t count, Layout* layout)
+{
+    AVLTree<Key, Value>& source = shards_[from]->tree;
+    AVLTree<Key, Value>& target = shards_[to]->tree;
+    typename AVLTree<Key, Value>::iterator it = source.begin();
+    for (std::size_t i = 0; i < count; ++i) {
+        ++it;
+    }
+    Key splitter = it->first;
+    AVLTree<Key, Value> rest(source.getAllocator());
+    source.split(splitter, rest);
+    target.join(source);
+    source.join(rest);   // source is empty, so this just takes rest's nodes
+    layout->splitters[to] = splitter;
+    shards_[from]->count.fetch_sub(count);
+    shards_[to]->count.fetch_add(count);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the ShardedAVLMap class.
+  -----------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,315 @@
+#ifndef SPLAY_TREE_H
+#define SPLAY_TREE_H
+
+#include <cstddef>
+#include "bst.h"
+
+/**
+* A self-adjusting binary search tree (Sleator and Tarjan). find, insert
+* and remove splay the node they reach to the root with zig-zig and
+* zig-zag rotations, so each costs O(log n) amortized, and keys used
+* often stay within a few levels of the root, and in cache. Under a
+* skewed access pattern that beats a balanced tree.
+*
+* Splaying writes to every node on the access path, even for a find.
+* setSplayInterval(k) splays on only every k-th access; the others are
+* plain searches and removals that leave the rest of the tree alone. Hot
+* keys still rise to the top, only more slowly, and the amortized bound
+* no longer holds for k > 1. A const tree never splays on find.
+*
+* Nodes are plain Nodes: a splay tree keeps no balance information.
+*/
+template <class Key, class Value, class Alloc = std::allocator<std::pair<const Key, Value> >,
+          class Compare = std::less<Key> >
+class SplayTree : public BinarySearchTree<Key, Value, Alloc, Compare>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator iterator;
+
+    SplayTree();
+    explicit SplayTree(const Alloc& alloc);
+    explicit SplayTree(const Compare& comp, const Alloc& alloc = Alloc());
+
+    // The const finds stay visible and never splay
+    using BinarySearchTree<Key, Value, Alloc, Compare>::find;
+    iterator find(const Key& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key);
+    virtual void remove(const Key& key);
+
+    void setSplayInterval(std::size_t interval);
+    std::size_t getSplayInterval() const;
+
+protected:
+    typedef typename BinarySearchTree<Key, Value, Alloc, Compare>::NodeType NodeType;
+
+    virtual void balanceAfterInsert(NodeType* node);
+    virtual void balanceAfterFind(NodeType* node);
+
+    // Add helper functions here
+    template<typename K>
+    NodeType* findAndSplay(const K& key);
+    bool splayDue();
+    void splay(NodeType* node);
+    void rotateUp(NodeType* node);
+
+    std::size_t splayInterval_;   // splay on every splayInterval_-th access
+    std::size_t untilSplay_;      // accesses left until the next splay
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the SplayTree class.
+  -----------------------------------------------
+*/
+
+template<class Key, class Value, class Alloc, class Compare>
+SplayTree<Key, Value, Alloc, Compare>::SplayTree() :
+    splayInterval_(1),
+    untilSplay_(1)
+{
+
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+SplayTree<Key, Value, Alloc, Compare>::SplayTree(const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Alloc, Compare>(alloc),
+    splayInterval_(1),
+    untilSplay_(1)
+{
+
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+SplayTree<Key, Value, Alloc, Compare>::SplayTree(const Compare& comp, const Alloc& alloc) :
+    BinarySearchTree<Key, Value, Alloc, Compare>(comp, alloc),
+    splayInterval_(1),
+    untilSplay_(1)
+{
+
+}
+
+/**
+* Returns an iterator to the item with the given key, or end(), and
+* splays the last node the search reached (the item, or its would-be
+* neighbour on a miss) to the root if this access is due to splay.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename SplayTree<Key, Value, Alloc, Compare>::iterator
+SplayTree<Key, Value, Alloc, Compare>::find(const Key& key)
+{
+    return this->iteratorAt(splayDue() ? findAndSplay(key) : this->internalFind(key));
+}
+
+/**
+* The same for a key of another type, when Compare is transparent.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename C, typename>
+typename SplayTree<Key, Value, Alloc, Compare>::iterator
+SplayTree<Key, Value, Alloc, Compare>::find(const K& key)
+{
+    return this->iteratorAt(splayDue() ? findAndSplay(key) : this->internalFind(key));
+}
+
+/**
+* Searches for key and splays the last node reached: the key's node, or
+* on a miss the leaf where the search fell off, since otherwise repeated
+* misses would keep paying for the same long path.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K>
+typename SplayTree<Key, Value, Alloc, Compare>::NodeType*
+SplayTree<Key, Value, Alloc, Compare>::findAndSplay(const K& key)
+{
+    NodeType* last = NULL;
+    NodeType* current = this->root_;
+    while (current != NULL) {
+        last = current;
+        int order = compareKeys(this->comp_, key, current->getKey());
+        if (order < 0) {
+            current = current->getLeft();
+        }
+        else if (order > 0) {
+            current = current->getRight();
+        }
+        else {
+            break;
+        }
+    }
+    if (current != NULL) {
+        BST_TRACE_EVENT(TRACE_LOOKUP, current, 1);
+    }
+    else {
+        BST_TRACE_EVENT(TRACE_LOOKUP, this->root_, 0);
+    }
+    if (last != NULL) {
+        splay(last);
+    }
+    return current;
+}
+
+/**
+* Removes key if present. When this access splays, the node is splayed
+* to the root, then the largest node of its left subtree is splayed to
+* the top of that subtree, where it has no right child, and takes the
+* right subtree there. Otherwise key is removed as in BinarySearchTree.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void SplayTree<Key, Value, Alloc, Compare>::remove(const Key& key)
+{
+    if (!splayDue()) {
+        BinarySearchTree<Key, Value, Alloc, Compare>::remove(key);
+        return;
+    }
+    NodeType* node = findAndSplay(key);
+    if (node == NULL) {
+        return;
+    }
+    this->trackUnlinked(node);
+    NodeType* left = node->getLeft();
+    NodeType* right = node->getRight();
+    if (left == NULL) {
+        this->root_ = right;
+        if (right != NULL) {
+            right->setParent(NULL);
+        }
+    }
+    else {
+        left->setParent(NULL);
+        this->root_ = left;
+        NodeType* largest = left;
+        while (largest->getRight() != NULL) {
+            largest = largest->getRight();
+        }
+        splay(largest);
+        largest->setRight(right);
+        if (right != NULL) {
+            right->setParent(largest);
+        }
+    }
+    this->deallocateNode(node);
+}
+
+/**
+* Makes every interval-th find, insert and remove splay; the default,
+* 1, splays on every one. 0 is taken as 1.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void SplayTree<Key, Value, Alloc, Compare>::setSplayInterval(std::size_t interval)
+{
+    splayInterval_ = (interval == 0) ? 1 : interval;
+    untilSplay_ = splayInterval_;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+std::size_t SplayTree<Key, Value, Alloc, Compare>::getSplayInterval() const
+{
+    return splayInterval_;
+}
+
+/**
+* Splays a newly linked node to the root.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void SplayTree<Key, Value, Alloc, Compare>::balanceAfterInsert(NodeType* node)
+{
+    if (splayDue()) {
+        splay(node);
+    }
+}
+
+/**
+* Splays the node of a key an insert found already present.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void SplayTree<Key, Value, Alloc, Compare>::balanceAfterFind(NodeType* node)
+{
+    if (splayDue()) {
+        splay(node);
+    }
+}
+
+/**
+* Counts an access and says whether it should splay.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+bool SplayTree<Key, Value, Alloc, Compare>::splayDue()
+{
+    if (--untilSplay_ > 0) {
+        return false;
+    }
+    untilSplay_ = splayInterval_;
+    return true;
+}
+
+/**
+* Rotates node up to the root. When node and its parent are children on
+* the same side, the parent rotates first (zig-zig); this is what halves
+* the depth of the nodes along the path, and what a plain move-to-root
+* lacks. Otherwise node rotates up twice (zig-zag).
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void SplayTree<Key, Value, Alloc, Compare>::splay(NodeType* node)
+{
+    while (node->getParent() != NULL) {
+        NodeType* parent = node->getParent();
+        NodeType* grandparent = parent->getParent();
+        if (grandparent != NULL) {
+            if ((grandparent->getLeft() == parent) == (parent->getLeft() == node)) {
+                rotateUp(parent);
+            }
+            else {
+                rotateUp(node);
+            }
+        }
+        rotateUp(node);
+    }
+}
+
+/**
+* Rotates node above its parent, keeping the key order.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+void SplayTree<Key, Value, Alloc, Compare>::rotateUp(NodeType* node)
+{
+    NodeType* parent = node->getParent();
+    NodeType* grandparent = parent->getParent();
+    if (parent->getLeft() == node) {
+        BST_TRACE_EVENT(TRACE_ROTATE_RIGHT, parent, 0);
+        NodeType* inner = node->getRight();
+        parent->setLeft(inner);
+        if (inner != NULL) {
+            inner->setParent(parent);
+        }
+        node->setRight(parent);
+    }
+    else {
+        BST_TRACE_EVENT(TRACE_ROTATE_LEFT, parent, 0);
+        NodeType* inner = node->getLeft();
+        parent->setRight(inner);
+        if (inner != NULL) {
+            inner->setParent(parent);
+        }
+        node->setLeft(parent);
+    }
+    parent->setParent(node);
+    node->setParent(grandparent);
+    if (grandparent == NULL) {
+        this->root_ = node;
+    }
+    else if (grandparent->getLeft() == parent) {
+        grandparent->setLeft(node);
+    }
+    else {
+        grandparent->setRight(node);
+    }
+}
+
+/*
+  ---------------------------------------------
+  End implementations for the SplayTree class.
+  ---------------------------------------------
+*/
+
+#endif